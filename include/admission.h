@@ -0,0 +1,61 @@
+
+#pragma once
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stdint.h>
+
+
+// The default number of requests handled at once across every connection
+#define DB_ADMISSION_DEFAULT_ACTIVE  32
+
+// The default number of requests allowed to wait for a slot before new ones are shed
+#define DB_ADMISSION_DEFAULT_QUEUED  64
+
+// The longest a request without a deadline waits for a slot
+#define DB_ADMISSION_QUEUE_MS  100
+
+
+// A struct to store the decisions made by an admission gate
+typedef struct DBAdmissionStats {
+	uint64_t admitted;
+	uint64_t shed;
+	uint64_t expired;
+
+	// The most requests ever handled at once
+	size_t peakActive;
+} DBAdmissionStats;
+
+
+// Opaque gate bounding the requests handled and queued across every connection
+typedef struct DBAdmission DBAdmission;
+
+
+// Prototypes for creating and destroying admission gates
+DBCode createAdmission(size_t, size_t, DBAdmission **);
+void destroyAdmission(DBAdmission *);
+
+// Prototypes for passing requests through the gate
+DBCode admitRequest(DBAdmission *, ULONG64);
+void releaseRequest(DBAdmission *);
+void readAdmissionStats(DBAdmission *, DBAdmissionStats *);
+
+// Prototype for attaching a deadline to the next request from the client-side
+DBCode sendRequestDeadline(SOCKET, DBIndex);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // ADMISSION_H
@@ -0,0 +1,57 @@
+
+#pragma once
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+
+// The fields an aggregation can group records by
+typedef enum DBGroupBy {
+	DB_GROUP_NONE,
+	DB_GROUP_BIRTH_YEAR,
+	DB_GROUP_BIRTH_MONTH,
+	DB_GROUP_LAST_INITIAL,
+	DB_GROUP_KINDS
+} DBGroupBy;
+
+
+// The size of one aggregate on the wire
+#define DB_AGGREGATE_WIRE_SIZE  14
+
+
+// A struct to store the COUNT/MIN/MAX results for one group
+typedef struct DBAggregate {
+
+	// The birth year, birth month or lastName initial of the group, or 0 if ungrouped
+	uint16_t key;
+
+	DBIndex count;
+
+	// The oldest and youngest birth dates, and the member born first
+	DBIndex oldestId;
+	DBDate oldest;
+	DBDate youngest;
+} DBAggregate;
+
+
+// Prototype for server-side aggregation handling
+DBCode handleAggregateRequest(DBContext *, SOCKET);
+
+// Prototype for client-side aggregation handling
+DBCode sendAggregateRequest(SOCKET, DBGroupBy, DBAggregate *, DBIndex, DBIndex *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // AGGREGATE_H
@@ -0,0 +1,102 @@
+
+#pragma once
+#ifndef ARENA_H
+#define ARENA_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stddef.h>
+
+
+// The alignment of every slab block and arena allocation
+#define DB_SLAB_ALIGNMENT  64
+
+// The size of the blocks in each slab class
+#define DB_SLAB_RECORD_SIZE  ((sizeof(DBRecord) + DB_SLAB_ALIGNMENT - 1) / DB_SLAB_ALIGNMENT * DB_SLAB_ALIGNMENT)
+#define DB_SLAB_FRAME_SIZE   ((size_t)32 * 1024)
+
+// The default limit on outstanding blocks per class, bounding memory under connection storms
+#define DB_SLAB_DEFAULT_LIMIT  4096
+
+
+// The fixed block sizes served by a slab pool
+typedef enum DBSlabClass {
+	DB_SLAB_RECORD,
+	DB_SLAB_FRAME,
+	DB_SLAB_CLASSES
+} DBSlabClass;
+
+
+// A struct to store the usage counters of one slab class
+typedef struct DBSlabStats {
+	size_t outstanding;
+	size_t cached;
+	size_t highWater;
+	size_t failures;
+} DBSlabStats;
+
+
+// Opaque pool of recycled blocks shared by every connection
+typedef struct DBSlabPool DBSlabPool;
+
+// Forward declaration for the frame blocks owned by an arena
+typedef struct DBArenaBlock DBArenaBlock;
+
+
+// A struct to store a bump allocator that is reset after every request
+typedef struct DBArena {
+
+	DBSlabPool *pool;
+
+	// The frames in use, the newest first
+	DBArenaBlock *blocks;
+	size_t offset;
+
+	// Allocations too large for a frame, taken from the heap until the next reset
+	DBArenaBlock *large;
+
+	// The bytes allocated since the last reset and the most ever allocated
+	size_t used;
+	size_t highWater;
+} DBArena;
+
+
+// Prototypes for creating and destroying slab pools
+DBCode createSlabPool(DBSlabPool **, size_t);
+void destroySlabPool(DBSlabPool *);
+
+// Prototypes for allocating and freeing slab blocks
+void *allocateSlab(DBSlabPool *, DBSlabClass);
+void freeSlab(DBSlabPool *, DBSlabClass, void *);
+void readSlabStats(DBSlabPool *, DBSlabClass, DBSlabStats *);
+
+// Prototypes for using arenas
+void initArena(DBArena *, DBSlabPool *);
+void *allocateArena(DBArena *, size_t);
+void resetArena(DBArena *);
+void releaseArena(DBArena *);
+
+// Prototypes for binding an arena to the handling thread
+void bindArena(DBArena *);
+DBArena *boundArena(void);
+
+// Prototypes for request memory, served from the bound arena when there is one
+void *allocateRequestMemory(size_t);
+void freeRequestMemory(void *);
+DBRecord *allocateRequestRecord(void);
+void freeRequestRecord(DBRecord *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // ARENA_H
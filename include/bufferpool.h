@@ -0,0 +1,86 @@
+
+#pragma once
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "record.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// The number of record slots held by one page, so a page fills 4 KiB
+#define DB_POOL_PAGE_SLOTS  64
+
+// The default number of pages held by a pool
+#define DB_POOL_DEFAULT_PAGES  128
+
+// How often the background flusher writes out dirty pages
+#define DB_POOL_FLUSH_INTERVAL_MS  1000
+
+
+// The policies for choosing which page to evict
+typedef enum DBEvictionPolicy {
+
+	// Second chance for every page referenced since the hand last passed
+	DB_EVICT_CLOCK,
+
+	// Evict the page whose second most recent reference is oldest, so pages read once go first
+	DB_EVICT_LRU2,
+
+	DB_EVICT_POLICIES
+} DBEvictionPolicy;
+
+
+// A struct to store the effectiveness of a buffer pool
+typedef struct DBPoolStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	uint64_t flushes;
+
+	// Pages holding writes that have not been flushed
+	size_t dirtyPages;
+} DBPoolStats;
+
+
+// Opaque cache of fixed-size pages of record slots
+typedef struct DBBufferPool DBBufferPool;
+
+
+// Prototypes for creating and destroying buffer pools
+DBCode createBufferPool(size_t, DBEvictionPolicy, bool, DBBufferPool **);
+void destroyBufferPool(DBBufferPool *);
+
+// Prototypes for reading and writing records through a buffer pool
+DBCode readPoolRecord(DBContext *, DBRecord *);
+void writePoolRecords(DBBufferPool *, const DBRecord *, size_t);
+void writePoolSlots(DBBufferPool *, DBIndex, const DBRecordSlot *, size_t);
+
+// Prototypes for carrying the resident pages across restarts
+DBCode warmBufferPool(DBContext *, const DBIndex *, DBIndex);
+DBIndex readPoolWarmSet(DBBufferPool *, DBIndex *, DBIndex);
+
+// Prototypes for flushing dirty pages in the background
+DBCode flushBufferPool(DBContext *);
+DBCode startPoolFlusher(DBContext *);
+void stopPoolFlusher(DBBufferPool *);
+
+// Prototype for reading the effectiveness of a buffer pool
+void readPoolStats(DBBufferPool *, DBPoolStats *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,91 @@
+
+#pragma once
+#ifndef CHANGES_H
+#define CHANGES_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "snapshot.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// The default number of changes retained for subscribers to catch up from
+#define DB_CHANGE_DEFAULT_CAPACITY  16384
+
+// The most changes sent to a subscriber before waiting for its acknowledgement
+#define DB_CHANGE_BATCH_SIZE  256
+
+// How long an idle subscription waits before sending an empty batch
+#define DB_CHANGE_HEARTBEAT_MS  1000
+
+// How long closing a database waits for subscriptions to leave the change log
+#define DB_CHANGE_CLOSE_TIMEOUT_MS  (4 * DB_CHANGE_HEARTBEAT_MS)
+
+// The size of a sequence number on the wire
+#define DB_SEQUENCE_SIZE  8
+
+
+// The kinds of change recorded by the log
+typedef enum DBChangeKind {
+	DB_CHANGE_INSERT,
+	DB_CHANGE_UPDATE,
+	DB_CHANGE_KINDS
+} DBChangeKind;
+
+
+// A struct to store one applied insert or update
+typedef struct DBChange {
+
+	// The sequence of the commit that applied the change
+	DBSequence sequence;
+
+	DBChangeKind kind;
+	DBRecord record;
+} DBChange;
+
+
+// Callback type for consuming changes, passed NULL on idle heartbeats, returning non-success to stop
+typedef DBCode (*DBChangeCallback)(const DBChange *, void *);
+
+
+// Prototypes for creating and destroying change logs
+DBCode createChangeLog(DBSequence, size_t, DBChangeLog **);
+void closeChangeLog(DBChangeLog *);
+bool waitChangeReaders(DBChangeLog *, DWORD);
+void destroyChangeLog(DBChangeLog *);
+
+// Prototypes for registering subscriptions reading a change log
+DBCode attachChangeReader(DBChangeLog *);
+void detachChangeReader(DBChangeLog *);
+
+// Prototypes for recording changes from within a commit
+void appendChange(DBChangeLog *, DBSequence, DBChangeKind, const DBRecord *);
+void publishChanges(DBChangeLog *, DBSequence);
+
+// Prototypes for following the log from a sequence
+DBCode seekChanges(DBChangeLog *, DBSequence, uint64_t *);
+DBCode readChanges(DBChangeLog *, uint64_t *, DBChange *, size_t, size_t *, DWORD);
+
+// Prototypes for sending sequence numbers
+DBCode sendSequence(SOCKET, DBSequence);
+DBCode receiveSequence(SOCKET, DBSequence *);
+
+// Prototypes for subscribing over the wire
+DBCode handleSubscribeRequest(DBContext *, SOCKET);
+DBCode sendSubscribeRequest(SOCKET, DBSequence, DBChangeCallback, void *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // CHANGES_H
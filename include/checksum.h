@@ -0,0 +1,30 @@
+
+#pragma once
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+// Prototype for folding bytes into a running CRC32C value
+uint32_t updateCRC32C(uint32_t, const void *, size_t);
+
+// Prototype for checking whether the hardware CRC32C instruction is used
+bool hasHardwareCRC32C(void);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // CHECKSUM_H
@@ -0,0 +1,376 @@
+
+#pragma once
+#ifndef CLIENT_HPP
+#define CLIENT_HPP
+
+
+// The typed client is only available in C++20
+#if !defined(__cplusplus) || (defined(_MSVC_LANG) ? _MSVC_LANG : __cplusplus) < 202002L
+#error "client.hpp requires C++20"
+#endif
+
+
+#include "extra.h"
+#include "database.h"
+
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+
+namespace xtr {
+
+	namespace db {
+
+		namespace impl {
+
+			// Writes an integer most significant byte first, whatever the host byte order
+			template <typename T>
+			constexpr void store_network(T value, std::byte *out) noexcept {
+				using U = std::make_unsigned_t<T>;
+				for (std::size_t i = 0; i < sizeof(T); ++i) {
+					out[i] = static_cast<std::byte>(static_cast<U>(value) >> (8 * (sizeof(T) - 1 - i)));
+				}
+			}
+
+			// Reads an integer written by store_network
+			template <typename T>
+			constexpr T load_network(const std::byte *in) noexcept {
+				using U = std::make_unsigned_t<T>;
+				U value = 0;
+				for (std::size_t i = 0; i < sizeof(T); ++i) {
+					value = static_cast<U>((value << 8) | std::to_integer<U>(in[i]));
+				}
+				return static_cast<T>(value);
+			}
+
+			// The class and type of a pointer to data member
+			template <typename>
+			struct member_traits;
+
+			template <typename C, typename M>
+			struct member_traits<M C::*> {
+				using class_type = C;
+				using type = M;
+			};
+
+			template <auto Member>
+			using member_type = typename member_traits<decltype(Member)>::type;
+
+			// Whether fields tile their bytes in order with no gaps or overlaps
+			template <typename... Fields>
+			constexpr bool contiguous() noexcept {
+				constexpr std::size_t offsets[] = { Fields::offset... };
+				constexpr std::size_t sizes[] = { Fields::size... };
+				std::size_t expected = offsets[0];
+				for (std::size_t i = 0; i < sizeof...(Fields); ++i) {
+					if (offsets[i] != expected) {
+						return false;
+					}
+					expected += sizes[i];
+				}
+				return true;
+			}
+		}
+
+
+		// An integer field sent in network byte order
+		template <auto Member, std::size_t Offset>
+		struct integer_field {
+			using value_type = impl::member_type<Member>;
+			static_assert(std::is_integral_v<value_type>, "integer_field requires an integer member");
+
+			static constexpr std::size_t offset = Offset;
+			static constexpr std::size_t size = sizeof(value_type);
+
+			template <typename C>
+			static constexpr void encode(const C &object, std::byte *out) noexcept {
+				impl::store_network(object.*Member, out + Offset);
+			}
+
+			template <typename C>
+			static constexpr void decode(const std::byte *in, C &object) noexcept {
+				object.*Member = impl::load_network<value_type>(in + Offset);
+			}
+		};
+
+
+		// A field sent byte for byte, such as a fixed-size name or a single byte
+		template <auto Member, std::size_t Offset>
+		struct bytes_field {
+			using value_type = impl::member_type<Member>;
+			static_assert(std::is_trivially_copyable_v<value_type>, "bytes_field requires a trivially copyable member");
+
+			static constexpr std::size_t offset = Offset;
+			static constexpr std::size_t size = sizeof(value_type);
+
+			template <typename C>
+			static void encode(const C &object, std::byte *out) noexcept {
+				std::memcpy(out + Offset, &(object.*Member), size);
+			}
+
+			template <typename C>
+			static void decode(const std::byte *in, C &object) noexcept {
+				std::memcpy(&(object.*Member), in + Offset, size);
+			}
+		};
+
+
+		// A nested struct field described by its own fields, whose offsets are relative to it
+		template <auto Member, std::size_t Offset, typename... Fields>
+		struct struct_field {
+			static_assert(impl::contiguous<Fields...>(), "struct_field fields must tile the struct");
+
+			static constexpr std::size_t offset = Offset;
+			static constexpr std::size_t size = (Fields::size + ...);
+
+			template <typename C>
+			static void encode(const C &object, std::byte *out) noexcept {
+				(Fields::encode(object.*Member, out + Offset), ...);
+			}
+
+			template <typename C>
+			static void decode(const std::byte *in, C &object) noexcept {
+				(Fields::decode(in + Offset, object.*Member), ...);
+			}
+		};
+
+
+		// A fixed wire layout for a type, generated at compile time from its fields
+		template <typename T, typename... Fields>
+		struct layout {
+			static_assert(impl::contiguous<Fields...>(), "layout fields must tile the wire format");
+
+			using value_type = T;
+			static constexpr std::size_t size = (Fields::size + ...);
+
+			static void encode(const T &object, std::byte *out) noexcept {
+				(Fields::encode(object, out), ...);
+			}
+
+			static void decode(const std::byte *in, T &object) noexcept {
+				(Fields::decode(in, object), ...);
+			}
+		};
+
+
+		// The wire layout of a record's date starting Base bytes into the record, with only the year swapped
+		template <std::size_t Base>
+		using date_field = struct_field<&DBRecord::birthDate, offsetof(DBRecord, birthDate) - Base,
+			integer_field<&DBDate::year, offsetof(DBDate, year)>,
+			bytes_field<&DBDate::day, offsetof(DBDate, day)>,
+			bytes_field<&DBDate::month, offsetof(DBDate, month)>>;
+
+		// The wire layout of a record with its memberId, as sent by sendRecord
+		using record_codec = layout<DBRecord,
+			integer_field<&DBRecord::memberId, offsetof(DBRecord, memberId)>,
+			bytes_field<&DBRecord::firstName, offsetof(DBRecord, firstName)>,
+			bytes_field<&DBRecord::lastName, offsetof(DBRecord, lastName)>,
+			date_field<0>>;
+
+		// The wire layout of a record without its memberId, starting at the first name
+		using insert_codec = layout<DBRecord,
+			bytes_field<&DBRecord::firstName, offsetof(DBRecord, firstName) - sizeof(DBIndex)>,
+			bytes_field<&DBRecord::lastName, offsetof(DBRecord, lastName) - sizeof(DBIndex)>,
+			date_field<sizeof(DBIndex)>>;
+
+		// The C functions send the record struct whole, so the layouts must cover it exactly
+		static_assert(record_codec::size == sizeof(DBRecord));
+		static_assert(insert_codec::size == sizeof(DBRecord) - sizeof(DBIndex));
+
+
+		// Encodes records back to back into a caller-provided buffer, returning the bytes written
+		template <typename Codec>
+		std::size_t encode_batch(std::span<const typename Codec::value_type> objects, std::span<std::byte> out) noexcept {
+			assert_assume(out.size() >= objects.size() * Codec::size);
+			std::byte *cursor = out.data();
+			for (const auto &object : objects) {
+				Codec::encode(object, cursor);
+				cursor += Codec::size;
+			}
+			return objects.size() * Codec::size;
+		}
+
+		// Decodes records written back to back by encode_batch, returning the records read
+		template <typename Codec>
+		std::size_t decode_batch(std::span<const std::byte> in, std::span<typename Codec::value_type> objects) noexcept {
+			std::size_t count = in.size() / Codec::size;
+			assert_assume(objects.size() >= count);
+			const std::byte *cursor = in.data();
+			for (std::size_t i = 0; i < count; ++i) {
+				Codec::decode(cursor, objects[i]);
+				cursor += Codec::size;
+			}
+			return count;
+		}
+
+
+		// An owned, move-only block of encoded records ready to be sent
+		template <typename Codec>
+		class record_batch {
+		public:
+			explicit record_batch(std::span<const typename Codec::value_type> objects)
+				: count_(objects.size()), bytes_(new std::byte[objects.size() * Codec::size]) {
+				encode_batch<Codec>(objects, std::span<std::byte>(bytes_.get(), objects.size() * Codec::size));
+			}
+
+			record_batch(record_batch &&) noexcept = default;
+			record_batch &operator=(record_batch &&) noexcept = default;
+			record_batch(const record_batch &) = delete;
+			record_batch &operator=(const record_batch &) = delete;
+
+			std::size_t size() const noexcept {
+				return count_;
+			}
+
+			std::span<const std::byte> bytes() const noexcept {
+				return { bytes_.get(), count_ * Codec::size };
+			}
+
+		private:
+			std::size_t count_;
+			std::unique_ptr<std::byte[]> bytes_;
+		};
+
+		using insert_batch = record_batch<insert_codec>;
+
+
+		// A typed client for one connection, serializing every request made through it
+		class client {
+		public:
+			explicit client(SOCKET socket) noexcept : socket_(socket) {}
+
+			client(const client &) = delete;
+			client &operator=(const client &) = delete;
+
+			DBCode insert(const DBRecord &record) {
+				std::array<std::byte, insert_codec::size> wire;
+				insert_codec::encode(record, wire.data());
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				CONDITIONAL_RETURN(request(DB_REQUEST_INSERT));
+				CONDITIONAL_RETURN(send_bytes(wire));
+				return receive_response();
+			}
+
+			DBCode update(const DBRecord &record) {
+				std::array<std::byte, record_codec::size> wire;
+				record_codec::encode(record, wire.data());
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				CONDITIONAL_RETURN(request(DB_REQUEST_UPDATE));
+				CONDITIONAL_RETURN(send_bytes(wire));
+				return receive_response();
+			}
+
+			DBCode find(DBIndex memberId, DBRecord &record) {
+				std::array<std::byte, sizeof(DBIndex)> id;
+				impl::store_network(memberId, id.data());
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				CONDITIONAL_RETURN(request(DB_REQUEST_FIND));
+				CONDITIONAL_RETURN(send_bytes(id));
+				CONDITIONAL_RETURN(receive_response());
+
+				std::array<std::byte, record_codec::size> wire;
+				CONDITIONAL_RETURN(receive_bytes(wire));
+				record_codec::decode(wire.data(), record);
+
+				return sendCode(socket_, DB_SUCCESS);
+			}
+
+			// Inserts every record of a batch with one bulk load request and a single contiguous send
+			DBCode load(const insert_batch &batch, DBIndex &first) {
+				assert_assume(batch.size() <= DB_MAX_ENTRY);
+
+				std::lock_guard<std::mutex> lock(mutex_);
+				CONDITIONAL_RETURN(request(DB_REQUEST_LOAD));
+				CONDITIONAL_RETURN(sendIndex(socket_, static_cast<DBIndex>(batch.size())));
+				CONDITIONAL_RETURN(receive_response());
+				CONDITIONAL_RETURN(send_bytes(batch.bytes()));
+				CONDITIONAL_RETURN(receive_response());
+				return receiveIndex(socket_, &first);
+			}
+
+			// Finds each memberId in turn, stopping at the first failure
+			DBCode find_batch(std::span<const DBIndex> memberIds, std::span<DBRecord> records) {
+				assert_assume(records.size() >= memberIds.size());
+				for (std::size_t i = 0; i < memberIds.size(); ++i) {
+					CONDITIONAL_RETURN(find(memberIds[i], records[i]));
+				}
+				return DB_SUCCESS;
+			}
+
+			// Asynchronous requests run in order with other requests, and the client must outlive them
+			std::future<std::pair<DBCode, DBRecord>> find_async(DBIndex memberId) {
+				return std::async(std::launch::async, [this, memberId] {
+					DBRecord record{};
+					DBCode status = find(memberId, record);
+					return std::make_pair(status, record);
+				});
+			}
+
+			std::future<std::pair<DBCode, DBIndex>> load_async(insert_batch batch) {
+				return std::async(std::launch::async, [this, batch = std::move(batch)] {
+					DBIndex first = 0;
+					DBCode status = load(batch, first);
+					return std::make_pair(status, first);
+				});
+			}
+
+		private:
+
+			// Sends a request code and receives its confirmation
+			DBCode request(DBCode command) {
+				CONDITIONAL_RETURN(sendCode(socket_, command));
+				return receive_response();
+			}
+
+			DBCode receive_response() {
+				DBCode response;
+				CONDITIONAL_RETURN(receiveCode(socket_, &response));
+				return response;
+			}
+
+			DBCode send_bytes(std::span<const std::byte> bytes) {
+				while (!bytes.empty()) {
+					int chunk = static_cast<int>(bytes.size() < INT_MAX ? bytes.size() : INT_MAX);
+					int result = ::send(socket_, reinterpret_cast<const char *>(bytes.data()), chunk, 0);
+					if (result == SOCKET_ERROR || result == 0) {
+						return DB_SOCKET_ERROR;
+					}
+					bytes = bytes.subspan(static_cast<std::size_t>(result));
+				}
+				return DB_SUCCESS;
+			}
+
+			DBCode receive_bytes(std::span<std::byte> bytes) {
+				while (!bytes.empty()) {
+					int chunk = static_cast<int>(bytes.size() < INT_MAX ? bytes.size() : INT_MAX);
+					int result = ::recv(socket_, reinterpret_cast<char *>(bytes.data()), chunk, 0);
+					if (result == SOCKET_ERROR) {
+						return DB_SOCKET_ERROR;
+					}
+					if (result == 0) {
+						return DB_SOCKET_MISMATCH;
+					}
+					bytes = bytes.subspan(static_cast<std::size_t>(result));
+				}
+				return DB_SUCCESS;
+			}
+
+			SOCKET socket_;
+			std::mutex mutex_;
+		};
+	}
+}
+
+
+#endif // CLIENT_HPP
@@ -56,6 +56,34 @@ typedef uint16_t DBCode;
 #define DB_REQUEST_QUERY    ((DBCode)0b1000'0000'0000)
 
 #define DB_REQUEST_DENIED   ((DBCode)0b0001'0000'0000'0000)
+#define DB_REQUEST_BUSY     ((DBCode)0b0100'0000'0000'0000)
+
+// Extended requests are numbered rather than flagged to conserve code bits
+#define DB_REQUEST_EXTENDED  ((DBCode)0b0010'0000'0000'0000)
+#define DB_REQUEST_EXT(n)    ((DBCode)(DB_REQUEST_EXTENDED | ((n) << 4)))
+
+#define DB_REQUEST_EXPORT   DB_REQUEST_EXT(1)
+#define DB_REQUEST_BEGIN    DB_REQUEST_EXT(2)
+#define DB_REQUEST_COMMIT   DB_REQUEST_EXT(3)
+#define DB_REQUEST_ABORT    DB_REQUEST_EXT(4)
+#define DB_REQUEST_AGGREGATE  DB_REQUEST_EXT(5)
+#define DB_REQUEST_FILTER   DB_REQUEST_EXT(6)
+#define DB_REQUEST_LOAD     DB_REQUEST_EXT(7)
+#define DB_REQUEST_SORTED   DB_REQUEST_EXT(8)
+#define DB_REQUEST_SUBSCRIBE  DB_REQUEST_EXT(9)
+#define DB_REQUEST_LEASE    DB_REQUEST_EXT(10)
+#define DB_REQUEST_DEADLINE  DB_REQUEST_EXT(11)
+#define DB_REQUEST_FUZZY    DB_REQUEST_EXT(12)
+
+
+// Conditional return macro for database handling functions
+#define CONDITIONAL_RETURN(expr) \
+do { \
+	DBCode DBResult = (expr); \
+	if (DBResult != DB_SUCCESS) { \
+		return DBResult; \
+	} \
+} while(0)
 
 
 // The size of the name fields in the Record struct
@@ -95,6 +123,41 @@ typedef struct DBRecord {
 } DBRecord;
 
 
+// Callback type for consuming a stream of records, returning non-success to stop
+typedef DBCode (*DBRecordCallback)(const DBRecord *, void *);
+
+
+// Forward declarations for the optional database components
+typedef struct DBVersionStore DBVersionStore;
+typedef struct DBMetadata DBMetadata;
+typedef struct DBAdmission DBAdmission;
+typedef struct DBBufferPool DBBufferPool;
+typedef struct DBNameIndex DBNameIndex;
+
+// A struct to store the server-side state shared by every request
+typedef struct DBContext {
+
+	FILE *file;
+	DBIndex entries;
+
+	// When set, writes keep old versions for snapshots and file access is serialized
+	DBVersionStore *versions;
+
+	// Set only for databases opened with openDatabase
+	char *path;
+	DBMetadata *metadata;
+
+	// When set, bounds the requests handled and queued across every connection
+	DBAdmission *admission;
+
+	// When set, record lookups and updates go through a cache of fixed-size pages
+	DBBufferPool *pool;
+
+	// When set, record names are indexed by trigram for fuzzy search
+	DBNameIndex *names;
+} DBContext;
+
+
 // Prototypes for reading and writing records to files
 DBCode writeRecord(FILE *, const DBRecord *);
 DBCode readRecord(FILE *, DBRecord *);
@@ -107,14 +170,23 @@ DBCode receiveRecord(SOCKET, DBRecord *, bool);
 DBCode sendCode(SOCKET, DBCode);
 DBCode receiveCode(SOCKET, DBCode *);
 
-// Prototype for server-side request handling
+// Prototypes for sending and receiving indices to sockets
+DBCode sendIndex(SOCKET, DBIndex);
+DBCode receiveIndex(SOCKET, DBIndex *);
+
+// Prototypes for server-side request handling
 DBCode handleRequest(FILE *, SOCKET, DBCode, DBIndex *);
+DBCode handleContextRequest(DBContext *, SOCKET, DBCode);
 
 // Prototypes for client-size request handling
 DBCode sendInsertRequest(SOCKET, const DBRecord *);
 DBCode sendUpdateRequest(SOCKET, const DBRecord *);
 DBCode sendFindRequest(SOCKET, DBRecord *);
 DBCode sendQueryRequest(SOCKET, DBIndex *);
+DBCode sendExportRequest(SOCKET, DBRecordCallback, void *);
+
+// Prototype for positioning a file at a record
+DBCode seekRecord(FILE *, DBIndex);
 
 // Prototype for reading the database size
 DBCode readEntryCount(FILE *, DBIndex *);
@@ -53,6 +53,34 @@ namespace xtr {}
 #endif // cpp_restrict
 
 
+// Macro to portably declare thread-local storage
+#ifndef thread_storage
+
+#if defined(__cplusplus)
+#define thread_storage  thread_local
+#elif defined(_MSC_VER)
+#define thread_storage  __declspec(thread)
+#else
+#define thread_storage  _Thread_local
+#endif
+
+#endif // thread_storage
+
+
+// Macro to portably align a declaration, placed before the first member to align a struct
+#ifndef align_as
+
+#if defined(__cplusplus)
+#define align_as(n)  alignas(n)
+#elif defined(_MSC_VER)
+#define align_as(n)  __declspec(align(n))
+#else
+#define align_as(n)  _Alignas(n)
+#endif
+
+#endif // align_as
+
+
 // Macros for meta string literal conversion
 #if !defined(concat_string) && !defined(literal_string) && !defined(macro_string)
 
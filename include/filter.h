@@ -0,0 +1,110 @@
+
+#pragma once
+#ifndef FILTER_H
+#define FILTER_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "record.h"
+#include "scan.h"
+
+#include <stdint.h>
+
+
+// Limits on the size and shape of a filter program
+#define DB_FILTER_MAX_PROGRAM  512
+#define DB_FILTER_MAX_OPS      64
+#define DB_FILTER_MAX_DEPTH    16
+
+// The number of 64-bit words in the match mask of one scan block
+#define DB_FILTER_MASK_WORDS  ((DB_SCAN_BLOCK_SLOTS + 63) / 64)
+
+
+// The operations of the postfix filter bytecode
+typedef enum DBFilterOp {
+	DB_FILTER_EQ = 1,
+	DB_FILTER_NE,
+	DB_FILTER_LT,
+	DB_FILTER_LE,
+	DB_FILTER_GT,
+	DB_FILTER_GE,
+	DB_FILTER_PREFIX,
+	DB_FILTER_EQUALS,
+	DB_FILTER_AND,
+	DB_FILTER_OR,
+	DB_FILTER_NOT
+} DBFilterOp;
+
+
+// The record fields a filter can test
+typedef enum DBFilterField {
+	DB_FIELD_MEMBER_ID = 1,
+	DB_FIELD_BIRTH_YEAR,
+	DB_FIELD_BIRTH_MONTH,
+	DB_FIELD_BIRTH_DAY,
+	DB_FIELD_BIRTH_DATE,
+	DB_FIELD_FIRST_NAME,
+	DB_FIELD_LAST_NAME
+} DBFilterField;
+
+
+// A struct to store a filter program as the client builds it
+typedef struct DBFilter {
+	uint8_t program[DB_FILTER_MAX_PROGRAM];
+	uint16_t size;
+
+	// Set when an instruction did not fit; the server is never sent a truncated program
+	bool overflow;
+} DBFilter;
+
+
+// A struct to store one validated instruction with its operands decoded
+typedef struct DBFilterInstruction {
+	uint8_t op;
+	uint8_t field;
+	uint8_t length;
+	uint32_t value;
+	char text[DB_SLOT_NAME_SIZE];
+} DBFilterInstruction;
+
+// A struct to store a validated filter ready to run over scan blocks
+typedef struct DBCompiledFilter {
+	DBFilterInstruction instructions[DB_FILTER_MAX_OPS];
+	size_t count;
+} DBCompiledFilter;
+
+
+// Prototypes for building filters on the client-side
+void initFilter(DBFilter *);
+void filterCompare(DBFilter *, DBFilterOp, DBFilterField, uint32_t);
+void filterDate(DBFilter *, DBFilterOp, DBDate);
+void filterName(DBFilter *, DBFilterOp, DBFilterField, const char *);
+void filterCombine(DBFilter *, DBFilterOp);
+
+// Prototypes for compiling and running filters on the server-side
+DBCode compileFilter(const uint8_t *, size_t, DBCompiledFilter *);
+void evaluateFilter(const DBCompiledFilter *, const DBRecordSlot *, DBIndex, size_t, uint64_t *);
+
+// Prototypes for sending and receiving filters to sockets
+DBCode sendFilter(SOCKET, const DBFilter *);
+DBCode receiveFilter(SOCKET, DBCompiledFilter *);
+
+// Prototype for server-side filter handling
+DBCode handleFilterRequest(DBContext *, SOCKET);
+
+// Prototype for client-side filter handling
+DBCode sendFilterRequest(SOCKET, const DBFilter *, DBRecordCallback, void *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // FILTER_H
@@ -0,0 +1,67 @@
+
+#pragma once
+#ifndef FUZZY_H
+#define FUZZY_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+
+// The longest query, long enough for a first and last name separated by a space
+#define DB_FUZZY_MAX_QUERY  (2 * DB_RECORD_NAME_SIZE)
+
+// The largest edit distance a search accepts
+#define DB_FUZZY_MAX_DISTANCE  8
+
+// The most ranked matches returned by one search
+#define DB_FUZZY_MAX_RESULTS  64
+
+// Posting lists longer than this switch from sorted arrays to bitmaps, which are smaller past this length
+#define DB_FUZZY_ARRAY_LIMIT  2500
+
+
+// Callback type for consuming ranked matches, returning non-success to stop
+typedef DBCode (*DBFuzzyCallback)(const DBRecord *, DBIndex, void *);
+
+
+// A struct to store one match of a fuzzy search
+typedef struct DBFuzzyMatch {
+	DBIndex memberId;
+	DBIndex distance;
+} DBFuzzyMatch;
+
+
+// Opaque trigram index over the first and last names of every record
+typedef struct DBNameIndex DBNameIndex;
+
+
+// Prototypes for creating and destroying name indexes
+DBCode createNameIndex(DBNameIndex **);
+void destroyNameIndex(DBNameIndex *);
+
+// Prototypes for maintaining a name index
+DBCode buildNameIndex(DBContext *);
+void indexRecordName(DBNameIndex *, const DBRecord *);
+
+// Prototype for ranking records by the edit distance of their names from a query
+DBCode searchNames(DBNameIndex *, const char *, DBIndex, DBFuzzyMatch *, size_t, size_t *);
+
+// Prototype for server-side fuzzy search handling
+DBCode handleFuzzyRequest(DBContext *, SOCKET);
+
+// Prototype for client-side fuzzy search handling
+DBCode sendFuzzyRequest(SOCKET, const char *, DBIndex, DBFuzzyCallback, void *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // FUZZY_H
@@ -0,0 +1,61 @@
+
+#pragma once
+#ifndef LEASE_H
+#define LEASE_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stdint.h>
+
+
+// How long the server lets a client serve a record from its cache
+#define DB_LEASE_DURATION_MS  2000
+
+// The most invalidations sent with one response before the client is told to drop everything
+#define DB_LEASE_MAX_INVALIDATIONS  1024
+
+// The invalidation count telling the client to drop every cached record
+#define DB_LEASE_RESET  ((DBIndex)0xFFFF)
+
+
+// A struct to store the effectiveness of a lease cache
+typedef struct DBLeaseStats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t invalidations;
+	uint64_t resets;
+} DBLeaseStats;
+
+
+// Opaque client-side cache of leased records
+typedef struct DBLeaseCache DBLeaseCache;
+
+
+// Prototypes for creating and destroying lease caches
+DBCode createLeaseCache(DBLeaseCache **);
+void destroyLeaseCache(DBLeaseCache *);
+
+// Prototypes for using a lease cache, whose own updates must go through sendCachedUpdateRequest or invalidateLeaseCache
+DBCode sendCachedFindRequest(SOCKET, DBLeaseCache *, DBRecord *);
+DBCode sendCachedUpdateRequest(SOCKET, DBLeaseCache *, const DBRecord *);
+DBCode syncLeaseCache(SOCKET, DBLeaseCache *);
+void invalidateLeaseCache(DBLeaseCache *, DBIndex);
+void readLeaseStats(const DBLeaseCache *, DBLeaseStats *);
+
+// Prototype for granting leases from the server-side
+DBCode handleLeaseRequest(DBContext *, SOCKET);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // LEASE_H
@@ -0,0 +1,77 @@
+
+#pragma once
+#ifndef LISTENER_H
+#define LISTENER_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "arena.h"
+
+#include <stdint.h>
+
+
+// The most threads accepting on each listening socket
+#define DB_LISTENER_MAX_ACCEPTORS  16
+
+// The default number of threads accepting on each listening socket
+#define DB_LISTENER_DEFAULT_ACCEPTORS  4
+
+// The most connections served at once, beyond which new connections are closed on accept
+#define DB_LISTENER_MAX_CONNECTIONS  256
+
+// The range of waits before accepting again after the process ran out of sockets or buffers
+#define DB_LISTENER_MIN_BACKOFF_MS  10
+#define DB_LISTENER_MAX_BACKOFF_MS  1000
+
+
+// A struct to store the sockets a listener serves and how
+typedef struct DBListenerConfig {
+
+	// The TCP host name to listen on at DEFAULT_PORT, or NULL for no TCP listener
+	const char *host;
+
+	// The Unix domain socket path to listen on, abstract when it starts with '@', or NULL for none
+	const char *unixPath;
+
+	// The number of threads accepting on each socket
+	unsigned acceptors;
+
+	// When set, each connection allocates request memory from an arena backed by this pool
+	DBSlabPool *slabs;
+} DBListenerConfig;
+
+
+// A struct to store the connections seen by a listener
+typedef struct DBListenerStats {
+	uint64_t accepted;
+
+	// Connections closed on accept because the connection limit was reached
+	uint64_t refused;
+
+	size_t active;
+	size_t peakActive;
+} DBListenerStats;
+
+
+// Opaque set of listening sockets whose connections share one database
+typedef struct DBListener DBListener;
+
+
+// Prototypes for serving a database to socket connections
+DBCode startListener(const DBListenerConfig *, DBContext *, DBListener **);
+void stopListener(DBListener *);
+void readListenerStats(DBListener *, DBListenerStats *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // LISTENER_H
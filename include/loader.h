@@ -0,0 +1,54 @@
+
+#pragma once
+#ifndef LOADER_H
+#define LOADER_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stddef.h>
+
+
+// The most threads used to parse an input file
+#define DB_LOAD_MAX_THREADS  16
+
+// The smallest input chunk worth parsing on its own thread
+#define DB_LOAD_MIN_CHUNK  ((size_t)64 * 1024)
+
+
+// A struct to store the results of a bulk load
+typedef struct DBLoadStats {
+
+	// The non-empty rows read, excluding any header
+	size_t rows;
+	size_t loaded;
+	size_t rejected;
+
+	// The 1-based line number of the first rejected row, or 0
+	size_t firstRejected;
+
+	// The memberId assigned to the first loaded row, or 0
+	DBIndex first;
+} DBLoadStats;
+
+
+// Prototype for loading delimited text directly into a database
+DBCode loadDelimited(DBContext *, const char *, char, bool, DBLoadStats *);
+
+// Prototypes for loading a block of records over the wire
+DBCode handleLoadRequest(DBContext *, SOCKET);
+DBCode sendLoadRequest(SOCKET, const DBRecord *, DBIndex, DBIndex *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // LOADER_H
@@ -0,0 +1,64 @@
+
+#pragma once
+#ifndef METADATA_H
+#define METADATA_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "snapshot.h"
+
+
+// The suffix appended to a database path to name its metadata file
+#define DB_METADATA_SUFFIX  ".meta"
+
+// The most memberIds kept in the saved cache warm set
+#define DB_METADATA_WARM_MAX  1024
+
+// The most threads used to rebuild metadata after a crash
+#define DB_REBUILD_MAX_THREADS  16
+
+// The commit sequences reserved by each start, which a restart after a crash resumes past
+#define DB_METADATA_SEQUENCE_RESERVE  ((DBSequence)1 << 40)
+
+
+// A struct to store the state saved across restarts
+typedef struct DBMetadata {
+
+	DBIndex entries;
+
+	// The last commit sequence, so numbering stays monotonic across restarts
+	DBSequence sequence;
+
+	// Recently used memberIds that caches may preload on start
+	DBIndex warmCount;
+	DBIndex warm[DB_METADATA_WARM_MAX];
+
+	// Slots below entries that failed verification during a rebuild
+	DBIndex corrupt;
+} DBMetadata;
+
+
+// Prototypes for saving and loading metadata files
+DBCode saveMetadata(const char *, const DBMetadata *, bool);
+DBCode loadMetadata(const char *, FILE *, DBMetadata *);
+
+// Prototype for recovering metadata by scanning the database file
+DBCode rebuildMetadata(const char *, DBMetadata *);
+
+// Prototypes for the start and clean shutdown sequence
+DBCode openMetadata(const char *, const char *, FILE *, DBMetadata *);
+DBCode closeMetadata(const char *, const DBMetadata *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // METADATA_H
@@ -0,0 +1,62 @@
+
+#pragma once
+#ifndef NUMA_H
+#define NUMA_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+// Requests memory from whichever node the system chooses
+#define DB_NODE_ANY  ((ULONG)-1)
+
+
+// A struct to store how memory and threads were placed
+typedef struct DBMemoryStats {
+
+	// The large page size, or zero when large pages cannot be used
+	size_t largePageSize;
+
+	// Bytes allocated with large pages, and with ordinary pages
+	uint64_t largeBytes;
+	uint64_t smallBytes;
+
+	// Large page allocations that fell back to ordinary pages
+	uint64_t largeFallbacks;
+
+	// Threads pinned to a node, and the number of nodes
+	uint64_t pinnedThreads;
+	ULONG nodes;
+} DBMemoryStats;
+
+
+// Prototypes for allocating page-granular memory
+bool enableLargePages(void);
+void *allocatePages(size_t, bool, ULONG);
+void freePages(void *);
+
+// Prototypes for placing threads on nodes
+ULONG countNumaNodes(void);
+bool pinThreadToNode(HANDLE, ULONG);
+HANDLE startNodeThread(LPTHREAD_START_ROUTINE, void *, size_t);
+
+// Prototypes for reading placement, where the system reports it
+DBCode readPageNode(const void *, ULONG *, bool *);
+void readMemoryStats(DBMemoryStats *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // NUMA_H
@@ -0,0 +1,90 @@
+
+#pragma once
+#ifndef RECORD_H
+#define RECORD_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "extra.h"
+#include "database.h"
+
+#include <stdint.h>
+
+
+/*	On-disk record layout, version 2
+
+	Every record occupies one 64-byte slot at offset (memberId - 1) * 64, so
+	slots never straddle a cache line when the file is mapped at an aligned
+	address. All multi-byte fields are little-endian and no byte is padding.
+
+	Offset  Size  Field
+	0       4     checksum      CRC32C of bytes 4-63, seeded with the memberId
+	4       1     versionFlags  format version in the high nibble, flags in the low
+	5       3     birthDate     day in bits 0-4, month in bits 5-8, year in bits 9-23
+	8       28    firstName     NUL padded, not necessarily NUL terminated
+	36      28    lastName      NUL padded, not necessarily NUL terminated
+
+	The memberId is implied by the slot position; seeding the checksum with it
+	lets a record written to the wrong slot be detected like a torn write.
+*/
+
+
+// The size and alignment of a record slot
+#define DB_SLOT_SIZE  64
+
+// The size of the name fields in a record slot
+#define DB_SLOT_NAME_SIZE  (DB_RECORD_NAME_SIZE - 1)
+
+// The current slot format version
+#define DB_SLOT_VERSION  2
+
+// Slot flag bits stored in the low nibble of versionFlags
+#define DB_SLOT_FLAG_LIVE  0b0001
+
+// Accessors for the versionFlags byte
+#define DB_SLOT_VERSION_OF(vf)  ((uint8_t)((vf) >> 4))
+#define DB_SLOT_FLAGS_OF(vf)    ((uint8_t)((vf) & 0x0F))
+#define DB_SLOT_VERSION_FLAGS(version, flags)  ((uint8_t)(((version) << 4) | ((flags) & 0x0F)))
+
+// The widest year that fits the packed birthDate field
+#define DB_SLOT_MAX_YEAR  0x7FFF
+
+
+// A struct to store a record exactly as it is laid out on disk
+typedef struct DBRecordSlot {
+
+	align_as(DB_SLOT_SIZE) uint32_t checksum;
+
+	uint8_t versionFlags;
+	uint8_t birthDate[3];
+
+	char firstName[DB_SLOT_NAME_SIZE];
+	char lastName[DB_SLOT_NAME_SIZE];
+} DBRecordSlot;
+
+
+// Prototypes for converting between records and slots
+bool validRecordDate(const DBDate *);
+void encodeRecordSlot(const DBRecord *, DBRecordSlot *);
+void decodeRecordSlot(const DBRecordSlot *, DBIndex, DBRecord *);
+
+// Prototypes for computing and verifying the checksum stored in a slot
+uint32_t computeSlotChecksum(const DBRecordSlot *, DBIndex);
+DBCode verifyRecordSlot(const DBRecordSlot *, DBIndex);
+
+// Prototypes for converting files from the original compiler-defined layout
+DBCode readRecordV1(FILE *, DBRecord *);
+DBCode convertRecordFile(FILE *, FILE *, DBIndex *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // RECORD_H
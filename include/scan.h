@@ -0,0 +1,34 @@
+
+#pragma once
+#ifndef SCAN_H
+#define SCAN_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "record.h"
+
+
+// The number of slots read per block during a scan
+#define DB_SCAN_BLOCK_SLOTS  256
+
+
+// Callback type for consuming verified blocks of slots, returning non-success to stop
+typedef DBCode (*DBSlotCallback)(const DBRecordSlot *, DBIndex, size_t, void *);
+
+
+// Prototype for scanning every slot in a consistent view of the database
+DBCode scanSlots(DBContext *, DBSlotCallback, void *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // SCAN_H
@@ -0,0 +1,86 @@
+
+#pragma once
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// The default background rate in bytes per second
+#define DB_IO_DEFAULT_RATE  ((size_t)8 * 1024 * 1024)
+
+// The default smoothed foreground latency above which background work is slowed
+#define DB_IO_DEFAULT_TARGET_US  1000
+
+// How often the background rate is adjusted to the foreground latency
+#define DB_IO_ADJUST_INTERVAL_MS  100
+
+// Foreground latency older than this is stale, leaving the background free to recover
+#define DB_IO_IDLE_MS  1000
+
+
+// The classes of storage I/O, set per thread
+typedef enum DBIOClass {
+
+	// Request handling, which is never delayed
+	DB_IO_FOREGROUND,
+
+	// Maintenance, which is rate limited and gives way to the foreground
+	DB_IO_BACKGROUND
+} DBIOClass;
+
+
+// A struct to store the storage I/O seen by a scheduler
+typedef struct DBIOStats {
+	uint64_t foregroundOps;
+	uint64_t foregroundBytes;
+	uint64_t backgroundOps;
+	uint64_t backgroundBytes;
+
+	// Time background threads spent waiting for the rate limit
+	uint64_t throttledMs;
+
+	// The smoothed foreground latency, and the background rate it currently allows
+	uint64_t foregroundLatencyUs;
+	uint64_t backgroundRate;
+} DBIOStats;
+
+
+// Opaque process-wide scheduler of storage I/O
+typedef struct DBIOScheduler DBIOScheduler;
+
+
+// Prototypes for starting and stopping the process I/O scheduler
+DBCode startIOScheduler(size_t, DWORD, DBIOScheduler **);
+void stopIOScheduler(DBIOScheduler *);
+
+// Prototypes for controlling and observing the I/O scheduler
+void setBackgroundRate(DBIOScheduler *, size_t);
+void readIOStats(DBIOScheduler *, DBIOStats *);
+
+// Prototypes for classifying and pacing the I/O of the calling thread
+void setIOClass(DBIOClass);
+void paceIO(size_t);
+
+// Prototypes for storage I/O, which background threads must not issue while holding a lock requests wait on
+size_t scheduledRead(void *, size_t, size_t, FILE *);
+size_t scheduledWrite(const void *, size_t, size_t, FILE *);
+int scheduledFlush(FILE *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // SCHEDULER_H
@@ -0,0 +1,61 @@
+
+#pragma once
+#ifndef SCRUBBER_H
+#define SCRUBBER_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// The default scrub rate in bytes per second
+#define DB_SCRUB_DEFAULT_RATE  ((size_t)4 * 1024 * 1024)
+
+// The number of slots verified per read
+#define DB_SCRUB_BLOCK_SLOTS  64
+
+// The pause between full passes over the file
+#define DB_SCRUB_PASS_INTERVAL_MS  1000
+
+// The shortest pause between blocks, so the rate is held across blocks rather than rounded away per block
+#define DB_SCRUB_MIN_PAUSE_MS  16
+
+
+// A struct to store the results of scrubbing
+typedef struct DBScrubStats {
+	uint64_t passes;
+	uint64_t slotsChecked;
+	uint64_t corruptSlots;
+
+	// The memberId of the most recent corrupt slot, or 0
+	DBIndex lastCorrupt;
+} DBScrubStats;
+
+
+// Opaque background checksum verifier
+typedef struct DBScrubber DBScrubber;
+
+
+// Prototypes for running the background scrubber
+DBCode startScrubber(const char *, size_t, DBScrubber **);
+void stopScrubber(DBScrubber *);
+
+// Prototypes for controlling and observing the scrubber
+void setScrubberRate(DBScrubber *, size_t);
+void readScrubberStats(DBScrubber *, DBScrubStats *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // SCRUBBER_H
@@ -0,0 +1,68 @@
+
+#pragma once
+#ifndef SHARED_H
+#define SHARED_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stddef.h>
+
+
+// The number of clients that can attach to one shared memory server
+#define DB_SHARED_MAX_CLIENTS  16
+
+// The number of frames in each request and response ring, a power of two
+#define DB_SHARED_RING_FRAMES  64
+
+// The default number of polls before sleeping on an event, 0 to always sleep
+#define DB_SHARED_DEFAULT_SPIN  4096
+
+// How often a sleeping client checks that the server is still running
+#define DB_SHARED_LIVENESS_MS  1000
+
+
+// A struct to store one request or response in a ring
+typedef struct DBSharedFrame {
+
+	// The request code, replaced with the result status in the response
+	DBCode code;
+
+	// The number of entries returned by a query request
+	DBIndex entries;
+
+	// The record sent or returned, selected by memberId for find requests
+	DBRecord record;
+} DBSharedFrame;
+
+
+// Opaque shared memory server and client
+typedef struct DBSharedServer DBSharedServer;
+typedef struct DBSharedClient DBSharedClient;
+
+
+// Prototypes for serving a database over shared memory
+DBCode startSharedServer(const char *, DBContext *, unsigned, DBSharedServer **);
+void stopSharedServer(DBSharedServer *);
+
+// Prototypes for attaching to a shared memory server
+DBCode openSharedClient(const char *, unsigned, DBSharedClient **);
+void closeSharedClient(DBSharedClient *);
+
+// Prototypes for sending requests over shared memory
+DBCode sendSharedRequests(DBSharedClient *, DBSharedFrame *, size_t);
+DBCode sendSharedRequest(DBSharedClient *, DBSharedFrame *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // SHARED_H
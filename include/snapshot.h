@@ -0,0 +1,89 @@
+
+#pragma once
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+#include "record.h"
+
+#include <stdint.h>
+
+
+// The type used to hold commit sequence numbers
+typedef uint64_t DBSequence;
+
+// How often the background reclaimer frees unreachable versions
+#define DB_RECLAIM_INTERVAL_MS  250
+
+
+// Forward declaration for the optional log of committed changes
+typedef struct DBChangeLog DBChangeLog;
+
+
+// A struct to store a pinned read view of the database
+typedef struct DBSnapshot {
+
+	// Every commit with a sequence at or below this one is visible
+	DBSequence sequence;
+
+	// The number of entries that existed when the snapshot was pinned
+	DBIndex entries;
+
+	// Intrusive links in the store's list of pinned snapshots
+	struct DBSnapshot *prev;
+	struct DBSnapshot *next;
+} DBSnapshot;
+
+
+// Prototypes for creating and destroying the version store
+DBCode createVersionStore(DBVersionStore **);
+void destroyVersionStore(DBVersionStore *);
+
+// Prototypes for pinning and releasing snapshots
+DBCode beginSnapshot(DBVersionStore *, const DBIndex *, DBSnapshot *);
+void endSnapshot(DBVersionStore *, DBSnapshot *);
+
+// Prototype for reading a record as it was when a snapshot was pinned
+DBCode readSnapshotRecord(DBVersionStore *, FILE *, const DBSnapshot *, DBRecord *);
+
+// Prototype for reading a block of raw slots as they were when a snapshot was pinned
+DBCode readSnapshotSlots(DBVersionStore *, FILE *, const DBSnapshot *, DBIndex, size_t, DBRecordSlot *);
+
+// Prototypes for writing records as one atomic commit
+void beginCommit(DBVersionStore *);
+DBCode preserveRecord(DBVersionStore *, FILE *, DBIndex, DBIndex);
+DBCode commitRecord(DBVersionStore *, FILE *, const DBRecord *, DBIndex);
+DBCode endCommit(DBVersionStore *, FILE *);
+
+// Prototypes for recording commits in a change log
+void attachChangeLog(DBVersionStore *, DBChangeLog *);
+DBChangeLog *readChangeLog(DBVersionStore *);
+void logCommitRecord(DBVersionStore *, const DBRecord *, DBIndex);
+
+// Prototypes for carrying the commit sequence across restarts
+DBSequence readCommitSequence(DBVersionStore *);
+void restoreCommitSequence(DBVersionStore *, DBSequence);
+
+// Prototypes for serialized access to the database file outside of commits
+void lockVersionStore(DBVersionStore *);
+void unlockVersionStore(DBVersionStore *);
+
+// Prototypes for freeing versions that no snapshot can see
+size_t reclaimVersions(DBVersionStore *);
+DBCode startVersionReclaimer(DBVersionStore *);
+void stopVersionReclaimer(DBVersionStore *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // SNAPSHOT_H
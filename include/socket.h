@@ -12,10 +12,22 @@ extern "C" {
 
 #include "socket_base.h"
 
+#include <stdbool.h>
+
 
 // Prototypes for creating different types of sockets
 SOCKET createServer(const char *);
 SOCKET createClient(const char *);
+SOCKET createListener(const char *);
+
+// Prototypes for creating Unix domain sockets for same-host clients
+SOCKET createUnixListener(const char *);
+SOCKET createUnixClient(const char *);
+bool unixAddress(const char *, struct sockaddr_un *, int *);
+bool staleUnixSocket(const char *);
+
+// Prototype for bounding how long a socket may block
+bool setSocketTimeouts(SOCKET, DWORD, DWORD);
 
 
 #ifdef __cplusplus // extern "C" {
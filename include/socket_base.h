@@ -19,6 +19,7 @@ extern "C" {
 #include <Windows.h>
 #include <WinSock2.h>
 #include <WS2tcpip.h>
+#include <afunix.h>
 
 
 // Undefine invasive min & max macros
@@ -41,6 +42,15 @@ extern "C" {
 #define DEFAULT_PORT          "27015"
 #define DEFAULT_SERVER_NAME   "localhost"
 
+// Default Unix domain socket path for same-host clients, in the abstract namespace when it starts with '@'
+#define DEFAULT_UNIX_PATH     "@c-database"
+
+// Pending connections beyond the backlog are refused by the stack instead of queueing without bound
+#define DEFAULT_BACKLOG       64
+
+// A send stalled for longer than this fails, so a client that stops reading cannot pin a handler
+#define DEFAULT_SEND_TIMEOUT_MS  5000
+
 
 #ifdef __cplusplus // extern "C"
 }
@@ -0,0 +1,55 @@
+
+#pragma once
+#ifndef SORT_H
+#define SORT_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stddef.h>
+
+
+// The memory an ordered export may use for sorted runs before spilling them to disk
+#define DB_SORT_MEMORY_BUDGET  ((size_t)1024 * 1024)
+
+// The most runs sorted and spilled concurrently
+#define DB_SORT_MAX_THREADS  4
+
+// The number of records buffered from each spilled run during the merge
+#define DB_SORT_READ_RECORDS  256
+
+
+// The orders an export can be sorted in, with ties broken by memberId
+typedef enum DBSortKey {
+	DB_SORT_NAME,
+	DB_SORT_BIRTH_DATE,
+	DB_SORT_KINDS
+} DBSortKey;
+
+
+// Opaque external merge sort over a consistent view of the database
+typedef struct DBSortedScan DBSortedScan;
+
+
+// Prototypes for reading every record in sorted order
+DBCode beginSortedScan(DBContext *, DBSortKey, DBSortedScan **, DBIndex *);
+DBCode readSortedScan(DBSortedScan *, DBRecordCallback, void *);
+void endSortedScan(DBSortedScan *);
+
+// Prototypes for ordered exports over the wire
+DBCode handleSortedExportRequest(DBContext *, SOCKET);
+DBCode sendSortedExportRequest(SOCKET, DBSortKey, DBRecordCallback, void *);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // SORT_H
@@ -0,0 +1,46 @@
+
+#pragma once
+#ifndef STORAGE_H
+#define STORAGE_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+
+// Flags for opening an embedded database
+#define DB_OPEN_CREATE       0b00'0001
+#define DB_OPEN_VERSIONED    0b00'0010
+#define DB_OPEN_CHANGES      0b00'0100
+#define DB_OPEN_POOL         0b00'1000
+#define DB_OPEN_LARGE_PAGES  0b01'0000
+#define DB_OPEN_NAMES        0b10'0000
+
+
+// Prototypes for opening and closing a database in-process
+DBCode openDatabase(const char *, unsigned, DBContext **);
+DBCode closeDatabase(DBContext *);
+
+// Prototypes for transport-free storage operations
+DBCode insertRecord(DBContext *, DBRecord *);
+DBCode appendRecords(DBContext *, const DBRecord *, DBIndex, DBIndex *);
+DBCode updateRecord(DBContext *, const DBRecord *);
+DBCode findRecord(DBContext *, DBRecord *);
+DBCode countRecords(DBContext *, DBIndex *);
+DBCode scanRecords(DBContext *, DBRecordCallback, void *);
+
+// Prototype for bringing the in-memory structures up to date with the records of a commit
+void noteRecordWrites(DBContext *, const DBRecord *, size_t);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // STORAGE_H
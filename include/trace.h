@@ -0,0 +1,79 @@
+
+#pragma once
+#ifndef TRACE_H
+#define TRACE_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+#include <stdint.h>
+
+
+// The number of finished requests each thread can hold before the flusher drains them
+#define DB_TRACE_RING_SIZE  256
+
+// The most phases recorded for one request
+#define DB_TRACE_MAX_MARKS  16
+
+// How often the flusher writes finished requests to the trace file
+#define DB_TRACE_FLUSH_INTERVAL_MS  500
+
+// The defaults for tracing one request in this many, and for always tracing requests this slow
+#define DB_TRACE_DEFAULT_SAMPLE   1024
+#define DB_TRACE_DEFAULT_SLOW_MS  10
+
+
+// The phases a traced request passes through, each lasting until the next begins
+typedef enum DBTracePhase {
+	DB_TRACE_RECEIVE,
+	DB_TRACE_ADMIT,
+	DB_TRACE_VALIDATE,
+	DB_TRACE_IO,
+	DB_TRACE_SEND,
+	DB_TRACE_WAIT,
+	DB_TRACE_PHASES
+} DBTracePhase;
+
+
+// A struct to store the requests seen by a tracer
+typedef struct DBTraceStats {
+
+	// Requests kept because they were sampled or slow
+	uint64_t sampled;
+	uint64_t slow;
+
+	// Requests lost because their thread's ring was full
+	uint64_t dropped;
+
+	// Requests written to the trace file
+	uint64_t written;
+} DBTraceStats;
+
+
+// Opaque process-wide writer of sampled and slow requests
+typedef struct DBTracer DBTracer;
+
+
+// Prototypes for starting and stopping the process tracer
+DBCode startTracer(const char *, unsigned, DWORD, DBTracer **);
+DBCode stopTracer(DBTracer *);
+void readTraceStats(DBTracer *, DBTraceStats *);
+
+// Prototypes for recording the phases of a request on the calling thread
+void beginTrace(void);
+void markTrace(DBTracePhase);
+void endTrace(DBCode, DBCode);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // TRACE_H
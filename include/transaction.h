@@ -0,0 +1,36 @@
+
+#pragma once
+#ifndef TRANSACTION_H
+#define TRANSACTION_H
+
+
+// Compiler guard for external C code in C++
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "database.h"
+
+
+// The maximum number of writes buffered by one transaction
+#define DB_TRANSACTION_MAX_WRITES  256
+
+
+// Prototype for server-side transaction handling
+DBCode handleTransactionRequest(DBContext *, SOCKET);
+
+// Prototypes for client-side transaction handling
+DBCode sendBeginRequest(SOCKET);
+DBCode sendTransactionInsert(SOCKET, const DBRecord *);
+DBCode sendTransactionUpdate(SOCKET, const DBRecord *);
+DBCode sendCommitRequest(SOCKET, DBIndex *);
+DBCode sendAbortRequest(SOCKET);
+
+
+#ifdef __cplusplus // extern "C"
+}
+#endif
+
+
+#endif // TRANSACTION_H
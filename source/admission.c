@@ -0,0 +1,167 @@
+
+#include "extra.h"
+#include "admission.h"
+
+#include <stdlib.h>
+
+
+// A struct to store the state of an admission gate
+struct DBAdmission {
+
+	SRWLOCK lock;
+	CONDITION_VARIABLE released;
+
+	size_t maxActive;
+	size_t maxQueued;
+
+	size_t active;
+	size_t queued;
+
+	DBAdmissionStats stats;
+};
+
+
+
+/*	Name:           createAdmission
+	Description:    Allocates an admission gate
+	Parameters:     size_t maxActive:  The most requests handled at once
+	                size_t maxQueued:  The most requests waiting for a slot
+	                DBAdmission **admission:  The created gate
+	Returns:        DBCode:  A return status code
+*/
+DBCode createAdmission(size_t maxActive, size_t maxQueued, DBAdmission **admission) {
+
+	// Establish function preconditions
+	assert_assume(maxActive != 0);
+	assert_assume(admission != NULL);
+
+	DBAdmission *temp = calloc(1, sizeof(DBAdmission));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+	InitializeConditionVariable(&temp->released);
+	temp->maxActive = maxActive;
+	temp->maxQueued = maxQueued;
+
+	*admission = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           destroyAdmission
+	Description:    Frees an admission gate once no request is using it
+	Parameters:     DBAdmission *admission:  The gate to destroy
+	Returns:        void
+*/
+void destroyAdmission(DBAdmission *admission) {
+	free(admission);
+}
+
+
+/*	Name:           admitRequest
+	Description:    Waits for a slot to handle a request, shedding it when the queue is full or its deadline passes
+	Parameters:     DBAdmission *admission:  The gate to pass, or NULL to only check the deadline
+	                ULONG64 deadline:  The tick count by which the request must start, or 0 for none
+	Returns:        DBCode:  DB_SUCCESS if admitted, otherwise DB_REQUEST_BUSY
+*/
+DBCode admitRequest(DBAdmission *admission, ULONG64 deadline) {
+
+	if (admission == NULL) {
+		return (deadline != 0 && GetTickCount64() >= deadline) ? DB_REQUEST_BUSY : DB_SUCCESS;
+	}
+
+	AcquireSRWLockExclusive(&admission->lock);
+
+	// Refuse at once rather than grow an unbounded queue
+	if (admission->active >= admission->maxActive && admission->queued >= admission->maxQueued) {
+		++admission->stats.shed;
+		ReleaseSRWLockExclusive(&admission->lock);
+		return DB_REQUEST_BUSY;
+	}
+
+	ULONG64 now = GetTickCount64();
+	ULONG64 limit = (deadline != 0) ? deadline : now + DB_ADMISSION_QUEUE_MS;
+
+	++admission->queued;
+	while (admission->active >= admission->maxActive && now < limit) {
+		SleepConditionVariableSRW(&admission->released, &admission->lock, (DWORD)(limit - now), 0);
+		now = GetTickCount64();
+	}
+	--admission->queued;
+
+	// Work whose deadline passed while queued is dropped before it reaches storage
+	if (admission->active >= admission->maxActive || (deadline != 0 && now >= deadline)) {
+		++admission->stats.expired;
+		ReleaseSRWLockExclusive(&admission->lock);
+		return DB_REQUEST_BUSY;
+	}
+
+	++admission->active;
+	++admission->stats.admitted;
+	if (admission->active > admission->stats.peakActive) {
+		admission->stats.peakActive = admission->active;
+	}
+
+	ReleaseSRWLockExclusive(&admission->lock);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           releaseRequest
+	Description:    Frees the slot held by an admitted request
+	Parameters:     DBAdmission *admission:  The gate the request passed, or NULL
+	Returns:        void
+*/
+void releaseRequest(DBAdmission *admission) {
+
+	if (admission == NULL) {
+		return;
+	}
+
+	AcquireSRWLockExclusive(&admission->lock);
+	--admission->active;
+	ReleaseSRWLockExclusive(&admission->lock);
+
+	WakeConditionVariable(&admission->released);
+}
+
+
+/*	Name:           readAdmissionStats
+	Description:    Reads the decisions made by an admission gate
+	Parameters:     DBAdmission *admission:  The gate to read
+	                DBAdmissionStats *stats:  The counters
+	Returns:        void
+*/
+void readAdmissionStats(DBAdmission *admission, DBAdmissionStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(admission != NULL);
+	assert_assume(stats != NULL);
+
+	AcquireSRWLockShared(&admission->lock);
+	*stats = admission->stats;
+	ReleaseSRWLockShared(&admission->lock);
+}
+
+
+/*	Name:           sendRequestDeadline
+	Description:    Limits how long the server may queue the next request before shedding it
+	Parameters:     SOCKET socket:  The database socket the next request is sent with
+	                DBIndex milliseconds:  The time the request may wait from when the server reads it, or 0 for the default
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendRequestDeadline(SOCKET socket, DBIndex milliseconds) {
+
+	// Establish function preconditions
+	assert_assume(socket != INVALID_SOCKET);
+
+	// The deadline is a prefix to the next request, so it costs no round trip
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_DEADLINE));
+	CONDITIONAL_RETURN(sendIndex(socket, milliseconds));
+
+	return DB_SUCCESS;
+}
@@ -0,0 +1,342 @@
+
+#include "extra.h"
+#include "aggregate.h"
+#include "scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// The number of distinct keys for each grouping
+static const size_t groupKeys[DB_GROUP_KINDS] = {
+	1,
+	DB_SLOT_MAX_YEAR + 1,
+	16,
+	256
+};
+
+// The number of aggregates sent per call
+#define DB_AGGREGATE_SEND_BATCH  256
+
+
+// A struct to store the running aggregates of a scan
+typedef struct DBAggregateState {
+
+	DBGroupBy grouping;
+
+	// Per-key accumulators, comparing dates in their packed slot form
+	uint32_t *counts;
+	uint32_t *oldest;
+	uint32_t *youngest;
+	DBIndex *oldestIds;
+} DBAggregateState;
+
+
+// Prototypes for aggregation
+DBCode aggregateBlock(const DBRecordSlot *, DBIndex, size_t, void *);
+void packAggregate(uint8_t *, const DBAggregate *);
+void unpackAggregate(const uint8_t *, DBAggregate *);
+
+
+
+/*	Name:           accumulate
+	Description:    Folds one record into the aggregates of its group
+	Parameters:     DBAggregateState *state:  The running aggregates
+	                size_t key:  The group of the record
+	                uint32_t date:  The packed birth date of the record
+	                DBIndex memberId:  The memberId of the record
+	Returns:        void
+*/
+static inline void accumulate(DBAggregateState *state, size_t key, uint32_t date, DBIndex memberId) {
+
+	++state->counts[key];
+
+	// The packed layout orders dates by year, then month, then day
+	if (date < state->oldest[key]) {
+		state->oldest[key] = date;
+		state->oldestIds[key] = memberId;
+	}
+	if (date > state->youngest[key]) {
+		state->youngest[key] = date;
+	}
+}
+
+
+/*	Name:           unpackDate
+	Description:    Converts a date from its packed slot form
+	Parameters:     uint32_t packed:  The packed date
+	Returns:        DBDate:  The unpacked date
+*/
+static inline DBDate unpackDate(uint32_t packed) {
+
+	DBDate date;
+	date.day = (DBDateDay)(packed & 0x1F);
+	date.month = (DBDateMonth)((packed >> 5) & 0x0F);
+	date.year = (DBDateYear)(packed >> 9);
+
+	return date;
+}
+
+
+/*	Name:           aggregateBlock
+	Description:    Folds a block of slots into the running aggregates
+	Parameters:     DBRecordSlot *slots:  The slots to fold in
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots
+	                void *user:  The running aggregates
+	Returns:        DBCode:  A return status code
+*/
+DBCode aggregateBlock(const DBRecordSlot *slots, DBIndex first, size_t count, void *user) {
+
+	DBAggregateState *state = user;
+
+	// Select the key once per block so the inner loops carry no grouping branch
+	switch (state->grouping) {
+	case DB_GROUP_NONE:
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t date = slots[i].birthDate[0] | (uint32_t)slots[i].birthDate[1] << 8 | (uint32_t)slots[i].birthDate[2] << 16;
+			accumulate(state, 0, date, (DBIndex)(first + i));
+		}
+		break;
+
+	case DB_GROUP_BIRTH_YEAR:
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t date = slots[i].birthDate[0] | (uint32_t)slots[i].birthDate[1] << 8 | (uint32_t)slots[i].birthDate[2] << 16;
+			accumulate(state, date >> 9, date, (DBIndex)(first + i));
+		}
+		break;
+
+	case DB_GROUP_BIRTH_MONTH:
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t date = slots[i].birthDate[0] | (uint32_t)slots[i].birthDate[1] << 8 | (uint32_t)slots[i].birthDate[2] << 16;
+			accumulate(state, (date >> 5) & 0x0F, date, (DBIndex)(first + i));
+		}
+		break;
+
+	case DB_GROUP_LAST_INITIAL:
+		for (size_t i = 0; i < count; ++i) {
+			uint32_t date = slots[i].birthDate[0] | (uint32_t)slots[i].birthDate[1] << 8 | (uint32_t)slots[i].birthDate[2] << 16;
+			accumulate(state, (uint8_t)slots[i].lastName[0], date, (DBIndex)(first + i));
+		}
+		break;
+
+	default:
+		return DB_REQUEST_DENIED;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           packAggregate
+	Description:    Lays out an aggregate in network byte order
+	Parameters:     uint8_t *buffer:  The destination of DB_AGGREGATE_WIRE_SIZE bytes
+	                DBAggregate *aggregate:  The aggregate to pack
+	Returns:        void
+*/
+void packAggregate(uint8_t *buffer, const DBAggregate *aggregate) {
+
+	uint16_t fields[5] = {
+		htons(aggregate->key),
+		htons(aggregate->count),
+		htons(aggregate->oldestId),
+		htons(aggregate->oldest.year),
+		htons(aggregate->youngest.year)
+	};
+
+	memcpy(buffer, fields, sizeof(fields));
+	buffer[10] = aggregate->oldest.month;
+	buffer[11] = aggregate->oldest.day;
+	buffer[12] = aggregate->youngest.month;
+	buffer[13] = aggregate->youngest.day;
+}
+
+
+/*	Name:           unpackAggregate
+	Description:    Reads an aggregate laid out in network byte order
+	Parameters:     uint8_t *buffer:  The source of DB_AGGREGATE_WIRE_SIZE bytes
+	                DBAggregate *aggregate:  The unpacked aggregate
+	Returns:        void
+*/
+void unpackAggregate(const uint8_t *buffer, DBAggregate *aggregate) {
+
+	uint16_t fields[5];
+	memcpy(fields, buffer, sizeof(fields));
+
+	aggregate->key = ntohs(fields[0]);
+	aggregate->count = ntohs(fields[1]);
+	aggregate->oldestId = ntohs(fields[2]);
+	aggregate->oldest.year = ntohs(fields[3]);
+	aggregate->youngest.year = ntohs(fields[4]);
+	aggregate->oldest.month = buffer[10];
+	aggregate->oldest.day = buffer[11];
+	aggregate->youngest.month = buffer[12];
+	aggregate->youngest.day = buffer[13];
+}
+
+
+/*	Name:           handleAggregateRequest
+	Description:    Handles a database aggregation request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleAggregateRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send a confirmation code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Receive the grouping to aggregate by
+	DBCode grouping;
+	CONDITIONAL_RETURN(receiveCode(socket, &grouping));
+	if (grouping >= DB_GROUP_KINDS) {
+		return DB_REQUEST_DENIED;
+	}
+
+	size_t keys = groupKeys[grouping];
+
+	DBAggregateState state;
+	state.grouping = (DBGroupBy)grouping;
+	state.counts = calloc(keys, sizeof(uint32_t));
+	state.oldest = malloc(keys * sizeof(uint32_t));
+	state.youngest = calloc(keys, sizeof(uint32_t));
+	state.oldestIds = calloc(keys, sizeof(DBIndex));
+
+	DBCode status = DB_SUCCESS;
+	if (state.counts == NULL || state.oldest == NULL || state.youngest == NULL || state.oldestIds == NULL) {
+		status = DB_REQUEST_DENIED;
+	}
+	else {
+		memset(state.oldest, 0xFF, keys * sizeof(uint32_t));
+
+		// Compute every group in a single pass
+		status = scanSlots(context, aggregateBlock, &state);
+	}
+
+	// Count the groups that contain records
+	DBIndex groups = 0;
+	for (size_t key = 0; status == DB_SUCCESS && key < keys; ++key) {
+		if (state.counts[key] != 0) {
+			++groups;
+		}
+	}
+
+	// Send a confirmation code and the number of groups
+	if (status == DB_SUCCESS) {
+		status = sendCode(socket, DB_REQUEST_SUCCESS);
+	}
+	if (status == DB_SUCCESS) {
+		status = sendIndex(socket, groups);
+	}
+
+	// Send the non-empty groups in batches
+	uint8_t buffer[DB_AGGREGATE_SEND_BATCH * DB_AGGREGATE_WIRE_SIZE];
+	size_t batched = 0;
+	for (size_t key = 0; status == DB_SUCCESS && key < keys; ++key) {
+
+		if (state.counts[key] != 0) {
+
+			DBAggregate aggregate = {
+				(uint16_t)key,
+				(DBIndex)state.counts[key],
+				state.oldestIds[key],
+				unpackDate(state.oldest[key]),
+				unpackDate(state.youngest[key])
+			};
+			packAggregate(buffer + batched * DB_AGGREGATE_WIRE_SIZE, &aggregate);
+			++batched;
+		}
+
+		// Flush a full batch, or the remainder after the last key
+		if (batched != 0 && (batched == DB_AGGREGATE_SEND_BATCH || key + 1 == keys)) {
+			int size = (int)(batched * DB_AGGREGATE_WIRE_SIZE);
+			int result = send(socket, (const char *)buffer, size, 0);
+			if (result == SOCKET_ERROR) {
+				status = DB_SOCKET_ERROR;
+			}
+			else if (result != size) {
+				status = DB_SOCKET_MISMATCH;
+			}
+			batched = 0;
+		}
+	}
+
+	free(state.counts);
+	free(state.oldest);
+	free(state.youngest);
+	free(state.oldestIds);
+
+	CONDITIONAL_RETURN(status);
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendAggregateRequest
+	Description:    Sends a database aggregation request from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBGroupBy grouping:  The field to group records by
+	                DBAggregate *aggregates:  The received groups
+	                DBIndex capacity:  The number of groups the array can hold
+	                DBIndex *count:  The number of groups the server returned, which may exceed capacity
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendAggregateRequest(SOCKET socket, DBGroupBy grouping, DBAggregate *aggregates, DBIndex capacity, DBIndex *count) {
+
+	// Establish function preconditions
+	assert_assume(aggregates != NULL || capacity == 0);
+	assert_assume(count != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_AGGREGATE));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the grouping
+	CONDITIONAL_RETURN(sendCode(socket, (DBCode)grouping));
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive the number of groups
+	CONDITIONAL_RETURN(receiveIndex(socket, count));
+
+	// Receive every group, keeping as many as fit
+	for (DBIndex i = 0; i < *count; ++i) {
+
+		uint8_t buffer[DB_AGGREGATE_WIRE_SIZE];
+		int result = recv(socket, (char *)buffer, DB_AGGREGATE_WIRE_SIZE, MSG_WAITALL);
+		if (result == SOCKET_ERROR) {
+			return DB_SOCKET_ERROR;
+		}
+		else if (result != DB_AGGREGATE_WIRE_SIZE) {
+			return DB_SOCKET_MISMATCH;
+		}
+
+		if (i < capacity) {
+			unpackAggregate(buffer, &aggregates[i]);
+		}
+	}
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_SUCCESS));
+
+	return response;
+}
@@ -0,0 +1,425 @@
+
+#include "extra.h"
+#include "arena.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+// Portable aligned allocation for slab blocks
+#ifdef _MSC_VER
+#include <malloc.h>
+#define allocateAligned(size)  _aligned_malloc((size), DB_SLAB_ALIGNMENT)
+#define freeAligned(block)     _aligned_free(block)
+#else
+#define allocateAligned(size)  aligned_alloc(DB_SLAB_ALIGNMENT, (size))
+#define freeAligned(block)     free(block)
+#endif
+
+
+// A struct to store the header at the start of every arena frame
+struct DBArenaBlock {
+	DBArenaBlock *next;
+};
+
+// The usable bytes in a frame after its header
+#define DB_ARENA_HEADER_SIZE    DB_SLAB_ALIGNMENT
+#define DB_ARENA_PAYLOAD_SIZE   (DB_SLAB_FRAME_SIZE - DB_ARENA_HEADER_SIZE)
+
+
+// A struct to store the free list and counters of one slab class
+typedef struct DBSlabClassState {
+
+	SRWLOCK lock;
+
+	// Recycled blocks, linked through their first bytes
+	void *free;
+
+	DBSlabStats stats;
+} DBSlabClassState;
+
+
+// A struct to store the recycled blocks of every class
+struct DBSlabPool {
+	DBSlabClassState classes[DB_SLAB_CLASSES];
+	size_t limit;
+};
+
+
+// The arena serving requests on the current thread, if any
+static thread_storage DBArena *currentArena = NULL;
+
+
+// The block size of each slab class
+static const size_t slabSizes[DB_SLAB_CLASSES] = {
+	DB_SLAB_RECORD_SIZE,
+	DB_SLAB_FRAME_SIZE
+};
+
+
+
+/*	Name:           createSlabPool
+	Description:    Allocates an empty slab pool
+	Parameters:     DBSlabPool **pool:  The created pool
+	                size_t limit:  The most blocks of each class that may be outstanding
+	Returns:        DBCode:  A return status code
+*/
+DBCode createSlabPool(DBSlabPool **pool, size_t limit) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(limit != 0);
+
+	DBSlabPool *temp = calloc(1, sizeof(DBSlabPool));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	for (size_t i = 0; i < DB_SLAB_CLASSES; ++i) {
+		InitializeSRWLock(&temp->classes[i].lock);
+	}
+	temp->limit = limit;
+
+	*pool = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           destroySlabPool
+	Description:    Frees a slab pool and every block cached in it
+	Parameters:     DBSlabPool *pool:  The pool to destroy
+	Returns:        void
+*/
+void destroySlabPool(DBSlabPool *pool) {
+
+	if (pool == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < DB_SLAB_CLASSES; ++i) {
+
+		// Every block must have been returned first
+		assert(pool->classes[i].stats.outstanding == 0);
+
+		void *block = pool->classes[i].free;
+		while (block != NULL) {
+			void *next = *(void **)block;
+			freeAligned(block);
+			block = next;
+		}
+	}
+
+	free(pool);
+}
+
+
+/*	Name:           allocateSlab
+	Description:    Takes a block from a slab class, recycling freed blocks first
+	Parameters:     DBSlabPool *pool:  The pool to allocate from
+	                DBSlabClass slab:  The class of block to allocate
+	Returns:        void *:  The block, or NULL if the class is at its limit
+*/
+void *allocateSlab(DBSlabPool *pool, DBSlabClass slab) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(0 <= slab && slab < DB_SLAB_CLASSES);
+
+	DBSlabClassState *state = &pool->classes[slab];
+
+	AcquireSRWLockExclusive(&state->lock);
+
+	void *block = state->free;
+	if (block != NULL) {
+		state->free = *(void **)block;
+		--state->stats.cached;
+	}
+	else if (state->stats.outstanding < pool->limit) {
+		block = allocateAligned(slabSizes[slab]);
+	}
+
+	if (block != NULL) {
+		++state->stats.outstanding;
+		if (state->stats.outstanding > state->stats.highWater) {
+			state->stats.highWater = state->stats.outstanding;
+		}
+	}
+	else {
+		++state->stats.failures;
+	}
+
+	ReleaseSRWLockExclusive(&state->lock);
+
+	return block;
+}
+
+
+/*	Name:           freeSlab
+	Description:    Returns a block to its slab class for reuse
+	Parameters:     DBSlabPool *pool:  The pool the block was allocated from
+	                DBSlabClass slab:  The class the block was allocated from
+	                void *block:  The block to return
+	Returns:        void
+*/
+void freeSlab(DBSlabPool *pool, DBSlabClass slab, void *block) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(0 <= slab && slab < DB_SLAB_CLASSES);
+
+	if (block == NULL) {
+		return;
+	}
+
+	DBSlabClassState *state = &pool->classes[slab];
+
+	AcquireSRWLockExclusive(&state->lock);
+
+	*(void **)block = state->free;
+	state->free = block;
+
+	--state->stats.outstanding;
+	++state->stats.cached;
+
+	ReleaseSRWLockExclusive(&state->lock);
+}
+
+
+/*	Name:           readSlabStats
+	Description:    Reads the usage counters of a slab class
+	Parameters:     DBSlabPool *pool:  The pool to read from
+	                DBSlabClass slab:  The class to read
+	                DBSlabStats *stats:  The counters read
+	Returns:        void
+*/
+void readSlabStats(DBSlabPool *pool, DBSlabClass slab, DBSlabStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(0 <= slab && slab < DB_SLAB_CLASSES);
+	assert_assume(stats != NULL);
+
+	DBSlabClassState *state = &pool->classes[slab];
+
+	AcquireSRWLockShared(&state->lock);
+	*stats = state->stats;
+	ReleaseSRWLockShared(&state->lock);
+}
+
+
+/*	Name:           initArena
+	Description:    Initializes an empty arena drawing frames from a pool
+	Parameters:     DBArena *arena:  The arena to initialize
+	                DBSlabPool *pool:  The pool to draw frames from
+	Returns:        void
+*/
+void initArena(DBArena *arena, DBSlabPool *pool) {
+
+	// Establish function preconditions
+	assert_assume(arena != NULL);
+	assert_assume(pool != NULL);
+
+	arena->pool = pool;
+	arena->blocks = NULL;
+	arena->offset = DB_ARENA_PAYLOAD_SIZE;
+	arena->large = NULL;
+	arena->used = 0;
+	arena->highWater = 0;
+}
+
+
+/*	Name:           allocateArena
+	Description:    Bump-allocates memory that lives until the arena is reset
+	Parameters:     DBArena *arena:  The arena to allocate from
+	                size_t size:  The number of bytes to allocate
+	Returns:        void *:  The memory, or NULL on failure
+*/
+void *allocateArena(DBArena *arena, size_t size) {
+
+	// Establish function preconditions
+	assert_assume(arena != NULL);
+
+	if (size == 0 || size > SIZE_MAX - DB_ARENA_HEADER_SIZE - DB_SLAB_ALIGNMENT) {
+		return NULL;
+	}
+
+	// Keep every allocation on its own cache lines
+	size = (size + DB_SLAB_ALIGNMENT - 1) & ~(size_t)(DB_SLAB_ALIGNMENT - 1);
+
+	// An allocation larger than a frame comes from the heap, behind a header linking it for the reset
+	if (size > DB_ARENA_PAYLOAD_SIZE) {
+
+		DBArenaBlock *block = allocateAligned(DB_ARENA_HEADER_SIZE + size);
+		if (block == NULL) {
+			return NULL;
+		}
+
+		block->next = arena->large;
+		arena->large = block;
+
+		arena->used += size;
+		if (arena->used > arena->highWater) {
+			arena->highWater = arena->used;
+		}
+
+		return (char *)block + DB_ARENA_HEADER_SIZE;
+	}
+
+	// Start a new frame when the current one is full
+	if (DB_ARENA_PAYLOAD_SIZE - arena->offset < size) {
+
+		DBArenaBlock *block = allocateSlab(arena->pool, DB_SLAB_FRAME);
+		if (block == NULL) {
+			return NULL;
+		}
+
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->offset = 0;
+	}
+
+	void *memory = (char *)arena->blocks + DB_ARENA_HEADER_SIZE + arena->offset;
+	arena->offset += size;
+
+	arena->used += size;
+	if (arena->used > arena->highWater) {
+		arena->highWater = arena->used;
+	}
+
+	return memory;
+}
+
+
+/*	Name:           resetArena
+	Description:    Frees everything allocated from an arena, keeping one frame for the next request
+	Parameters:     DBArena *arena:  The arena to reset
+	Returns:        void
+*/
+void resetArena(DBArena *arena) {
+
+	// Establish function preconditions
+	assert_assume(arena != NULL);
+
+	// Large allocations are not recycled
+	DBArenaBlock *large = arena->large;
+	while (large != NULL) {
+		DBArenaBlock *next = large->next;
+		freeAligned(large);
+		large = next;
+	}
+	arena->large = NULL;
+
+	arena->used = 0;
+	if (arena->blocks == NULL) {
+		return;
+	}
+
+	// Return every frame except the newest to the pool
+	DBArenaBlock *block = arena->blocks->next;
+	while (block != NULL) {
+		DBArenaBlock *next = block->next;
+		freeSlab(arena->pool, DB_SLAB_FRAME, block);
+		block = next;
+	}
+
+	arena->blocks->next = NULL;
+	arena->offset = 0;
+}
+
+
+/*	Name:           releaseArena
+	Description:    Returns every frame of an arena to its pool
+	Parameters:     DBArena *arena:  The arena to release
+	Returns:        void
+*/
+void releaseArena(DBArena *arena) {
+
+	// Establish function preconditions
+	assert_assume(arena != NULL);
+
+	resetArena(arena);
+
+	freeSlab(arena->pool, DB_SLAB_FRAME, arena->blocks);
+	arena->blocks = NULL;
+	arena->offset = DB_ARENA_PAYLOAD_SIZE;
+}
+
+
+/*	Name:           bindArena
+	Description:    Sets the arena serving request memory on the current thread
+	Parameters:     DBArena *arena:  The arena to bind, or NULL to use the heap
+	Returns:        void
+*/
+void bindArena(DBArena *arena) {
+	currentArena = arena;
+}
+
+
+/*	Name:           boundArena
+	Description:    Gets the arena serving request memory on the current thread
+	Parameters:     void
+	Returns:        DBArena *:  The bound arena, or NULL
+*/
+DBArena *boundArena(void) {
+	return currentArena;
+}
+
+
+/*	Name:           allocateRequestMemory
+	Description:    Allocates memory that lives until the end of the current request
+	Parameters:     size_t size:  The number of bytes to allocate
+	Returns:        void *:  The memory, or NULL on failure
+*/
+void *allocateRequestMemory(size_t size) {
+
+	if (currentArena != NULL) {
+		return allocateArena(currentArena, size);
+	}
+
+	return malloc(size);
+}
+
+
+/*	Name:           freeRequestMemory
+	Description:    Frees request memory early; arena memory is freed by the next reset
+	Parameters:     void *memory:  The memory to free
+	Returns:        void
+*/
+void freeRequestMemory(void *memory) {
+
+	if (currentArena == NULL) {
+		free(memory);
+	}
+}
+
+
+/*	Name:           allocateRequestRecord
+	Description:    Allocates a record buffer, from the record slab class of the bound arena's pool when there is one
+	Parameters:     void
+	Returns:        DBRecord *:  The record, or NULL on failure
+*/
+DBRecord *allocateRequestRecord(void) {
+
+	if (currentArena != NULL) {
+		return allocateSlab(currentArena->pool, DB_SLAB_RECORD);
+	}
+
+	return malloc(sizeof(DBRecord));
+}
+
+
+/*	Name:           freeRequestRecord
+	Description:    Frees a record buffer on the thread that allocated it
+	Parameters:     DBRecord *record:  The record to free
+	Returns:        void
+*/
+void freeRequestRecord(DBRecord *record) {
+
+	if (currentArena != NULL) {
+		freeSlab(currentArena->pool, DB_SLAB_RECORD, record);
+	}
+	else {
+		free(record);
+	}
+}
@@ -0,0 +1,729 @@
+
+#include "extra.h"
+#include "bufferpool.h"
+#include "record.h"
+#include "snapshot.h"
+#include "numa.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// The number of pages needed to hold every possible entry
+#define DB_POOL_MAX_PAGES  ((DB_MAX_ENTRY + DB_POOL_PAGE_SLOTS - 1) / DB_POOL_PAGE_SLOTS)
+
+// Marks a frame holding no page, or a page held by no frame
+#define DB_POOL_NONE  SIZE_MAX
+
+
+// A struct to store one page-sized frame of a buffer pool
+typedef struct DBPoolFrame {
+
+	// The page held by the frame, or DB_POOL_NONE
+	size_t page;
+
+	// The number of leading slots read from or appended to the file
+	size_t valid;
+
+	// Pinned frames are being filled and may not be evicted
+	size_t pins;
+
+	// The write count when the page was last written, or zero once flushed
+	uint64_t dirty;
+
+	// CLOCK reference bit
+	bool referenced;
+
+	// LRU-2 reference history, zero when there is no such reference
+	uint64_t last;
+	uint64_t previous;
+
+	DBRecordSlot *slots;
+} DBPoolFrame;
+
+
+// A struct to store the state of a buffer pool
+struct DBBufferPool {
+
+	SRWLOCK lock;
+
+	DBEvictionPolicy policy;
+
+	size_t count;
+	DBPoolFrame *frames;
+	DBRecordSlot *memory;
+
+	// The frame holding each page, or DB_POOL_NONE
+	size_t table[DB_POOL_MAX_PAGES];
+
+	// CLOCK hand and LRU-2 logical time
+	size_t hand;
+	uint64_t tick;
+
+	// The number of writes made, and the number made before the last flush
+	uint64_t written;
+	uint64_t flushed;
+
+	DBPoolStats stats;
+
+	// The background flusher thread and its stop signal
+	HANDLE flusher;
+	HANDLE stopEvent;
+};
+
+
+// Function pointer types for an eviction policy
+typedef void (*DBReferenceFunction)(DBBufferPool *, DBPoolFrame *);
+typedef size_t (*DBVictimFunction)(DBBufferPool *);
+
+
+// Prototypes for the eviction policies
+void referenceClock(DBBufferPool *, DBPoolFrame *);
+size_t victimClock(DBBufferPool *);
+void referenceLRU2(DBBufferPool *, DBPoolFrame *);
+size_t victimLRU2(DBBufferPool *);
+
+// Prototypes for moving pages between the file and the pool
+void resetFrame(DBPoolFrame *);
+DBCode fetchPage(DBContext *, size_t, size_t, DBRecordSlot *);
+void placePoolSlot(DBBufferPool *, DBIndex, const DBRecordSlot *);
+
+
+
+// Eviction policies indexed by DBEvictionPolicy
+static const struct {
+	DBReferenceFunction reference;
+	DBVictimFunction victim;
+} policies[DB_EVICT_POLICIES] = {
+	[DB_EVICT_CLOCK] = { referenceClock, victimClock },
+	[DB_EVICT_LRU2] = { referenceLRU2, victimLRU2 },
+};
+
+
+/*	Name:           createBufferPool
+	Description:    Allocates an empty buffer pool
+	Parameters:     size_t pages:  The number of pages the pool holds
+	                DBEvictionPolicy policy:  The policy choosing which page to evict
+	                bool largePages:  Whether to back the pages with large pages, when available
+	                DBBufferPool **pool:  The created pool
+	Returns:        DBCode:  A return status code
+*/
+DBCode createBufferPool(size_t pages, DBEvictionPolicy policy, bool largePages, DBBufferPool **pool) {
+
+	// Establish function preconditions
+	assert_assume(pages != 0);
+	assert_assume(0 <= policy && policy < DB_EVICT_POLICIES);
+	assert_assume(pool != NULL);
+
+	// Every page fits at once in a larger pool
+	if (pages > DB_POOL_MAX_PAGES) {
+		pages = DB_POOL_MAX_PAGES;
+	}
+
+	DBBufferPool *temp = calloc(1, sizeof(DBBufferPool));
+	DBPoolFrame *frames = calloc(pages, sizeof(DBPoolFrame));
+	// Page memory comes straight from the system, so it is page aligned and may use large pages
+	DBRecordSlot *memory = allocatePages(pages * DB_POOL_PAGE_SLOTS * sizeof(DBRecordSlot), largePages, DB_NODE_ANY);
+
+	if (temp == NULL || frames == NULL || memory == NULL) {
+		free(temp);
+		free(frames);
+		freePages(memory);
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+	temp->policy = policy;
+	temp->count = pages;
+	temp->frames = frames;
+	temp->memory = memory;
+
+	for (size_t i = 0; i < pages; ++i) {
+		frames[i].slots = memory + i * DB_POOL_PAGE_SLOTS;
+		resetFrame(&frames[i]);
+	}
+	for (size_t i = 0; i < DB_POOL_MAX_PAGES; ++i) {
+		temp->table[i] = DB_POOL_NONE;
+	}
+
+	*pool = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           destroyBufferPool
+	Description:    Stops the flusher and frees a buffer pool
+	Parameters:     DBBufferPool *pool:  The pool to destroy
+	Returns:        void
+*/
+void destroyBufferPool(DBBufferPool *pool) {
+
+	if (pool == NULL) {
+		return;
+	}
+
+	stopPoolFlusher(pool);
+
+	free(pool->frames);
+	freePages(pool->memory);
+	free(pool);
+}
+
+
+/*	Name:           resetFrame
+	Description:    Empties a frame so it holds no page
+	Parameters:     DBPoolFrame *frame:  The frame to empty
+	Returns:        void
+*/
+void resetFrame(DBPoolFrame *frame) {
+
+	// Establish function preconditions
+	assert_assume(frame != NULL);
+
+	frame->page = DB_POOL_NONE;
+	frame->valid = 0;
+	frame->dirty = 0;
+	frame->referenced = false;
+	frame->last = 0;
+	frame->previous = 0;
+}
+
+
+/*	Name:           referenceClock
+	Description:    Records a reference to a frame for the CLOCK policy
+	Parameters:     DBBufferPool *pool:  The pool holding the frame
+	                DBPoolFrame *frame:  The referenced frame
+	Returns:        void
+*/
+void referenceClock(DBBufferPool *pool, DBPoolFrame *frame) {
+	frame->referenced = true;
+}
+
+
+/*	Name:           victimClock
+	Description:    Chooses a frame to evict by sweeping the clock hand, clearing reference bits
+	Parameters:     DBBufferPool *pool:  The pool to evict from
+	Returns:        size_t:  The chosen frame, or DB_POOL_NONE when every frame is pinned
+*/
+size_t victimClock(DBBufferPool *pool) {
+
+	// Two sweeps clear every reference bit, so an unpinned frame is found if one exists
+	for (size_t step = 0; step < 2 * pool->count; ++step) {
+
+		size_t index = pool->hand;
+		pool->hand = (pool->hand + 1) % pool->count;
+
+		DBPoolFrame *frame = &pool->frames[index];
+		if (frame->pins != 0) {
+			continue;
+		}
+		if (frame->page != DB_POOL_NONE && frame->referenced) {
+			frame->referenced = false;
+			continue;
+		}
+
+		return index;
+	}
+
+	return DB_POOL_NONE;
+}
+
+
+/*	Name:           referenceLRU2
+	Description:    Records a reference to a frame for the LRU-2 policy
+	Parameters:     DBBufferPool *pool:  The pool holding the frame
+	                DBPoolFrame *frame:  The referenced frame
+	Returns:        void
+*/
+void referenceLRU2(DBBufferPool *pool, DBPoolFrame *frame) {
+	frame->previous = frame->last;
+	frame->last = ++pool->tick;
+}
+
+
+/*	Name:           victimLRU2
+	Description:    Chooses the frame whose second most recent reference is oldest
+	Parameters:     DBBufferPool *pool:  The pool to evict from
+	Returns:        size_t:  The chosen frame, or DB_POOL_NONE when every frame is pinned
+*/
+size_t victimLRU2(DBBufferPool *pool) {
+
+	size_t victim = DB_POOL_NONE;
+
+	for (size_t i = 0; i < pool->count; ++i) {
+
+		DBPoolFrame *frame = &pool->frames[i];
+		if (frame->pins != 0) {
+			continue;
+		}
+		if (frame->page == DB_POOL_NONE) {
+			return i;
+		}
+
+		// Pages referenced only once have no second reference and are evicted first
+		const DBPoolFrame *best = (victim != DB_POOL_NONE) ? &pool->frames[victim] : NULL;
+		if (best == NULL
+			|| frame->previous < best->previous
+			|| (frame->previous == best->previous && frame->last < best->last)) {
+			victim = i;
+		}
+	}
+
+	return victim;
+}
+
+
+/*	Name:           fetchPage
+	Description:    Reads a slot through the pool, reading its whole page from the file on a miss
+	Parameters:     DBContext *context:  The database the pool caches
+	                size_t page:  The page holding the slot
+	                size_t offset:  The position of the slot in the page
+	                DBRecordSlot *slot:  The slot read
+	Returns:        DBCode:  A return status code
+*/
+DBCode fetchPage(DBContext *context, size_t page, size_t offset, DBRecordSlot *slot) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->pool != NULL);
+	assert_assume(page < DB_POOL_MAX_PAGES && offset < DB_POOL_PAGE_SLOTS);
+	assert_assume(slot != NULL);
+
+	DBBufferPool *pool = context->pool;
+
+	AcquireSRWLockExclusive(&pool->lock);
+
+	// Another reader may have loaded the page while this one waited for the file
+	size_t index = pool->table[page];
+	if (index != DB_POOL_NONE && offset < pool->frames[index].valid) {
+		DBPoolFrame *frame = &pool->frames[index];
+		*slot = frame->slots[offset];
+		policies[pool->policy].reference(pool, frame);
+		++pool->stats.hits;
+		ReleaseSRWLockExclusive(&pool->lock);
+		return DB_SUCCESS;
+	}
+
+	++pool->stats.misses;
+
+	// A page missing appended slots is read again in place
+	if (index == DB_POOL_NONE) {
+		index = policies[pool->policy].victim(pool);
+	}
+
+	// Every frame is being filled, so read around the pool
+	if (index == DB_POOL_NONE) {
+		ReleaseSRWLockExclusive(&pool->lock);
+		CONDITIONAL_RETURN(seekRecord(context->file, (DBIndex)(page * DB_POOL_PAGE_SLOTS + offset + DB_MIN_ENTRY)));
+		if (scheduledRead(slot, DB_SLOT_SIZE, 1, context->file) != 1) {
+			return DB_FILE_ERROR;
+		}
+		return DB_SUCCESS;
+	}
+
+	// Unmap and pin the frame so no reader sees it and no miss evicts it while it is filled
+	DBPoolFrame *frame = &pool->frames[index];
+	if (frame->page != DB_POOL_NONE) {
+		if (frame->page != page) {
+			++pool->stats.evictions;
+		}
+		if (frame->dirty != 0) {
+			--pool->stats.dirtyPages;
+		}
+		pool->table[frame->page] = DB_POOL_NONE;
+	}
+	resetFrame(frame);
+	++frame->pins;
+
+	ReleaseSRWLockExclusive(&pool->lock);
+
+	// Read every slot of the page that exists with one aligned read
+	DBIndex first = (DBIndex)(page * DB_POOL_PAGE_SLOTS + DB_MIN_ENTRY);
+	size_t valid = context->entries - first + 1;
+	if (valid > DB_POOL_PAGE_SLOTS) {
+		valid = DB_POOL_PAGE_SLOTS;
+	}
+
+	DBCode status = seekRecord(context->file, first);
+	if (status == DB_SUCCESS && scheduledRead(frame->slots, DB_SLOT_SIZE, valid, context->file) != valid) {
+		status = DB_FILE_ERROR;
+	}
+
+	AcquireSRWLockExclusive(&pool->lock);
+
+	--frame->pins;
+
+	// A concurrent miss may already have mapped the page to another frame
+	if (status == DB_SUCCESS && pool->table[page] == DB_POOL_NONE) {
+		frame->page = page;
+		frame->valid = valid;
+		pool->table[page] = index;
+		policies[pool->policy].reference(pool, frame);
+	}
+	if (status == DB_SUCCESS) {
+		*slot = frame->slots[offset];
+	}
+
+	ReleaseSRWLockExclusive(&pool->lock);
+
+	return status;
+}
+
+
+/*	Name:           readPoolRecord
+	Description:    Reads a record by memberId through the database's buffer pool
+	Parameters:     DBContext *context:  The database to read from
+	                DBRecord *record:  The record to read, selected by memberId
+	Returns:        DBCode:  A return status code
+*/
+DBCode readPoolRecord(DBContext *context, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL && context->pool != NULL);
+	assert_assume(record != NULL);
+	assert_assume(DB_MIN_ENTRY <= record->memberId && record->memberId <= context->entries);
+
+	DBBufferPool *pool = context->pool;
+	size_t page = (size_t)(record->memberId - DB_MIN_ENTRY) / DB_POOL_PAGE_SLOTS;
+	size_t offset = (size_t)(record->memberId - DB_MIN_ENTRY) % DB_POOL_PAGE_SLOTS;
+
+	DBRecordSlot slot;
+	bool hit = false;
+
+	AcquireSRWLockExclusive(&pool->lock);
+
+	size_t index = pool->table[page];
+	if (index != DB_POOL_NONE && offset < pool->frames[index].valid) {
+		DBPoolFrame *frame = &pool->frames[index];
+		slot = frame->slots[offset];
+		policies[pool->policy].reference(pool, frame);
+		++pool->stats.hits;
+		hit = true;
+	}
+
+	ReleaseSRWLockExclusive(&pool->lock);
+
+	// Misses are serialized against writers, so a page is never installed older than a commit
+	if (!hit) {
+
+		if (context->versions != NULL) {
+			lockVersionStore(context->versions);
+		}
+
+		DBCode status = fetchPage(context, page, offset, &slot);
+
+		if (context->versions != NULL) {
+			unlockVersionStore(context->versions);
+		}
+
+		CONDITIONAL_RETURN(status);
+	}
+
+	// Reject torn, misplaced or corrupt slots before trusting their contents
+	CONDITIONAL_RETURN(verifyRecordSlot(&slot, record->memberId));
+
+	decodeRecordSlot(&slot, record->memberId, record);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           placePoolSlot
+	Description:    Copies a slot just written to the file into its page, if resident, and marks it dirty
+	Parameters:     DBBufferPool *pool:  The pool to update, locked exclusively by the caller
+	                DBIndex memberId:  The memberId the slot was written at
+	                DBRecordSlot *slot:  The slot written
+	Returns:        void
+*/
+void placePoolSlot(DBBufferPool *pool, DBIndex memberId, const DBRecordSlot *slot) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(slot != NULL);
+	assert_assume(DB_MIN_ENTRY <= memberId && memberId <= DB_MAX_ENTRY);
+
+	size_t page = (size_t)(memberId - DB_MIN_ENTRY) / DB_POOL_PAGE_SLOTS;
+	size_t offset = (size_t)(memberId - DB_MIN_ENTRY) % DB_POOL_PAGE_SLOTS;
+
+	++pool->written;
+
+	// Appends extend a resident page only when they are contiguous with what it holds
+	size_t index = pool->table[page];
+	if (index != DB_POOL_NONE && offset <= pool->frames[index].valid) {
+
+		DBPoolFrame *frame = &pool->frames[index];
+		frame->slots[offset] = *slot;
+		if (offset == frame->valid) {
+			++frame->valid;
+		}
+
+		if (frame->dirty == 0) {
+			++pool->stats.dirtyPages;
+		}
+		frame->dirty = pool->written;
+	}
+}
+
+
+/*	Name:           writePoolRecords
+	Description:    Copies the records of one commit into their pages at once, so a hit never sees part of it
+	Parameters:     DBBufferPool *pool:  The pool to update
+	                DBRecord *records:  The records written, each selected by memberId
+	                size_t count:  The number of records
+	Returns:        void
+*/
+void writePoolRecords(DBBufferPool *pool, const DBRecord *records, size_t count) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(records != NULL || count == 0);
+
+	AcquireSRWLockExclusive(&pool->lock);
+
+	for (size_t i = 0; i < count; ++i) {
+		DBRecordSlot slot;
+		encodeRecordSlot(&records[i], &slot);
+		placePoolSlot(pool, records[i].memberId, &slot);
+	}
+
+	ReleaseSRWLockExclusive(&pool->lock);
+}
+
+
+/*	Name:           writePoolSlots
+	Description:    Copies a run of slots appended by one commit into their pages at once
+	Parameters:     DBBufferPool *pool:  The pool to update
+	                DBIndex first:  The memberId of the first slot
+	                DBRecordSlot *slots:  The slots written
+	                size_t count:  The number of slots
+	Returns:        void
+*/
+void writePoolSlots(DBBufferPool *pool, DBIndex first, const DBRecordSlot *slots, size_t count) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(slots != NULL || count == 0);
+
+	AcquireSRWLockExclusive(&pool->lock);
+
+	for (size_t i = 0; i < count; ++i) {
+		placePoolSlot(pool, (DBIndex)(first + i), &slots[i]);
+	}
+
+	ReleaseSRWLockExclusive(&pool->lock);
+}
+
+
+/*	Name:           warmBufferPool
+	Description:    Preloads the pages holding a set of memberIds, such as a saved warm set
+	Parameters:     DBContext *context:  The database the pool caches
+	                DBIndex *memberIds:  The memberIds whose pages are preloaded
+	                DBIndex count:  The number of memberIds
+	Returns:        DBCode:  A return status code
+*/
+DBCode warmBufferPool(DBContext *context, const DBIndex *memberIds, DBIndex count) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL && context->pool != NULL);
+	assert_assume(memberIds != NULL || count == 0);
+
+	// Loading more pages than fit would only evict the first ones again
+	size_t limit = (count < context->pool->count) ? count : context->pool->count;
+
+	for (size_t i = 0; i < limit; ++i) {
+
+		// A stale warm set may name records that no longer exist
+		DBIndex memberId = memberIds[i];
+		if (memberId < DB_MIN_ENTRY || memberId > context->entries) {
+			continue;
+		}
+
+		DBRecordSlot slot;
+		size_t page = (size_t)(memberId - DB_MIN_ENTRY) / DB_POOL_PAGE_SLOTS;
+		size_t offset = (size_t)(memberId - DB_MIN_ENTRY) % DB_POOL_PAGE_SLOTS;
+		CONDITIONAL_RETURN(fetchPage(context, page, offset, &slot));
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           readPoolWarmSet
+	Description:    Lists the first memberId of every resident page, to be preloaded after a restart
+	Parameters:     DBBufferPool *pool:  The pool to read
+	                DBIndex *memberIds:  The memberIds listed
+	                DBIndex capacity:  The most memberIds listed
+	Returns:        DBIndex:  The number of memberIds listed
+*/
+DBIndex readPoolWarmSet(DBBufferPool *pool, DBIndex *memberIds, DBIndex capacity) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(memberIds != NULL || capacity == 0);
+
+	DBIndex count = 0;
+
+	AcquireSRWLockShared(&pool->lock);
+
+	for (size_t i = 0; i < pool->count && count < capacity; ++i) {
+		if (pool->frames[i].page != DB_POOL_NONE) {
+			memberIds[count++] = (DBIndex)(pool->frames[i].page * DB_POOL_PAGE_SLOTS + DB_MIN_ENTRY);
+		}
+	}
+
+	ReleaseSRWLockShared(&pool->lock);
+
+	return count;
+}
+
+
+/*	Name:           flushBufferPool
+	Description:    Flushes every write made so far to the file and marks the written pages clean
+	Parameters:     DBContext *context:  The database the pool caches
+	Returns:        DBCode:  A return status code
+*/
+DBCode flushBufferPool(DBContext *context) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL && context->pool != NULL);
+
+	DBBufferPool *pool = context->pool;
+
+	AcquireSRWLockShared(&pool->lock);
+	uint64_t written = pool->written;
+	bool pending = (written != pool->flushed);
+	size_t dirtyBytes = pool->stats.dirtyPages * DB_POOL_PAGE_SLOTS * sizeof(DBRecordSlot);
+	ReleaseSRWLockShared(&pool->lock);
+
+	if (!pending) {
+		return DB_SUCCESS;
+	}
+
+	// A background flush waits for its share of the disk before writers are excluded
+	paceIO(dirtyBytes);
+
+	if (context->versions != NULL) {
+		lockVersionStore(context->versions);
+	}
+
+	int result = scheduledFlush(context->file);
+
+	if (context->versions != NULL) {
+		unlockVersionStore(context->versions);
+	}
+
+	if (result != 0) {
+		return DB_FILE_ERROR;
+	}
+
+	// Pages written again since the count was read stay dirty until the next flush
+	AcquireSRWLockExclusive(&pool->lock);
+
+	for (size_t i = 0; i < pool->count; ++i) {
+		DBPoolFrame *frame = &pool->frames[i];
+		if (frame->dirty != 0 && frame->dirty <= written) {
+			frame->dirty = 0;
+			--pool->stats.dirtyPages;
+		}
+	}
+
+	pool->flushed = written;
+	++pool->stats.flushes;
+
+	ReleaseSRWLockExclusive(&pool->lock);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           flusherThread
+	Description:    Periodically flushes dirty pages until signalled to stop
+	Parameters:     LPVOID param:  The database whose pool is flushed
+	Returns:        DWORD:  The thread exit code
+*/
+static DWORD WINAPI flusherThread(LPVOID param) {
+
+	DBContext *context = param;
+
+	// Flushing is maintenance, so it gives way to requests
+	setIOClass(DB_IO_BACKGROUND);
+
+	while (WaitForSingleObject(context->pool->stopEvent, DB_POOL_FLUSH_INTERVAL_MS) == WAIT_TIMEOUT) {
+		flushBufferPool(context);
+	}
+
+	return 0;
+}
+
+
+/*	Name:           startPoolFlusher
+	Description:    Starts a background thread that periodically flushes dirty pages
+	Parameters:     DBContext *context:  The database whose pool is flushed
+	Returns:        DBCode:  A return status code
+*/
+DBCode startPoolFlusher(DBContext *context) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->pool != NULL);
+	assert_assume(context->pool->flusher == NULL);
+
+	DBBufferPool *pool = context->pool;
+
+	pool->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (pool->stopEvent == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	pool->flusher = CreateThread(NULL, 0, flusherThread, context, 0, NULL);
+	if (pool->flusher == NULL) {
+		CloseHandle(pool->stopEvent);
+		pool->stopEvent = NULL;
+		return DB_REQUEST_DENIED;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopPoolFlusher
+	Description:    Signals the flusher thread to stop and waits for it
+	Parameters:     DBBufferPool *pool:  The pool being flushed
+	Returns:        void
+*/
+void stopPoolFlusher(DBBufferPool *pool) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+
+	if (pool->flusher == NULL) {
+		return;
+	}
+
+	SetEvent(pool->stopEvent);
+	WaitForSingleObject(pool->flusher, INFINITE);
+
+	CloseHandle(pool->flusher);
+	CloseHandle(pool->stopEvent);
+
+	pool->flusher = NULL;
+	pool->stopEvent = NULL;
+}
+
+
+/*	Name:           readPoolStats
+	Description:    Reads the effectiveness of a buffer pool
+	Parameters:     DBBufferPool *pool:  The pool to read
+	                DBPoolStats *stats:  The statistics read
+	Returns:        void
+*/
+void readPoolStats(DBBufferPool *pool, DBPoolStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(pool != NULL);
+	assert_assume(stats != NULL);
+
+	AcquireSRWLockShared(&pool->lock);
+	*stats = pool->stats;
+	ReleaseSRWLockShared(&pool->lock);
+}
@@ -0,0 +1,553 @@
+
+#include "extra.h"
+#include "changes.h"
+#include "arena.h"
+
+#include <stdlib.h>
+
+
+// A struct to store the retained changes in a ring shared by every subscriber
+struct DBChangeLog {
+
+	SRWLOCK lock;
+	CONDITION_VARIABLE ready;
+
+	DBChange *entries;
+	size_t capacity;
+
+	// Positions count every change ever appended, and position p is stored at p % capacity
+	uint64_t head;
+
+	// Changes below this position belong to finished commits
+	uint64_t visible;
+
+	// The newest sequence no longer retained, so resuming from before it is refused
+	DBSequence evicted;
+
+	// The newest commit made visible, so resuming from after it is refused
+	DBSequence published;
+
+	// The subscriptions reading the log, which must all leave before it is freed
+	size_t readers;
+	bool closed;
+};
+
+
+
+/*	Name:           createChangeLog
+	Description:    Allocates an empty change log
+	Parameters:     DBSequence sequence:  The last commit applied before the log was created
+	                size_t capacity:  The number of changes to retain
+	                DBChangeLog **log:  The created log
+	Returns:        DBCode:  A return status code
+*/
+DBCode createChangeLog(DBSequence sequence, size_t capacity, DBChangeLog **log) {
+
+	// Establish function preconditions
+	assert_assume(capacity != 0);
+	assert_assume(log != NULL);
+
+	DBChangeLog *temp = calloc(1, sizeof(DBChangeLog));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	temp->entries = malloc(sizeof(DBChange) * capacity);
+	if (temp->entries == NULL) {
+		free(temp);
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+	InitializeConditionVariable(&temp->ready);
+	temp->capacity = capacity;
+
+	// Commits from before the log existed cannot be replayed
+	temp->evicted = sequence;
+	temp->published = sequence;
+
+	*log = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           closeChangeLog
+	Description:    Ends every subscription waiting on a change log
+	Parameters:     DBChangeLog *log:  The log to close
+	Returns:        void
+*/
+void closeChangeLog(DBChangeLog *log) {
+
+	if (log == NULL) {
+		return;
+	}
+
+	AcquireSRWLockExclusive(&log->lock);
+	log->closed = true;
+	ReleaseSRWLockExclusive(&log->lock);
+
+	WakeAllConditionVariable(&log->ready);
+}
+
+
+/*	Name:           attachChangeReader
+	Description:    Registers a subscription reading a change log, so the log outlives it
+	Parameters:     DBChangeLog *log:  The log to read
+	Returns:        DBCode:  A return status code, DB_REQUEST_DENIED once the log is closed
+*/
+DBCode attachChangeReader(DBChangeLog *log) {
+
+	// Establish function preconditions
+	assert_assume(log != NULL);
+
+	AcquireSRWLockExclusive(&log->lock);
+
+	bool closed = log->closed;
+	if (!closed) {
+		++log->readers;
+	}
+
+	ReleaseSRWLockExclusive(&log->lock);
+
+	return closed ? DB_REQUEST_DENIED : DB_SUCCESS;
+}
+
+
+/*	Name:           detachChangeReader
+	Description:    Ends a subscription registered with attachChangeReader
+	Parameters:     DBChangeLog *log:  The log that was read
+	Returns:        void
+*/
+void detachChangeReader(DBChangeLog *log) {
+
+	// Establish function preconditions
+	assert_assume(log != NULL);
+
+	AcquireSRWLockExclusive(&log->lock);
+	assert(log->readers != 0);
+	--log->readers;
+	ReleaseSRWLockExclusive(&log->lock);
+
+	// Wake a close waiting for the last reader
+	WakeAllConditionVariable(&log->ready);
+}
+
+
+/*	Name:           waitChangeReaders
+	Description:    Waits for every subscription to leave a closed change log
+	Parameters:     DBChangeLog *log:  The closed log
+	                DWORD timeout:  The most milliseconds to wait
+	Returns:        bool:  Whether no subscription is reading the log
+*/
+bool waitChangeReaders(DBChangeLog *log, DWORD timeout) {
+
+	if (log == NULL) {
+		return true;
+	}
+
+	// Establish function preconditions
+	assert_assume(log->closed);
+
+	ULONG64 limit = GetTickCount64() + timeout;
+
+	AcquireSRWLockExclusive(&log->lock);
+
+	ULONG64 now = GetTickCount64();
+	while (log->readers != 0 && now < limit) {
+		SleepConditionVariableSRW(&log->ready, &log->lock, (DWORD)(limit - now), 0);
+		now = GetTickCount64();
+	}
+	bool idle = log->readers == 0;
+
+	ReleaseSRWLockExclusive(&log->lock);
+
+	return idle;
+}
+
+
+/*	Name:           destroyChangeLog
+	Description:    Frees a change log once no subscription is reading it
+	Parameters:     DBChangeLog *log:  The log to destroy
+	Returns:        void
+*/
+void destroyChangeLog(DBChangeLog *log) {
+
+	if (log == NULL) {
+		return;
+	}
+
+	assert(log->readers == 0);
+
+	free(log->entries);
+	free(log);
+}
+
+
+/*	Name:           appendChange
+	Description:    Records a change applied by the open commit, overwriting the oldest when full
+	Parameters:     DBChangeLog *log:  The log to append to
+	                DBSequence sequence:  The sequence of the open commit
+	                DBChangeKind kind:  Whether the record was inserted or updated
+	                DBRecord *record:  The record as written
+	Returns:        void
+*/
+void appendChange(DBChangeLog *log, DBSequence sequence, DBChangeKind kind, const DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(log != NULL);
+	assert_assume(record != NULL);
+
+	AcquireSRWLockExclusive(&log->lock);
+
+	// Writers never wait for subscribers, so a slow one falls behind instead
+	DBChange *change = &log->entries[log->head % log->capacity];
+	if (log->head >= log->capacity) {
+		log->evicted = change->sequence;
+	}
+
+	change->sequence = sequence;
+	change->kind = kind;
+	change->record = *record;
+	++log->head;
+
+	ReleaseSRWLockExclusive(&log->lock);
+}
+
+
+/*	Name:           publishChanges
+	Description:    Makes every change appended so far visible to subscribers
+	Parameters:     DBChangeLog *log:  The log to publish
+	                DBSequence sequence:  The commit that appended the changes
+	Returns:        void
+*/
+void publishChanges(DBChangeLog *log, DBSequence sequence) {
+
+	// Establish function preconditions
+	assert_assume(log != NULL);
+
+	AcquireSRWLockExclusive(&log->lock);
+	log->visible = log->head;
+	log->published = sequence;
+	ReleaseSRWLockExclusive(&log->lock);
+
+	WakeAllConditionVariable(&log->ready);
+}
+
+
+/*	Name:           seekChanges
+	Description:    Finds the position of the first change committed after a sequence
+	Parameters:     DBChangeLog *log:  The log to search
+	                DBSequence sequence:  The last commit the subscriber has seen
+	                uint64_t *position:  The position to read from
+	Returns:        DBCode:  A return status code, DB_REQUEST_DENIED if the changes after the sequence are unknown
+*/
+DBCode seekChanges(DBChangeLog *log, DBSequence sequence, uint64_t *position) {
+
+	// Establish function preconditions
+	assert_assume(log != NULL);
+	assert_assume(position != NULL);
+
+	AcquireSRWLockShared(&log->lock);
+
+	// Refuse a resume that would silently skip changes no longer retained, or
+	// one from a sequence this log never reached, such as one seen before a crash
+	if (sequence < log->evicted || sequence > log->published) {
+		ReleaseSRWLockShared(&log->lock);
+		return DB_REQUEST_DENIED;
+	}
+
+	// Sequences never decrease along the ring, so the first later change is found by bisection
+	uint64_t low = (log->head > log->capacity) ? log->head - log->capacity : 0;
+	uint64_t high = log->visible;
+	while (low < high) {
+		uint64_t middle = low + (high - low) / 2;
+		if (log->entries[middle % log->capacity].sequence <= sequence) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	*position = low;
+
+	ReleaseSRWLockShared(&log->lock);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           readChanges
+	Description:    Copies the next published changes, waiting up to a timeout for some to arrive
+	Parameters:     DBChangeLog *log:  The log to read
+	                uint64_t *position:  The position to read from, advanced past the changes read
+	                DBChange *changes:  The buffer to copy to
+	                size_t capacity:  The size of the buffer
+	                size_t *count:  The number of changes copied, 0 on timeout
+	                DWORD timeout:  The most milliseconds to wait
+	Returns:        DBCode:  A return status code, DB_REQUEST_DENIED if the reader fell too far behind
+*/
+DBCode readChanges(DBChangeLog *log, uint64_t *position, DBChange *changes, size_t capacity, size_t *count, DWORD timeout) {
+
+	// Establish function preconditions
+	assert_assume(log != NULL);
+	assert_assume(position != NULL);
+	assert_assume(changes != NULL);
+	assert_assume(count != NULL);
+
+	AcquireSRWLockExclusive(&log->lock);
+
+	while (log->visible <= *position && !log->closed) {
+		if (!SleepConditionVariableSRW(&log->ready, &log->lock, timeout, 0)) {
+			break;
+		}
+	}
+
+	// The changes at the reader's position have been overwritten
+	if (log->head - *position > log->capacity || log->closed) {
+		ReleaseSRWLockExclusive(&log->lock);
+		return DB_REQUEST_DENIED;
+	}
+
+	size_t available = (log->visible > *position) ? (size_t)(log->visible - *position) : 0;
+	if (available > capacity) {
+		available = capacity;
+	}
+
+	for (size_t i = 0; i < available; ++i) {
+		changes[i] = log->entries[(*position + i) % log->capacity];
+	}
+
+	*position += available;
+	*count = available;
+
+	ReleaseSRWLockExclusive(&log->lock);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendSequence
+	Description:    Sends a sequence number to a socket
+	Parameters:     SOCKET socket:  The socket to send the sequence to
+	                DBSequence sequence:  The sequence to send
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendSequence(SOCKET socket, DBSequence sequence) {
+
+	// Establish function preconditions
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Write the sequence in network byte order
+	uint8_t buffer[DB_SEQUENCE_SIZE];
+	for (size_t i = 0; i < DB_SEQUENCE_SIZE; ++i) {
+		buffer[i] = (uint8_t)(sequence >> (8 * (DB_SEQUENCE_SIZE - 1 - i)));
+	}
+
+	int result = send(socket, (char *)buffer, DB_SEQUENCE_SIZE, 0);
+	if (result == SOCKET_ERROR) {
+		return DB_SOCKET_ERROR;
+	}
+	else if (result != DB_SEQUENCE_SIZE) {
+		return DB_SOCKET_MISMATCH;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           receiveSequence
+	Description:    Receives a sequence number from a socket
+	Parameters:     SOCKET socket:  The socket to receive the sequence from
+	                DBSequence *sequence:  The received sequence
+	Returns:        DBCode:  A return status code
+*/
+DBCode receiveSequence(SOCKET socket, DBSequence *sequence) {
+
+	// Establish function preconditions
+	assert_assume(sequence != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	uint8_t buffer[DB_SEQUENCE_SIZE];
+	int result = recv(socket, (char *)buffer, DB_SEQUENCE_SIZE, MSG_WAITALL);
+	if (result == SOCKET_ERROR) {
+		return DB_SOCKET_ERROR;
+	}
+	else if (result != DB_SEQUENCE_SIZE) {
+		return DB_SOCKET_MISMATCH;
+	}
+
+	// Read the sequence from network byte order
+	DBSequence temp = 0;
+	for (size_t i = 0; i < DB_SEQUENCE_SIZE; ++i) {
+		temp = temp << 8 | buffer[i];
+	}
+	*sequence = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           handleSubscribeRequest
+	Description:    Handles a change subscription from the server-side, streaming changes until it ends
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleSubscribeRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Changes are only recorded by versioned databases with a change log
+	DBChangeLog *log = (context->versions != NULL) ? readChangeLog(context->versions) : NULL;
+	if (log == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBChange *batch = allocateRequestMemory(sizeof(DBChange) * DB_CHANGE_BATCH_SIZE);
+	if (batch == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// A closing database refuses new subscriptions and waits for attached ones to leave
+	DBCode status = attachChangeReader(log);
+	if (status != DB_SUCCESS) {
+		freeRequestMemory(batch);
+		return status;
+	}
+
+	// Send a confirmation code
+	status = sendCode(socket, DB_REQUEST_SUCCESS);
+
+	// Receive the last sequence the subscriber has seen
+	DBSequence sequence;
+	if (status == DB_SUCCESS) {
+		status = receiveSequence(socket, &sequence);
+	}
+
+	uint64_t position;
+	if (status == DB_SUCCESS) {
+		status = seekChanges(log, sequence, &position);
+	}
+
+	// Send a confirmation code
+	if (status == DB_SUCCESS) {
+		status = sendCode(socket, DB_REQUEST_SUCCESS);
+	}
+
+	while (status == DB_SUCCESS) {
+
+		// A subscriber that fell behind the log is told so and must resynchronize
+		size_t count;
+		DBCode result = readChanges(log, &position, batch, DB_CHANGE_BATCH_SIZE, &count, DB_CHANGE_HEARTBEAT_MS);
+		status = sendCode(socket, result);
+		if (result != DB_SUCCESS) {
+			break;
+		}
+
+		// Send the batch, which is empty when the subscription is idle
+		if (status == DB_SUCCESS) {
+			status = sendIndex(socket, (DBIndex)count);
+		}
+		for (size_t i = 0; status == DB_SUCCESS && i < count; ++i) {
+			status = sendSequence(socket, batch[i].sequence);
+			if (status == DB_SUCCESS) {
+				status = sendCode(socket, (DBCode)batch[i].kind);
+			}
+			if (status == DB_SUCCESS) {
+				status = sendRecord(socket, &batch[i].record, true);
+			}
+		}
+
+		// Wait for the acknowledgement, so a slow subscriber holds at most one batch in flight
+		DBCode response = DB_SUCCESS;
+		if (status == DB_SUCCESS) {
+			status = receiveCode(socket, &response);
+		}
+		if (response != DB_SUCCESS) {
+			break;
+		}
+	}
+
+	detachChangeReader(log);
+	freeRequestMemory(batch);
+
+	return status;
+}
+
+
+/*	Name:           sendSubscribeRequest
+	Description:    Subscribes to changes from the client-side, passing each to a callback until it stops
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBSequence sequence:  The last sequence seen, or 0 for every retained change
+	                DBChangeCallback callback:  The function to pass each change to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendSubscribeRequest(SOCKET socket, DBSequence sequence, DBChangeCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(callback != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUBSCRIBE));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the sequence to resume after
+	CONDITIONAL_RETURN(sendSequence(socket, sequence));
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	for (;;) {
+
+		// Receive the status of the next batch
+		CONDITIONAL_RETURN(receiveCode(socket, &response));
+		if (response != DB_REQUEST_SUCCESS) {
+			return response;
+		}
+
+		DBIndex count;
+		CONDITIONAL_RETURN(receiveIndex(socket, &count));
+
+		// Let the callback stop an idle subscription
+		DBCode status = DB_SUCCESS;
+		if (count == 0) {
+			status = callback(NULL, user);
+		}
+
+		// Receive every change, even after the callback stops, to keep the stream in sync
+		for (DBIndex i = 0; i < count; ++i) {
+
+			DBChange change;
+			DBCode kind;
+			CONDITIONAL_RETURN(receiveSequence(socket, &change.sequence));
+			CONDITIONAL_RETURN(receiveCode(socket, &kind));
+			CONDITIONAL_RETURN(receiveRecord(socket, &change.record, true));
+			change.kind = (DBChangeKind)kind;
+
+			if (status == DB_SUCCESS) {
+				status = callback(&change, user);
+			}
+		}
+
+		// Acknowledge the batch, or end the subscription
+		CONDITIONAL_RETURN(sendCode(socket, status));
+		if (status != DB_SUCCESS) {
+			return status;
+		}
+	}
+}
@@ -0,0 +1,186 @@
+
+#include "extra.h"
+#include "checksum.h"
+
+#include <Windows.h>
+#include <string.h>
+
+
+// Hardware CRC32C is available through SSE4.2 on x86 targets
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#define DB_CRC32C_HARDWARE
+
+#include <nmmintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DB_TARGET_SSE42
+#else
+#include <cpuid.h>
+#define DB_TARGET_SSE42  __attribute__((target("sse4.2")))
+#endif
+
+#endif // DB_CRC32C_HARDWARE
+
+
+// The reflected CRC32C (Castagnoli) polynomial
+#define DB_CRC32C_POLYNOMIAL  0x82F63B78u
+
+
+// Lookup table for the software fallback, built once on first use
+static uint32_t crcTable[256];
+static INIT_ONCE crcTableOnce = INIT_ONCE_STATIC_INIT;
+
+// Whether the processor supports SSE4.2: 0 unknown, 1 supported, 2 unsupported
+static volatile int crcHardware = 0;
+
+
+// Prototypes for each CRC32C implementation
+BOOL CALLBACK buildCRC32CTable(PINIT_ONCE, PVOID, PVOID *);
+uint32_t updateCRC32CTable(uint32_t, const uint8_t *, size_t);
+#ifdef DB_CRC32C_HARDWARE
+DB_TARGET_SSE42 uint32_t updateCRC32CHardware(uint32_t, const uint8_t *, size_t);
+#endif
+
+
+
+/*	Name:           hasHardwareCRC32C
+	Description:    Detects whether the SSE4.2 CRC32 instruction is available
+	Parameters:     void
+	Returns:        bool:  Whether the hardware implementation is used
+*/
+bool hasHardwareCRC32C(void) {
+
+#ifdef DB_CRC32C_HARDWARE
+
+	// Detection is idempotent, so a racing first call is harmless
+	if (crcHardware == 0) {
+
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 1);
+		bool supported = (info[2] & (1 << 20)) != 0;
+#else
+		unsigned int eax, ebx, ecx = 0, edx;
+		bool supported = __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2) != 0;
+#endif
+
+		crcHardware = supported ? 1 : 2;
+	}
+
+	return crcHardware == 1;
+
+#else
+	return false;
+#endif
+}
+
+
+/*	Name:           buildCRC32CTable
+	Description:    Fills the lookup table for the software fallback
+	Parameters:     PINIT_ONCE once:  The one-time initialization guarding the table
+	                PVOID parameter:  Unused
+	                PVOID *context:  Unused
+	Returns:        BOOL:  TRUE, since building the table cannot fail
+*/
+BOOL CALLBACK buildCRC32CTable(PINIT_ONCE once, PVOID parameter, PVOID *context) {
+
+	for (uint32_t i = 0; i < 256; ++i) {
+		uint32_t entry = i;
+		for (int bit = 0; bit < 8; ++bit) {
+			entry = (entry >> 1) ^ (DB_CRC32C_POLYNOMIAL & (0u - (entry & 1u)));
+		}
+		crcTable[i] = entry;
+	}
+
+	return TRUE;
+}
+
+
+/*	Name:           updateCRC32CTable
+	Description:    Folds bytes into a CRC32C value a byte at a time with a lookup table
+	Parameters:     uint32_t crc:  The running checksum
+	                uint8_t *bytes:  The bytes to fold in
+	                size_t size:  The number of bytes
+	Returns:        uint32_t:  The updated checksum
+*/
+uint32_t updateCRC32CTable(uint32_t crc, const uint8_t *bytes, size_t size) {
+
+	// The table is only read after every entry is visible to this thread
+	InitOnceExecuteOnce(&crcTableOnce, buildCRC32CTable, NULL, NULL);
+
+	for (size_t i = 0; i < size; ++i) {
+		crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	}
+
+	return crc;
+}
+
+
+#ifdef DB_CRC32C_HARDWARE
+
+/*	Name:           updateCRC32CHardware
+	Description:    Folds bytes into a CRC32C value with the SSE4.2 CRC32 instruction
+	Parameters:     uint32_t crc:  The running checksum
+	                uint8_t *bytes:  The bytes to fold in
+	                size_t size:  The number of bytes
+	Returns:        uint32_t:  The updated checksum
+*/
+DB_TARGET_SSE42 uint32_t updateCRC32CHardware(uint32_t crc, const uint8_t *bytes, size_t size) {
+
+#if defined(_M_X64) || defined(__x86_64__)
+
+	// Consume eight bytes per instruction; a 64-byte slot takes eight steps
+	uint64_t wide = crc;
+	while (size >= sizeof(uint64_t)) {
+		uint64_t word;
+		memcpy(&word, bytes, sizeof(word));
+		wide = _mm_crc32_u64(wide, word);
+		bytes += sizeof(uint64_t);
+		size -= sizeof(uint64_t);
+	}
+	crc = (uint32_t)wide;
+
+#endif
+
+	while (size >= sizeof(uint32_t)) {
+		uint32_t word;
+		memcpy(&word, bytes, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+		bytes += sizeof(uint32_t);
+		size -= sizeof(uint32_t);
+	}
+
+	while (size != 0) {
+		crc = _mm_crc32_u8(crc, *bytes);
+		++bytes;
+		--size;
+	}
+
+	return crc;
+}
+
+#endif // DB_CRC32C_HARDWARE
+
+
+/*	Name:           updateCRC32C
+	Description:    Folds a buffer into a running CRC32C value
+	Parameters:     uint32_t crc:  The running checksum
+	                void *data:  The bytes to fold in
+	                size_t size:  The number of bytes
+	Returns:        uint32_t:  The updated checksum
+*/
+uint32_t updateCRC32C(uint32_t crc, const void *data, size_t size) {
+
+	// Establish function preconditions
+	assert_assume(data != NULL || size == 0);
+
+#ifdef DB_CRC32C_HARDWARE
+	if (hasHardwareCRC32C()) {
+		return updateCRC32CHardware(crc, data, size);
+	}
+#endif
+
+	return updateCRC32CTable(crc, data, size);
+}
@@ -1,6 +1,21 @@
 
 #include "extra.h"
 #include "database.h"
+#include "snapshot.h"
+#include "transaction.h"
+#include "arena.h"
+#include "record.h"
+#include "aggregate.h"
+#include "filter.h"
+#include "storage.h"
+#include "loader.h"
+#include "sort.h"
+#include "changes.h"
+#include "lease.h"
+#include "admission.h"
+#include "trace.h"
+#include "fuzzy.h"
+#include "scheduler.h"
 
 
 // Disable MSVC specific compiler error
@@ -9,16 +24,6 @@
 #endif
 
 
-// Conditional return macro for database handling functions
-#define CONDITIONAL_RETURN(expr) \
-do { \
-	DBCode DBResult = (expr); \
-	if (DBResult != DB_SUCCESS) { \
-		return DBResult; \
-	} \
-} while(0)
-
-
 // Macro for DBIndex conversion
 #define htonDBIndex(expr)  htons(expr)
 #define ntohDBIndex(expr)  ntohs(expr)
@@ -40,10 +45,12 @@ struct DBDate ntohDBDate(DBDate);
 
 
 // Prototypes for server-side request handling
-DBCode handleInsertRequest(FILE *, SOCKET, DBIndex *);
-DBCode handleUpdateRequest(FILE *, SOCKET, DBIndex);
-DBCode handleFindRequest(FILE *, SOCKET, DBIndex);
-DBCode handleQueryRequest(FILE *, SOCKET, DBIndex);
+DBCode handleInsertRequest(DBContext *, SOCKET);
+DBCode handleUpdateRequest(DBContext *, SOCKET);
+DBCode handleFindRequest(DBContext *, SOCKET);
+DBCode handleQueryRequest(DBContext *, SOCKET);
+DBCode handleExportRequest(DBContext *, SOCKET);
+DBCode dispatchRequest(DBContext *, SOCKET, DBCode);
 
 
 
@@ -81,21 +88,12 @@ DBCode writeRecord(FILE *file, const DBRecord *record) {
 	assert_assume(record != NULL);
 	assert_assume(file != NULL);
 
-	// Temporary union for type-punning
-	union {
-		DBRecord record;
-		char buffer[DB_RECORD_SIZE];
-	} temp;
+	// Lay the record out in the on-disk slot format
+	DBRecordSlot slot;
+	encodeRecordSlot(record, &slot);
 
-	// Copy the record into the temp variable
-	temp.record = *record;
-
-	// Convert integers to network byte order
-	temp.record.memberId = htonDBIndex(temp.record.memberId);
-	temp.record.birthDate = htonDBDate(temp.record.birthDate);
-
-	// Write the temp variable buffer to the file
-	if (fwrite(temp.buffer, sizeof(char), DB_RECORD_SIZE, file) != DB_RECORD_SIZE) {
+	// Write the slot to the file
+	if (scheduledWrite(&slot, sizeof(char), DB_SLOT_SIZE, file) != DB_SLOT_SIZE) {
 		return DB_FILE_ERROR;
 	}
 
@@ -115,23 +113,23 @@ DBCode readRecord(FILE *file, DBRecord *record) {
 	assert_assume(record != NULL);
 	assert_assume(file != NULL);
 
-	// Temporary union for type-punning
-	union {
-		DBRecord record;
-		char buffer[DB_RECORD_SIZE];
-	} temp;
+	// The memberId is implied by the slot position
+	long pos = ftell(file);
+	if (pos < 0 || pos % DB_SLOT_SIZE != 0) {
+		return DB_FILE_ERROR;
+	}
 
-	// Read the file contents into the temp variable buffer
-	if (fread(temp.buffer, sizeof(char), DB_RECORD_SIZE, file) != DB_RECORD_SIZE) {
+	// Read the slot from the file
+	DBRecordSlot slot;
+	if (scheduledRead(&slot, sizeof(char), DB_SLOT_SIZE, file) != DB_SLOT_SIZE) {
 		return DB_FILE_ERROR;
 	}
 
-	// Convert integers to host byte order
-	temp.record.memberId = ntohDBIndex(temp.record.memberId);
-	temp.record.birthDate = ntohDBDate(temp.record.birthDate);
+	// Reject torn, misplaced or corrupt slots before trusting their contents
+	DBIndex memberId = (DBIndex)(pos / DB_SLOT_SIZE + DB_MIN_ENTRY);
+	CONDITIONAL_RETURN(verifyRecordSlot(&slot, memberId));
 
-	// Copy the temp variable into the record
-	*record = temp.record;
+	decodeRecordSlot(&slot, memberId, record);
 
 	return DB_SUCCESS;
 }
@@ -213,8 +211,8 @@ DBCode receiveRecord(SOCKET socket, DBRecord *record, bool receiveId) {
 		size -= DB_INDEX_SIZE;
 	}
 
-	// Receive the socket contents and store it in the temp variable
-	int result = recv(socket, address, size, 0);
+	// Wait for the whole record, since a stream may deliver it in pieces
+	int result = recv(socket, address, size, MSG_WAITALL);
 	if (result == SOCKET_ERROR) {
 		return DB_SOCKET_ERROR;
 	}
@@ -276,8 +274,8 @@ DBCode receiveCode(SOCKET socket, DBCode *code) {
 
 	DBCode temp;
 
-	// Receive the code from the socket
-	int result = recv(socket, (char *)&temp, DB_CODE_SIZE, 0);
+	// Receive the code from the socket, waiting for every byte
+	int result = recv(socket, (char *)&temp, DB_CODE_SIZE, MSG_WAITALL);
 	if (result == SOCKET_ERROR) {
 		return DB_SOCKET_ERROR;
 	}
@@ -298,7 +296,7 @@ DBCode receiveCode(SOCKET socket, DBCode *code) {
 	                DBIndex code:  The code to send to the socket
 	Returns:        DBCode:  A return status code
 */
-DBIndex sendIndex(SOCKET socket, DBIndex index) {
+DBCode sendIndex(SOCKET socket, DBIndex index) {
 
 	// Establish function preconditions
 	assert_assume(socket != INVALID_SOCKET);
@@ -325,7 +323,7 @@ DBIndex sendIndex(SOCKET socket, DBIndex index) {
 	                DBIndex *code:  The record to code from the socket
 	Returns:        DBCode:  A return status code
 */
-DBIndex receiveIndex(SOCKET socket, DBIndex *index) {
+DBCode receiveIndex(SOCKET socket, DBIndex *index) {
 
 	// Establish function preconditions
 	assert_assume(index != NULL);
@@ -333,8 +331,8 @@ DBIndex receiveIndex(SOCKET socket, DBIndex *index) {
 
 	DBIndex temp;
 
-	// Receive the code from the socket
-	int result = recv(socket, (char *)&temp, DB_INDEX_SIZE, 0);
+	// Receive the code from the socket, waiting for every byte
+	int result = recv(socket, (char *)&temp, DB_INDEX_SIZE, MSG_WAITALL);
 	if (result == SOCKET_ERROR) {
 		return DB_SOCKET_ERROR;
 	}
@@ -351,172 +349,177 @@ DBIndex receiveIndex(SOCKET socket, DBIndex *index) {
 
 /*	Name:           handleInsertRequest
 	Description:    Handles a database insert request from the server-side
-	Parameters:     FILE *file:  The database file to handle the request with
+	Parameters:     DBContext *context:  The database state to handle the request with
 	                SOCKET socket:  The database socket to handle the request with
-	                DBIndex *entries:  The number of entries in the database
 	Returns:        DBCode:  A return status code
 */
-DBCode handleInsertRequest(FILE *file, SOCKET socket, DBIndex *entries) {
+DBCode handleInsertRequest(DBContext *context, SOCKET socket) {
 
 	// Establish function preconditions
-	assert_assume(file != NULL);
+	assert_assume(context != NULL && context->file != NULL);
 	assert_assume(socket != INVALID_SOCKET);
-	assert_assume(entries != NULL && 0 <= *entries && *entries <= DB_MAX_ENTRY);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
 
 	// Validate the database capacity
-	if (*entries == DB_MAX_ENTRY) {
+	markTrace(DB_TRACE_VALIDATE);
+	if (context->entries == DB_MAX_ENTRY) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBRecord *record = allocateRequestRecord();
+	if (record == NULL) {
 		return DB_REQUEST_DENIED;
 	}
 
 	// Send a confirmation code
-	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+	markTrace(DB_TRACE_SEND);
+	DBCode status = sendCode(socket, DB_REQUEST_SUCCESS);
 
 	// Receive the record to insert
-	DBRecord record;
-	CONDITIONAL_RETURN(receiveRecord(socket, &record, false));
-
-	// Seek to the end of the file
-	if (fseek(file, 0, SEEK_END) != 0) {
-		return DB_FILE_ERROR;
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_RECEIVE);
+		status = receiveRecord(socket, record, false);
 	}
 
-	// Write the record to the file
-	record.memberId = *entries + 1;
-	CONDITIONAL_RETURN(writeRecord(file, &record));
-
-	// Increment the database entry count
-	++(*entries);
+	// Insert the record
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_IO);
+		status = insertRecord(context, record);
+	}
 
 	// Send a confirmation code
-	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_SEND);
+		status = sendCode(socket, DB_REQUEST_SUCCESS);
+	}
 
-	return DB_SUCCESS;
+	freeRequestRecord(record);
+
+	return status;
 }
 
 
 /*	Name:           handleUpdateRequest
 	Description:    Handles a database update request from the server-side
-	Parameters:     FILE *file:  The database file to handle the request with
+	Parameters:     DBContext *context:  The database state to handle the request with
 	                SOCKET socket:  The database socket to handle the request with
-	                DBIndex entries:  The number of entries in the database
 	Returns:        DBCode:  A return status code
 */
-DBCode handleUpdateRequest(FILE *file, SOCKET socket, DBIndex entries) {
+DBCode handleUpdateRequest(DBContext *context, SOCKET socket) {
 
 	// Establish function preconditions
-	assert_assume(file != NULL);
+	assert_assume(context != NULL && context->file != NULL);
 	assert_assume(socket != INVALID_SOCKET);
-	assert_assume(0 <= entries && entries <= DB_MAX_ENTRY);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	DBRecord *record = allocateRequestRecord();
+	if (record == NULL) {
+		return DB_REQUEST_DENIED;
+	}
 
 	// Send a confirmation code
-	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+	markTrace(DB_TRACE_SEND);
+	DBCode status = sendCode(socket, DB_REQUEST_SUCCESS);
 
 	// Receive the record to update
-	DBRecord record;
-	CONDITIONAL_RETURN(receiveRecord(socket, &record, true));
-
-	// Validate the record memberId
-	if (record.memberId < DB_MIN_ENTRY) {
-		return DB_REQUEST_DENIED;
-	}
-	if (record.memberId > entries) {
-		return DB_REQUEST_DENIED;
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_RECEIVE);
+		status = receiveRecord(socket, record, true);
 	}
 
-	// Seek the file to the correct position
-	if (fseek(file, (record.memberId - DB_MIN_ENTRY) * DB_RECORD_SIZE, SEEK_SET) != 0) {
-		return DB_FILE_ERROR;
+	// Update the record
+	if (status == DB_SUCCESS) {
+		status = updateRecord(context, record);
 	}
 
-	// Write the record to the file
-	CONDITIONAL_RETURN(writeRecord(file, &record));
-
 	// Send a completion code
-	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_SEND);
+		status = sendCode(socket, DB_REQUEST_SUCCESS);
+	}
 
-	return DB_SUCCESS;
+	freeRequestRecord(record);
+
+	return status;
 }
 
 
 /*	Name:           handleFindRequest
 	Description:    Handles a database find request from the server-side
-	Parameters:     FILE *file:  The database file to handle the request with
+	Parameters:     DBContext *context:  The database state to handle the request with
 	                SOCKET socket:  The database socket to handle the request with
-	                DBIndex entries:  The number of entries in the database
 	Returns:        DBCode:  A return status code
 */
-DBCode handleFindRequest(FILE *file, SOCKET socket, DBIndex entries) {
+DBCode handleFindRequest(DBContext *context, SOCKET socket) {
 
 	// Establish function preconditions
-	assert_assume(file != NULL);
+	assert_assume(context != NULL && context->file != NULL);
 	assert_assume(socket != INVALID_SOCKET);
-	assert_assume(0 <= entries && entries <= DB_MAX_ENTRY);
-
-	// Send a confirmation code
-	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
 
-	DBIndex memberId;
-	// Receive the memberId to find in the database
-	int result = recv(socket, (char *)&memberId, DB_INDEX_SIZE, 0);
-	if (result == SOCKET_ERROR) {
-		return DB_SOCKET_ERROR;
-	}
-	if (result != DB_INDEX_SIZE) {
-		return DB_SOCKET_MISMATCH;
+	DBRecord *record = allocateRequestRecord();
+	if (record == NULL) {
+		return DB_REQUEST_DENIED;
 	}
 
-	// Convert the memberId to host byte order
-	memberId = ntohDBIndex(memberId);
+	// Send a confirmation code
+	markTrace(DB_TRACE_SEND);
+	DBCode status = sendCode(socket, DB_REQUEST_SUCCESS);
 
-	// Validate the memberId
-	if (memberId < DB_MIN_ENTRY) {
-		return DB_REQUEST_DENIED;
-	}
-	if (memberId > entries) {
-		return DB_REQUEST_DENIED;
+	// Receive the memberId to find in the database
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_RECEIVE);
+		status = receiveIndex(socket, &record->memberId);
 	}
 
-	// Seek the file to the correct position
-	if (fseek(file, (memberId - DB_MIN_ENTRY) * DB_RECORD_SIZE, SEEK_SET) != 0) {
-		return DB_FILE_ERROR;
+	// Read the record
+	if (status == DB_SUCCESS) {
+		status = findRecord(context, record);
 	}
 
-	// Read the record from the file
-	DBRecord record;
-	CONDITIONAL_RETURN(readRecord(file, &record));
-
 	// Send a confirmation code
-	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_SEND);
+		status = sendCode(socket, DB_REQUEST_SUCCESS);
+	}
 
 	// Send the record
-	CONDITIONAL_RETURN(sendRecord(socket, &record, true));
+	if (status == DB_SUCCESS) {
+		status = sendRecord(socket, record, true);
+	}
+
+	freeRequestRecord(record);
 
 	// Receive a completion code
-	DBCode response;
-	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_WAIT);
+		DBCode response;
+		status = receiveCode(socket, &response);
+	}
 
-	return DB_SUCCESS;
+	return status;
 }
 
 
 /*	Name:           handleQueryRequest
 	Description:    Handles a database query request from the server-side
-	Parameters:     FILE *file:  The database file to handle the request with
+	Parameters:     DBContext *context:  The database state to handle the request with
 	                SOCKET socket:  The database socket to handle the request with
-	                DBIndex entries:  The number of entries in the database
 	Returns:        DBCode:  A return status code
 */
-DBCode handleQueryRequest(FILE *file, SOCKET socket, DBIndex entries) {
+DBCode handleQueryRequest(DBContext *context, SOCKET socket) {
 
 	// Establish function preconditions
-	assert_assume(file != NULL);
+	assert_assume(context != NULL && context->file != NULL);
 	assert_assume(socket != INVALID_SOCKET);
-	assert_assume(0 <= entries && entries <= DB_MAX_ENTRY);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
 
 	// Send a confirmation code
 	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
 
 	// Send the number of entries in the database
+	DBIndex entries;
+	CONDITIONAL_RETURN(countRecords(context, &entries));
 	CONDITIONAL_RETURN(sendIndex(socket, entries));
 
 	// Receive a completion code
@@ -527,39 +530,140 @@ DBCode handleQueryRequest(FILE *file, SOCKET socket, DBIndex entries) {
 }
 
 
-/*	Name:           handleRequest
-	Description:    Handles a database request from the server-side
-	Parameters:     FILE *file:  The database file to handle the request with
+/*	Name:           handleExportRequest
+	Description:    Handles a database export request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
 	                SOCKET socket:  The database socket to handle the request with
-	                DBCode command:  The request to handle
-	                DBIndex *entries:  The number of entries in the database
 	Returns:        DBCode:  A return status code
 */
-DBCode handleRequest(FILE *file, SOCKET socket, DBCode command, DBIndex *entries) {
+DBCode handleExportRequest(DBContext *context, SOCKET socket) {
 
 	// Establish function preconditions
-	assert_assume(file != NULL);
+	assert_assume(context != NULL && context->file != NULL);
 	assert_assume(socket != INVALID_SOCKET);
-	assert_assume(0 <= *entries && *entries <= DB_MAX_ENTRY);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	// Each record is preceded by its read status, so a failed read ends the export in place of a record
+	DBCode status = DB_SUCCESS;
+
+	// Without a version store the file cannot change underneath the export
+	if (context->versions == NULL) {
+
+		// Records are contiguous, so one seek covers the whole scan
+		if (fseek(context->file, 0, SEEK_SET) != 0) {
+			return DB_FILE_ERROR;
+		}
+
+		CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+		CONDITIONAL_RETURN(sendIndex(socket, context->entries));
+
+		for (DBIndex i = 0; status == DB_SUCCESS && i < context->entries; ++i) {
+			DBRecord record;
+			status = readRecord(context->file, &record);
+			CONDITIONAL_RETURN(sendCode(socket, status));
+			if (status == DB_SUCCESS) {
+				CONDITIONAL_RETURN(sendRecord(socket, &record, true));
+			}
+		}
+	}
+	else {
+
+		// Pin a snapshot so concurrent updates neither block nor tear the export
+		DBSnapshot snapshot;
+		CONDITIONAL_RETURN(beginSnapshot(context->versions, &context->entries, &snapshot));
+
+		DBCode result = sendCode(socket, DB_REQUEST_SUCCESS);
+		if (result == DB_SUCCESS) {
+			result = sendIndex(socket, snapshot.entries);
+		}
+
+		for (DBIndex i = DB_MIN_ENTRY; result == DB_SUCCESS && status == DB_SUCCESS && i <= snapshot.entries; ++i) {
+			DBRecord record;
+			record.memberId = i;
+			status = readSnapshotRecord(context->versions, context->file, &snapshot, &record);
+			result = sendCode(socket, status);
+			if (result == DB_SUCCESS && status == DB_SUCCESS) {
+				result = sendRecord(socket, &record, true);
+			}
+		}
+
+		endSnapshot(context->versions, &snapshot);
+
+		CONDITIONAL_RETURN(result);
+	}
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	// A read failure was already sent in the stream, so it must not be sent again
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           dispatchRequest
+	Description:    Passes an admitted request to the handler for its command
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	                DBCode command:  The request to handle
+	Returns:        DBCode:  A return status code
+*/
+DBCode dispatchRequest(DBContext *context, SOCKET socket, DBCode command) {
 
 	DBCode status;
 
 	// Jump to the command to handle
 	switch (command) {
 	case DB_REQUEST_INSERT:
-		status = handleInsertRequest(file, socket, entries);
+		status = handleInsertRequest(context, socket);
 		break;
 
 	case DB_REQUEST_UPDATE:
-		status = handleUpdateRequest(file, socket, *entries);
+		status = handleUpdateRequest(context, socket);
 		break;
 
 	case DB_REQUEST_FIND:
-		status = handleFindRequest(file, socket, *entries);
+		status = handleFindRequest(context, socket);
 		break;
 
 	case DB_REQUEST_QUERY:
-		status = handleQueryRequest(file, socket, *entries);
+		status = handleQueryRequest(context, socket);
+		break;
+
+	case DB_REQUEST_EXPORT:
+		status = handleExportRequest(context, socket);
+		break;
+
+	case DB_REQUEST_BEGIN:
+		status = handleTransactionRequest(context, socket);
+		break;
+
+	case DB_REQUEST_AGGREGATE:
+		status = handleAggregateRequest(context, socket);
+		break;
+
+	case DB_REQUEST_FILTER:
+		status = handleFilterRequest(context, socket);
+		break;
+
+	case DB_REQUEST_LOAD:
+		status = handleLoadRequest(context, socket);
+		break;
+
+	case DB_REQUEST_SORTED:
+		status = handleSortedExportRequest(context, socket);
+		break;
+
+	case DB_REQUEST_SUBSCRIBE:
+		status = handleSubscribeRequest(context, socket);
+		break;
+
+	case DB_REQUEST_LEASE:
+		status = handleLeaseRequest(context, socket);
+		break;
+
+	case DB_REQUEST_FUZZY:
+		status = handleFuzzyRequest(context, socket);
 		break;
 
 	default:
@@ -568,6 +672,59 @@ DBCode handleRequest(FILE *file, SOCKET socket, DBCode command, DBIndex *entries
 		break;
 	}
 
+	return status;
+}
+
+
+/*	Name:           handleContextRequest
+	Description:    Handles a database request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	                DBCode command:  The request to handle
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleContextRequest(DBContext *context, SOCKET socket, DBCode command) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	// Time the request when a tracer is running, starting with the rest of its header
+	beginTrace();
+	markTrace(DB_TRACE_RECEIVE);
+
+	DBCode status = DB_SUCCESS;
+
+	// A deadline prefix carries the time the request may wait, followed by the request itself
+	ULONG64 deadline = 0;
+	if (command == DB_REQUEST_DEADLINE) {
+
+		DBIndex milliseconds;
+		status = receiveIndex(socket, &milliseconds);
+		if (status == DB_SUCCESS) {
+			status = receiveCode(socket, &command);
+
+			// A zero deadline asks for the default queue limit rather than shedding at once
+			if (milliseconds != 0) {
+				deadline = GetTickCount64() + milliseconds;
+			}
+		}
+	}
+
+	// Shed the request before its payload is read, sending the busy code in place of a confirmation
+	if (status == DB_SUCCESS) {
+		markTrace(DB_TRACE_ADMIT);
+
+		// A subscription lasts as long as its connection, so it only checks its deadline instead of holding a slot
+		DBAdmission *admission = (command != DB_REQUEST_SUBSCRIBE) ? context->admission : NULL;
+		status = admitRequest(admission, deadline);
+		if (status == DB_SUCCESS) {
+			status = dispatchRequest(context, socket, command);
+			releaseRequest(admission);
+		}
+	}
+
 	// If there is an uncommunicated request fail state
 	if (status != DB_SUCCESS
 		&& status != DB_SOCKET_ERROR) {
@@ -579,6 +736,39 @@ DBCode handleRequest(FILE *file, SOCKET socket, DBCode command, DBIndex *entries
 		}
 	}
 
+	endTrace(command, status);
+
+	// Request memory does not outlive the request
+	DBArena *arena = boundArena();
+	if (arena != NULL) {
+		resetArena(arena);
+	}
+
+	return status;
+}
+
+
+/*	Name:           handleRequest
+	Description:    Handles a database request from the server-side
+	Parameters:     FILE *file:  The database file to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	                DBCode command:  The request to handle
+	                DBIndex *entries:  The number of entries in the database
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleRequest(FILE *file, SOCKET socket, DBCode command, DBIndex *entries) {
+
+	// Establish function preconditions
+	assert_assume(file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+	assert_assume(0 <= *entries && *entries <= DB_MAX_ENTRY);
+
+	// Handle the request with an unversioned context
+	DBContext context = { file, *entries, NULL, NULL, NULL, NULL, NULL, NULL };
+	DBCode status = handleContextRequest(&context, socket, command);
+
+	*entries = context.entries;
+
 	return status;
 }
 
@@ -725,6 +915,78 @@ DBCode sendQueryRequest(SOCKET socket, DBIndex *entries) {
 }
 
 
+/*	Name:           sendExportRequest
+	Description:    Sends a database export request from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBRecordCallback callback:  The function to pass each exported record to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendExportRequest(SOCKET socket, DBRecordCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(callback != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_EXPORT));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive the number of records in the export
+	DBIndex entries;
+	CONDITIONAL_RETURN(receiveIndex(socket, &entries));
+
+	// Receive every record, even after the callback stops, to keep the stream in sync
+	DBCode status = DB_SUCCESS;
+	for (DBIndex i = 0; i < entries; ++i) {
+
+		// A failed read on the server ends the export in place of the record
+		CONDITIONAL_RETURN(receiveCode(socket, &response));
+		if (response != DB_SUCCESS) {
+			status = response;
+			break;
+		}
+
+		DBRecord record;
+		CONDITIONAL_RETURN(receiveRecord(socket, &record, true));
+		if (status == DB_SUCCESS) {
+			status = callback(&record, user);
+		}
+	}
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_SUCCESS));
+
+	return status;
+}
+
+
+/*	Name:           seekRecord
+	Description:    Positions a database file at the start of a record
+	Parameters:     FILE *file:  The database file to seek
+	                DBIndex memberId:  The memberId of the record
+	Returns:        DBCode:  A return status code
+*/
+DBCode seekRecord(FILE *file, DBIndex memberId) {
+
+	// Establish function preconditions
+	assert_assume(file != NULL);
+	assert_assume(DB_MIN_ENTRY <= memberId && memberId <= DB_MAX_ENTRY + 1);
+
+	if (fseek(file, (long)(memberId - DB_MIN_ENTRY) * DB_SLOT_SIZE, SEEK_SET) != 0) {
+		return DB_FILE_ERROR;
+	}
+
+	return DB_SUCCESS;
+}
+
+
 /*	Name:           readEntryCount
 	Description:    Reads the number of entries in the database
 	Parameters:     FILE *file:  The database file to read from
@@ -743,12 +1005,12 @@ DBCode readEntryCount(FILE *file, DBIndex *entries) {
 	}
 	// Get the file position offset
 	long pos = ftell(file);
-	if (pos % DB_RECORD_SIZE != 0) {
+	if (pos % DB_SLOT_SIZE != 0) {
 		return DB_FILE_ERROR;
 	}
 
 	// Calculate the number of entries in the file
-	*entries = (DBIndex)(pos / DB_RECORD_SIZE);
+	*entries = (DBIndex)(pos / DB_SLOT_SIZE);
 
 	return DB_SUCCESS;
 }
@@ -0,0 +1,647 @@
+
+#include "extra.h"
+#include "filter.h"
+
+#include <string.h>
+
+
+// The encoded sizes of each instruction form
+#define DB_FILTER_COMPARE_SIZE  6
+#define DB_FILTER_NAME_SIZE     3
+#define DB_FILTER_COMBINE_SIZE  1
+
+
+// A struct to store the state of a filtered scan
+typedef struct DBFilterScan {
+	const DBCompiledFilter *filter;
+	SOCKET socket;
+} DBFilterScan;
+
+
+// Prototypes for filter evaluation
+void extractColumn(uint8_t, const DBRecordSlot *, DBIndex, size_t, uint32_t *);
+void compareColumn(uint8_t, uint32_t, const uint32_t *, size_t, uint64_t *);
+void compareNames(const DBFilterInstruction *, const DBRecordSlot *, size_t, uint64_t *);
+DBCode sendMatches(const DBRecordSlot *, DBIndex, size_t, void *);
+
+
+
+/*	Name:           initFilter
+	Description:    Initializes an empty filter program
+	Parameters:     DBFilter *filter:  The filter to initialize
+	Returns:        void
+*/
+void initFilter(DBFilter *filter) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+
+	filter->size = 0;
+	filter->overflow = false;
+}
+
+
+/*	Name:           filterCompare
+	Description:    Appends a numeric comparison against a constant
+	Parameters:     DBFilter *filter:  The filter to append to
+	                DBFilterOp op:  The comparison, DB_FILTER_EQ to DB_FILTER_GE
+	                DBFilterField field:  The numeric field to compare
+	                uint32_t value:  The constant to compare against
+	Returns:        void
+*/
+void filterCompare(DBFilter *filter, DBFilterOp op, DBFilterField field, uint32_t value) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+	assert_assume(DB_FILTER_EQ <= op && op <= DB_FILTER_GE);
+
+	if (filter->size + DB_FILTER_COMPARE_SIZE > DB_FILTER_MAX_PROGRAM) {
+		filter->overflow = true;
+		return;
+	}
+
+	uint8_t *code = filter->program + filter->size;
+	code[0] = (uint8_t)op;
+	code[1] = (uint8_t)field;
+
+	uint32_t temp = htonl(value);
+	memcpy(code + 2, &temp, sizeof(temp));
+
+	filter->size += DB_FILTER_COMPARE_SIZE;
+}
+
+
+/*	Name:           filterDate
+	Description:    Appends a comparison of the whole birth date against a constant
+	Parameters:     DBFilter *filter:  The filter to append to
+	                DBFilterOp op:  The comparison, DB_FILTER_EQ to DB_FILTER_GE
+	                DBDate date:  The date to compare against
+	Returns:        void
+*/
+void filterDate(DBFilter *filter, DBFilterOp op, DBDate date) {
+
+	// Dates compare in their packed slot form
+	uint32_t packed = (uint32_t)(date.day & 0x1F)
+		| (uint32_t)(date.month & 0x0F) << 5
+		| (uint32_t)(date.year & DB_SLOT_MAX_YEAR) << 9;
+
+	filterCompare(filter, op, DB_FIELD_BIRTH_DATE, packed);
+}
+
+
+/*	Name:           filterName
+	Description:    Appends a name prefix or equality test
+	Parameters:     DBFilter *filter:  The filter to append to
+	                DBFilterOp op:  DB_FILTER_PREFIX or DB_FILTER_EQUALS
+	                DBFilterField field:  The name field to test
+	                char *text:  The prefix or name to test for
+	Returns:        void
+*/
+void filterName(DBFilter *filter, DBFilterOp op, DBFilterField field, const char *text) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+	assert_assume(text != NULL);
+	assert_assume(op == DB_FILTER_PREFIX || op == DB_FILTER_EQUALS);
+
+	size_t length = strlen(text);
+	if (length > DB_SLOT_NAME_SIZE
+		|| filter->size + DB_FILTER_NAME_SIZE + length > DB_FILTER_MAX_PROGRAM) {
+		filter->overflow = true;
+		return;
+	}
+
+	uint8_t *code = filter->program + filter->size;
+	code[0] = (uint8_t)op;
+	code[1] = (uint8_t)field;
+	code[2] = (uint8_t)length;
+	memcpy(code + DB_FILTER_NAME_SIZE, text, length);
+
+	filter->size += (uint16_t)(DB_FILTER_NAME_SIZE + length);
+}
+
+
+/*	Name:           filterCombine
+	Description:    Appends a logical operator over the preceding results
+	Parameters:     DBFilter *filter:  The filter to append to
+	                DBFilterOp op:  DB_FILTER_AND, DB_FILTER_OR or DB_FILTER_NOT
+	Returns:        void
+*/
+void filterCombine(DBFilter *filter, DBFilterOp op) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+	assert_assume(op == DB_FILTER_AND || op == DB_FILTER_OR || op == DB_FILTER_NOT);
+
+	if (filter->size + DB_FILTER_COMBINE_SIZE > DB_FILTER_MAX_PROGRAM) {
+		filter->overflow = true;
+		return;
+	}
+
+	filter->program[filter->size] = (uint8_t)op;
+	filter->size += DB_FILTER_COMBINE_SIZE;
+}
+
+
+/*	Name:           compileFilter
+	Description:    Validates a filter program and decodes its operands
+	Parameters:     uint8_t *program:  The encoded program
+	                size_t size:  The size of the program in bytes
+	                DBCompiledFilter *filter:  The compiled filter
+	Returns:        DBCode:  A return status code
+*/
+DBCode compileFilter(const uint8_t *program, size_t size, DBCompiledFilter *filter) {
+
+	// Establish function preconditions
+	assert_assume(program != NULL || size == 0);
+	assert_assume(filter != NULL);
+
+	filter->count = 0;
+	size_t depth = 0;
+
+	for (size_t pos = 0; pos < size; ) {
+
+		if (filter->count == DB_FILTER_MAX_OPS) {
+			return DB_REQUEST_DENIED;
+		}
+
+		DBFilterInstruction *instruction = &filter->instructions[filter->count];
+		memset(instruction, 0, sizeof(DBFilterInstruction));
+		instruction->op = program[pos];
+
+		switch (instruction->op) {
+		case DB_FILTER_EQ:
+		case DB_FILTER_NE:
+		case DB_FILTER_LT:
+		case DB_FILTER_LE:
+		case DB_FILTER_GT:
+		case DB_FILTER_GE:
+			if (size - pos < DB_FILTER_COMPARE_SIZE) {
+				return DB_REQUEST_DENIED;
+			}
+			instruction->field = program[pos + 1];
+			if (instruction->field < DB_FIELD_MEMBER_ID || instruction->field > DB_FIELD_BIRTH_DATE) {
+				return DB_REQUEST_DENIED;
+			}
+			memcpy(&instruction->value, program + pos + 2, sizeof(uint32_t));
+			instruction->value = ntohl(instruction->value);
+			pos += DB_FILTER_COMPARE_SIZE;
+			++depth;
+			break;
+
+		case DB_FILTER_PREFIX:
+		case DB_FILTER_EQUALS:
+			if (size - pos < DB_FILTER_NAME_SIZE) {
+				return DB_REQUEST_DENIED;
+			}
+			instruction->field = program[pos + 1];
+			instruction->length = program[pos + 2];
+			if ((instruction->field != DB_FIELD_FIRST_NAME && instruction->field != DB_FIELD_LAST_NAME)
+				|| instruction->length > DB_SLOT_NAME_SIZE
+				|| size - pos - DB_FILTER_NAME_SIZE < instruction->length) {
+				return DB_REQUEST_DENIED;
+			}
+
+			// Unused bytes stay NUL, matching the padding of a slot name
+			memcpy(instruction->text, program + pos + DB_FILTER_NAME_SIZE, instruction->length);
+			pos += DB_FILTER_NAME_SIZE + instruction->length;
+			++depth;
+			break;
+
+		case DB_FILTER_AND:
+		case DB_FILTER_OR:
+			if (depth < 2) {
+				return DB_REQUEST_DENIED;
+			}
+			pos += DB_FILTER_COMBINE_SIZE;
+			--depth;
+			break;
+
+		case DB_FILTER_NOT:
+			if (depth < 1) {
+				return DB_REQUEST_DENIED;
+			}
+			pos += DB_FILTER_COMBINE_SIZE;
+			break;
+
+		default:
+			return DB_REQUEST_DENIED;
+		}
+
+		if (depth > DB_FILTER_MAX_DEPTH) {
+			return DB_REQUEST_DENIED;
+		}
+
+		++filter->count;
+	}
+
+	// A complete program leaves exactly one result
+	if (depth != 1) {
+		return DB_REQUEST_DENIED;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           extractColumn
+	Description:    Extracts one numeric field from every slot in a block
+	Parameters:     uint8_t field:  The field to extract
+	                DBRecordSlot *slots:  The block of slots
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots
+	                uint32_t *column:  The extracted values
+	Returns:        void
+*/
+void extractColumn(uint8_t field, const DBRecordSlot *slots, DBIndex first, size_t count, uint32_t *column) {
+
+	// The memberId is implied by position
+	if (field == DB_FIELD_MEMBER_ID) {
+		for (size_t i = 0; i < count; ++i) {
+			column[i] = (uint32_t)(first + i);
+		}
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		column[i] = slots[i].birthDate[0] | (uint32_t)slots[i].birthDate[1] << 8 | (uint32_t)slots[i].birthDate[2] << 16;
+	}
+
+	// Narrow the packed date to the requested part
+	switch (field) {
+	case DB_FIELD_BIRTH_YEAR:
+		for (size_t i = 0; i < count; ++i) {
+			column[i] >>= 9;
+		}
+		break;
+
+	case DB_FIELD_BIRTH_MONTH:
+		for (size_t i = 0; i < count; ++i) {
+			column[i] = (column[i] >> 5) & 0x0F;
+		}
+		break;
+
+	case DB_FIELD_BIRTH_DAY:
+		for (size_t i = 0; i < count; ++i) {
+			column[i] &= 0x1F;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/*	Name:           compareColumn
+	Description:    Sets a mask bit for every value in a column that satisfies a comparison
+	Parameters:     uint8_t op:  The comparison
+	                uint32_t value:  The constant to compare against
+	                uint32_t *column:  The values to compare
+	                size_t count:  The number of values
+	                uint64_t *mask:  The resulting mask
+	Returns:        void
+*/
+void compareColumn(uint8_t op, uint32_t value, const uint32_t *column, size_t count, uint64_t *mask) {
+
+	memset(mask, 0, sizeof(uint64_t) * DB_FILTER_MASK_WORDS);
+
+// Each comparison gets its own branch-free loop
+#define DB_FILTER_COMPARE_LOOP(expr) \
+	for (size_t i = 0; i < count; ++i) { \
+		mask[i / 64] |= (uint64_t)(column[i] expr value) << (i % 64); \
+	}
+
+	switch (op) {
+	case DB_FILTER_EQ: DB_FILTER_COMPARE_LOOP(==) break;
+	case DB_FILTER_NE: DB_FILTER_COMPARE_LOOP(!=) break;
+	case DB_FILTER_LT: DB_FILTER_COMPARE_LOOP(<) break;
+	case DB_FILTER_LE: DB_FILTER_COMPARE_LOOP(<=) break;
+	case DB_FILTER_GT: DB_FILTER_COMPARE_LOOP(>) break;
+	case DB_FILTER_GE: DB_FILTER_COMPARE_LOOP(>=) break;
+	default: break;
+	}
+
+#undef DB_FILTER_COMPARE_LOOP
+}
+
+
+/*	Name:           compareNames
+	Description:    Sets a mask bit for every slot whose name matches a prefix or equality test
+	Parameters:     DBFilterInstruction *instruction:  The name test
+	                DBRecordSlot *slots:  The block of slots
+	                size_t count:  The number of slots
+	                uint64_t *mask:  The resulting mask
+	Returns:        void
+*/
+void compareNames(const DBFilterInstruction *instruction, const DBRecordSlot *slots, size_t count, uint64_t *mask) {
+
+	memset(mask, 0, sizeof(uint64_t) * DB_FILTER_MASK_WORDS);
+
+	size_t offset = (instruction->field == DB_FIELD_FIRST_NAME)
+		? offsetof(DBRecordSlot, firstName)
+		: offsetof(DBRecordSlot, lastName);
+
+	// Equality compares the whole NUL padded field, a prefix only its own length
+	size_t length = (instruction->op == DB_FILTER_EQUALS) ? DB_SLOT_NAME_SIZE : instruction->length;
+
+	for (size_t i = 0; i < count; ++i) {
+		const char *name = (const char *)&slots[i] + offset;
+		mask[i / 64] |= (uint64_t)(memcmp(name, instruction->text, length) == 0) << (i % 64);
+	}
+}
+
+
+/*	Name:           evaluateFilter
+	Description:    Runs a compiled filter over a block of slots, an instruction at a time
+	Parameters:     DBCompiledFilter *filter:  The filter to run
+	                DBRecordSlot *slots:  The block of slots
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots, at most DB_SCAN_BLOCK_SLOTS
+	                uint64_t *mask:  The DB_FILTER_MASK_WORDS words marking matching slots
+	Returns:        void
+*/
+void evaluateFilter(const DBCompiledFilter *filter, const DBRecordSlot *slots, DBIndex first, size_t count, uint64_t *mask) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL && filter->count != 0);
+	assert_assume(slots != NULL);
+	assert_assume(count <= DB_SCAN_BLOCK_SLOTS);
+	assert_assume(mask != NULL);
+
+	uint64_t stack[DB_FILTER_MAX_DEPTH][DB_FILTER_MASK_WORDS];
+	uint32_t column[DB_SCAN_BLOCK_SLOTS];
+	size_t depth = 0;
+
+	// Each instruction processes the whole block, so dispatch is paid per block, not per record
+	for (size_t n = 0; n < filter->count; ++n) {
+
+		const DBFilterInstruction *instruction = &filter->instructions[n];
+
+		switch (instruction->op) {
+		case DB_FILTER_AND:
+			--depth;
+			for (size_t w = 0; w < DB_FILTER_MASK_WORDS; ++w) {
+				stack[depth - 1][w] &= stack[depth][w];
+			}
+			break;
+
+		case DB_FILTER_OR:
+			--depth;
+			for (size_t w = 0; w < DB_FILTER_MASK_WORDS; ++w) {
+				stack[depth - 1][w] |= stack[depth][w];
+			}
+			break;
+
+		case DB_FILTER_NOT:
+			for (size_t w = 0; w < DB_FILTER_MASK_WORDS; ++w) {
+				stack[depth - 1][w] = ~stack[depth - 1][w];
+			}
+			break;
+
+		case DB_FILTER_PREFIX:
+		case DB_FILTER_EQUALS:
+			compareNames(instruction, slots, count, stack[depth]);
+			++depth;
+			break;
+
+		default:
+			extractColumn(instruction->field, slots, first, count, column);
+			compareColumn(instruction->op, instruction->value, column, count, stack[depth]);
+			++depth;
+			break;
+		}
+	}
+
+	assert(depth == 1);
+
+	// Clear bits past the end of a short block that NOT may have set
+	for (size_t w = 0; w < DB_FILTER_MASK_WORDS; ++w) {
+		size_t base = w * 64;
+		if (base >= count) {
+			mask[w] = 0;
+		}
+		else if (count - base < 64) {
+			mask[w] = stack[0][w] & ((UINT64_C(1) << (count - base)) - 1);
+		}
+		else {
+			mask[w] = stack[0][w];
+		}
+	}
+}
+
+
+/*	Name:           sendFilter
+	Description:    Sends a filter program to a socket
+	Parameters:     SOCKET socket:  The socket to send the filter to
+	                DBFilter *filter:  The filter to send
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendFilter(SOCKET socket, const DBFilter *filter) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Never send a program that was cut short
+	if (filter->overflow) {
+		return DB_REQUEST_DENIED;
+	}
+
+	CONDITIONAL_RETURN(sendIndex(socket, filter->size));
+
+	int result = send(socket, (const char *)filter->program, filter->size, 0);
+	if (result == SOCKET_ERROR) {
+		return DB_SOCKET_ERROR;
+	}
+	else if (result != filter->size) {
+		return DB_SOCKET_MISMATCH;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           receiveFilter
+	Description:    Receives and compiles a filter program from a socket
+	Parameters:     SOCKET socket:  The socket to receive the filter from
+	                DBCompiledFilter *filter:  The compiled filter
+	Returns:        DBCode:  A return status code
+*/
+DBCode receiveFilter(SOCKET socket, DBCompiledFilter *filter) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	DBIndex size;
+	CONDITIONAL_RETURN(receiveIndex(socket, &size));
+	if (size == 0 || size > DB_FILTER_MAX_PROGRAM) {
+		return DB_REQUEST_DENIED;
+	}
+
+	uint8_t program[DB_FILTER_MAX_PROGRAM];
+	int result = recv(socket, (char *)program, size, MSG_WAITALL);
+	if (result == SOCKET_ERROR) {
+		return DB_SOCKET_ERROR;
+	}
+	else if (result != size) {
+		return DB_SOCKET_MISMATCH;
+	}
+
+	return compileFilter(program, size, filter);
+}
+
+
+/*	Name:           sendMatches
+	Description:    Sends the slots of a block that pass the filter
+	Parameters:     DBRecordSlot *slots:  The block of slots
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots
+	                void *user:  The filtered scan state
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendMatches(const DBRecordSlot *slots, DBIndex first, size_t count, void *user) {
+
+	DBFilterScan *scan = user;
+
+	uint64_t mask[DB_FILTER_MASK_WORDS];
+	evaluateFilter(scan->filter, slots, first, count, mask);
+
+	DBIndex matches = 0;
+	for (size_t w = 0; w < DB_FILTER_MASK_WORDS; ++w) {
+		for (uint64_t bits = mask[w]; bits != 0; bits &= bits - 1) {
+			++matches;
+		}
+	}
+
+	if (matches == 0) {
+		return DB_SUCCESS;
+	}
+
+	// Send the number of matches in the block, then the matching records
+	CONDITIONAL_RETURN(sendIndex(scan->socket, matches));
+
+	for (size_t i = 0; i < count; ++i) {
+		if ((mask[i / 64] >> (i % 64)) & 1) {
+			DBRecord record;
+			decodeRecordSlot(&slots[i], (DBIndex)(first + i), &record);
+			CONDITIONAL_RETURN(sendRecord(scan->socket, &record, true));
+		}
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           handleFilterRequest
+	Description:    Handles a database filter request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleFilterRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send a confirmation code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Receive and validate the filter before touching the file
+	DBCompiledFilter filter;
+	CONDITIONAL_RETURN(receiveFilter(socket, &filter));
+
+	// Send a confirmation code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Stream the matches of each block, ending with an empty block
+	DBFilterScan scan = { &filter, socket };
+	DBCode status = scanSlots(context, sendMatches, &scan);
+	if (status & (DB_SOCKET_ERROR | DB_SOCKET_MISMATCH)) {
+		return status;
+	}
+	CONDITIONAL_RETURN(sendIndex(socket, 0));
+
+	// Blocks are only sent once read, so a failed read ends the stream early with its status
+	CONDITIONAL_RETURN(sendCode(socket, status));
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	// A read failure was already sent in the stream, so it must not be sent again
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendFilterRequest
+	Description:    Sends a database filter request from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBFilter *filter:  The filter records must pass
+	                DBRecordCallback callback:  The function to pass each matching record to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendFilterRequest(SOCKET socket, const DBFilter *filter, DBRecordCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(filter != NULL);
+	assert_assume(callback != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Never start a request with a program that was cut short
+	if (filter->overflow) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_FILTER));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the filter program
+	CONDITIONAL_RETURN(sendFilter(socket, filter));
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive blocks of matches until an empty one, even after the callback stops
+	DBCode status = DB_SUCCESS;
+	for (;;) {
+
+		DBIndex matches;
+		CONDITIONAL_RETURN(receiveIndex(socket, &matches));
+		if (matches == 0) {
+			break;
+		}
+
+		for (DBIndex i = 0; i < matches; ++i) {
+			DBRecord record;
+			CONDITIONAL_RETURN(receiveRecord(socket, &record, true));
+			if (status == DB_SUCCESS) {
+				status = callback(&record, user);
+			}
+		}
+	}
+
+	// Receive the status of the scan, which fails if the server could not read every block
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (status == DB_SUCCESS) {
+		status = response;
+	}
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_SUCCESS));
+
+	return status;
+}
@@ -0,0 +1,996 @@
+
+#include "extra.h"
+#include "fuzzy.h"
+#include "storage.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// SSE2 is part of every x64 target, and of x86 targets built for it
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define DB_FUZZY_SSE2
+#include <emmintrin.h>
+#endif
+
+
+// Characters fold into 37 symbols: padding and punctuation, then letters, then digits
+#define DB_FUZZY_SYMBOLS   37
+#define DB_FUZZY_TRIGRAMS  (DB_FUZZY_SYMBOLS * DB_FUZZY_SYMBOLS * DB_FUZZY_SYMBOLS)
+
+// The most distinct trigrams taken from a query or from the names of one record
+#define DB_FUZZY_MAX_GRAMS  128
+
+// Bitmaps hold a bit for every memberId, in a whole number of 128-bit vectors
+#define DB_FUZZY_BITMAP_WORDS  ((DB_MAX_ENTRY + 128) / 128 * 2)
+
+// Bit planes of the per-record trigram counters, enough to count every trigram of a query
+#define DB_FUZZY_PLANES  6
+
+// The first allocation of a posting list array
+#define DB_FUZZY_ARRAY_INITIAL  8
+
+// The bitmap words of candidates whose names are copied under one hold of the index lock
+#define DB_FUZZY_CHUNK_WORDS  16
+
+
+// A struct to store the records containing one trigram
+typedef struct DBPosting {
+
+	// The number of records, and the capacity of the array
+	DBIndex size;
+	DBIndex capacity;
+
+	// Sorted memberIds while the list is short, then a bitmap once it is long
+	DBIndex *array;
+	uint64_t *bitmap;
+} DBPosting;
+
+
+// A struct to store the folded names of one record
+typedef struct DBIndexedName {
+	char first[DB_RECORD_NAME_SIZE];
+	char last[DB_RECORD_NAME_SIZE];
+	bool present;
+} DBIndexedName;
+
+
+// A struct to store the state of a name index
+struct DBNameIndex {
+
+	SRWLOCK lock;
+
+	// Set once a posting list could not grow, after which searches verify every name
+	bool degraded;
+
+	DBIndexedName names[DB_MAX_ENTRY + 1];
+	DBPosting postings[DB_FUZZY_TRIGRAMS];
+};
+
+
+// A struct to store the working memory of one search
+typedef struct DBFuzzyScratch {
+
+	// Bit-sliced counters of the query trigrams each record contains
+	uint64_t planes[DB_FUZZY_PLANES][DB_FUZZY_BITMAP_WORDS];
+
+	// A bitmap for posting lists still held as arrays
+	uint64_t spread[DB_FUZZY_BITMAP_WORDS];
+
+	// The candidates of one chunk, copied so they are verified without holding the index lock
+	DBIndex ids[DB_FUZZY_CHUNK_WORDS * 64];
+	DBIndexedName names[DB_FUZZY_CHUNK_WORDS * 64];
+} DBFuzzyScratch;
+
+
+// Prototypes for folding names into trigrams
+uint8_t foldSymbol(char);
+size_t foldName(const char *, size_t, char *);
+size_t collectTrigrams(const char *, size_t, uint16_t *, size_t);
+size_t uniqueTrigrams(uint16_t *, size_t);
+size_t nameTrigrams(const DBIndexedName *, uint16_t *);
+
+// Prototypes for maintaining posting lists
+bool addPosting(DBPosting *, DBIndex);
+void removePosting(DBPosting *, DBIndex);
+DBCode indexNameCallback(const DBRecord *, void *);
+
+// Prototypes for counting and verifying candidates
+void countBitmap(DBFuzzyScratch *, const uint64_t *);
+void countPosting(DBFuzzyScratch *, const DBPosting *);
+uint64_t thresholdWord(const DBFuzzyScratch *, size_t, unsigned);
+unsigned boundedDistance(const char *, size_t, const char *, size_t, unsigned);
+unsigned nameDistance(const DBIndexedName *, const char *, size_t, unsigned);
+unsigned recordDistance(const DBRecord *, const char *, size_t, unsigned);
+void rankMatch(DBFuzzyMatch *, size_t, size_t *, DBIndex, unsigned);
+
+
+
+/*	Name:           foldSymbol
+	Description:    Folds a character into one of the trigram symbols
+	Parameters:     char c:  The character to fold
+	Returns:        uint8_t:  0 for padding and punctuation, 1 to 26 for letters and 27 to 36 for digits
+*/
+uint8_t foldSymbol(char c) {
+
+	if ('a' <= c && c <= 'z') {
+		return (uint8_t)(c - 'a' + 1);
+	}
+	if ('A' <= c && c <= 'Z') {
+		return (uint8_t)(c - 'A' + 1);
+	}
+	if ('0' <= c && c <= '9') {
+		return (uint8_t)(c - '0' + 27);
+	}
+
+	return 0;
+}
+
+
+/*	Name:           foldName
+	Description:    Copies a name as its symbols, lowercase with punctuation as spaces
+	Parameters:     char *name:  The name to fold, which need not be terminated
+	                size_t size:  The most characters to read
+	                char *folded:  The folded name, which is terminated
+	Returns:        size_t:  The length of the folded name
+*/
+size_t foldName(const char *name, size_t size, char *folded) {
+
+	// Establish function preconditions
+	assert_assume(name != NULL);
+	assert_assume(folded != NULL);
+
+	static const char symbols[DB_FUZZY_SYMBOLS + 1] = " abcdefghijklmnopqrstuvwxyz0123456789";
+
+	size_t length = 0;
+	while (length < size && name[length] != '\0') {
+		folded[length] = symbols[foldSymbol(name[length])];
+		++length;
+	}
+	folded[length] = '\0';
+
+	return length;
+}
+
+
+/*	Name:           collectTrigrams
+	Description:    Appends the trigrams of a folded name padded with two leading and one trailing space
+	Parameters:     char *text:  The folded name
+	                size_t length:  The length of the name
+	                uint16_t *grams:  The trigram list to append to
+	                size_t count:  The number of trigrams already in the list
+	Returns:        size_t:  The new number of trigrams in the list
+*/
+size_t collectTrigrams(const char *text, size_t length, uint16_t *grams, size_t count) {
+
+	// Establish function preconditions
+	assert_assume(text != NULL);
+	assert_assume(grams != NULL);
+
+	if (length == 0) {
+		return count;
+	}
+
+	// Slide a window of three symbols over the padded name
+	unsigned a = 0, b = 0;
+	for (size_t i = 0; i <= length && count < DB_FUZZY_MAX_GRAMS; ++i) {
+		unsigned c = (i < length) ? foldSymbol(text[i]) : 0;
+		grams[count++] = (uint16_t)((a * DB_FUZZY_SYMBOLS + b) * DB_FUZZY_SYMBOLS + c);
+		a = b;
+		b = c;
+	}
+
+	return count;
+}
+
+
+/*	Name:           uniqueTrigrams
+	Description:    Sorts a trigram list and removes its duplicates
+	Parameters:     uint16_t *grams:  The trigram list
+	                size_t count:  The number of trigrams in the list
+	Returns:        size_t:  The number of distinct trigrams
+*/
+size_t uniqueTrigrams(uint16_t *grams, size_t count) {
+
+	// Establish function preconditions
+	assert_assume(grams != NULL || count == 0);
+
+	// Lists are short, so an insertion sort is quickest
+	for (size_t i = 1; i < count; ++i) {
+		uint16_t gram = grams[i];
+		size_t j = i;
+		for (; j > 0 && grams[j - 1] > gram; --j) {
+			grams[j] = grams[j - 1];
+		}
+		grams[j] = gram;
+	}
+
+	size_t unique = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (unique == 0 || grams[unique - 1] != grams[i]) {
+			grams[unique++] = grams[i];
+		}
+	}
+
+	return unique;
+}
+
+
+/*	Name:           nameTrigrams
+	Description:    Collects the distinct trigrams of the first, last and full name of a record
+	Parameters:     DBIndexedName *name:  The folded names of the record
+	                uint16_t *grams:  The trigram list, holding DB_FUZZY_MAX_GRAMS
+	Returns:        size_t:  The number of distinct trigrams
+*/
+size_t nameTrigrams(const DBIndexedName *name, uint16_t *grams) {
+
+	// Establish function preconditions
+	assert_assume(name != NULL);
+	assert_assume(grams != NULL);
+
+	size_t firstLength = strlen(name->first);
+	size_t lastLength = strlen(name->last);
+
+	// The full name adds the trigrams that cross the space between the names
+	char full[2 * DB_RECORD_NAME_SIZE];
+	memcpy(full, name->first, firstLength);
+	full[firstLength] = ' ';
+	memcpy(full + firstLength + 1, name->last, lastLength);
+
+	size_t count = 0;
+	count = collectTrigrams(name->first, firstLength, grams, count);
+	count = collectTrigrams(name->last, lastLength, grams, count);
+	count = collectTrigrams(full, firstLength + 1 + lastLength, grams, count);
+
+	return uniqueTrigrams(grams, count);
+}
+
+
+/*	Name:           createNameIndex
+	Description:    Allocates an empty name index
+	Parameters:     DBNameIndex **index:  The created index
+	Returns:        DBCode:  A return status code
+*/
+DBCode createNameIndex(DBNameIndex **index) {
+
+	// Establish function preconditions
+	assert_assume(index != NULL);
+
+	DBNameIndex *temp = calloc(1, sizeof(DBNameIndex));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+
+	*index = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           destroyNameIndex
+	Description:    Frees a name index and its posting lists
+	Parameters:     DBNameIndex *index:  The index to destroy
+	Returns:        void
+*/
+void destroyNameIndex(DBNameIndex *index) {
+
+	if (index == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < DB_FUZZY_TRIGRAMS; ++i) {
+		free(index->postings[i].array);
+		free(index->postings[i].bitmap);
+	}
+
+	free(index);
+}
+
+
+/*	Name:           addPosting
+	Description:    Adds a record to a posting list, turning a long array into a bitmap
+	Parameters:     DBPosting *posting:  The posting list
+	                DBIndex memberId:  The record to add
+	Returns:        bool:  Whether the record could be added
+*/
+bool addPosting(DBPosting *posting, DBIndex memberId) {
+
+	// Establish function preconditions
+	assert_assume(posting != NULL);
+	assert_assume(DB_MIN_ENTRY <= memberId && memberId <= DB_MAX_ENTRY);
+
+	if (posting->bitmap != NULL) {
+		uint64_t bit = (uint64_t)1 << (memberId & 63);
+		if ((posting->bitmap[memberId >> 6] & bit) == 0) {
+			posting->bitmap[memberId >> 6] |= bit;
+			++posting->size;
+		}
+		return true;
+	}
+
+	// Records are mostly indexed in memberId order, so the search starts from the end
+	size_t position = posting->size;
+	while (position > 0 && posting->array[position - 1] > memberId) {
+		--position;
+	}
+	if (position > 0 && posting->array[position - 1] == memberId) {
+		return true;
+	}
+
+	if (posting->size == DB_FUZZY_ARRAY_LIMIT) {
+
+		uint64_t *bitmap = calloc(DB_FUZZY_BITMAP_WORDS, sizeof(uint64_t));
+		if (bitmap == NULL) {
+			return false;
+		}
+
+		for (size_t i = 0; i < posting->size; ++i) {
+			bitmap[posting->array[i] >> 6] |= (uint64_t)1 << (posting->array[i] & 63);
+		}
+
+		free(posting->array);
+		posting->array = NULL;
+		posting->capacity = 0;
+		posting->bitmap = bitmap;
+
+		return addPosting(posting, memberId);
+	}
+
+	if (posting->size == posting->capacity) {
+
+		size_t capacity = (posting->capacity == 0) ? DB_FUZZY_ARRAY_INITIAL : 2 * (size_t)posting->capacity;
+		if (capacity > DB_FUZZY_ARRAY_LIMIT) {
+			capacity = DB_FUZZY_ARRAY_LIMIT;
+		}
+
+		DBIndex *array = realloc(posting->array, capacity * sizeof(DBIndex));
+		if (array == NULL) {
+			return false;
+		}
+
+		posting->array = array;
+		posting->capacity = (DBIndex)capacity;
+	}
+
+	memmove(posting->array + position + 1, posting->array + position, (posting->size - position) * sizeof(DBIndex));
+	posting->array[position] = memberId;
+	++posting->size;
+
+	return true;
+}
+
+
+/*	Name:           removePosting
+	Description:    Removes a record from a posting list, if it is there
+	Parameters:     DBPosting *posting:  The posting list
+	                DBIndex memberId:  The record to remove
+	Returns:        void
+*/
+void removePosting(DBPosting *posting, DBIndex memberId) {
+
+	// Establish function preconditions
+	assert_assume(posting != NULL);
+
+	if (posting->bitmap != NULL) {
+		uint64_t bit = (uint64_t)1 << (memberId & 63);
+		if ((posting->bitmap[memberId >> 6] & bit) != 0) {
+			posting->bitmap[memberId >> 6] &= ~bit;
+			--posting->size;
+		}
+		return;
+	}
+
+	size_t low = 0, high = posting->size;
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+		if (posting->array[middle] < memberId) {
+			low = middle + 1;
+		}
+		else {
+			high = middle;
+		}
+	}
+
+	if (low < posting->size && posting->array[low] == memberId) {
+		memmove(posting->array + low, posting->array + low + 1, (posting->size - low - 1) * sizeof(DBIndex));
+		--posting->size;
+	}
+}
+
+
+/*	Name:           indexRecordName
+	Description:    Indexes the names of an inserted or updated record, replacing its old names
+	Parameters:     DBNameIndex *index:  The index to update
+	                DBRecord *record:  The record written
+	Returns:        void
+*/
+void indexRecordName(DBNameIndex *index, const DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(index != NULL);
+	assert_assume(record != NULL);
+	assert_assume(DB_MIN_ENTRY <= record->memberId && record->memberId <= DB_MAX_ENTRY);
+
+	DBIndexedName name;
+	foldName(record->firstName, DB_RECORD_NAME_SIZE - 1, name.first);
+	foldName(record->lastName, DB_RECORD_NAME_SIZE - 1, name.last);
+	name.present = true;
+
+	uint16_t added[DB_FUZZY_MAX_GRAMS];
+	size_t addedCount = nameTrigrams(&name, added);
+
+	AcquireSRWLockExclusive(&index->lock);
+
+	DBIndexedName *entry = &index->names[record->memberId];
+
+	uint16_t removed[DB_FUZZY_MAX_GRAMS];
+	size_t removedCount = entry->present ? nameTrigrams(entry, removed) : 0;
+
+	// Only the trigrams that differ between the old and new names are touched
+	size_t i = 0, j = 0;
+	while (i < removedCount || j < addedCount) {
+		if (j == addedCount || (i < removedCount && removed[i] < added[j])) {
+			removePosting(&index->postings[removed[i++]], record->memberId);
+		}
+		else if (i == removedCount || added[j] < removed[i]) {
+			if (!addPosting(&index->postings[added[j++]], record->memberId)) {
+				index->degraded = true;
+			}
+		}
+		else {
+			++i;
+			++j;
+		}
+	}
+
+	*entry = name;
+
+	ReleaseSRWLockExclusive(&index->lock);
+}
+
+
+/*	Name:           indexNameCallback
+	Description:    Indexes the names of each record of a scan
+	Parameters:     DBRecord *record:  The scanned record
+	                void *user:  The name index
+	Returns:        DBCode:  A return status code
+*/
+DBCode indexNameCallback(const DBRecord *record, void *user) {
+
+	indexRecordName(user, record);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           buildNameIndex
+	Description:    Indexes the names of every record in a database
+	Parameters:     DBContext *context:  The database whose index to build
+	Returns:        DBCode:  A return status code
+*/
+DBCode buildNameIndex(DBContext *context) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->names != NULL);
+
+	return scanRecords(context, indexNameCallback, context->names);
+}
+
+
+/*	Name:           countBitmap
+	Description:    Adds one to the counter of every record in a bitmap
+	Parameters:     DBFuzzyScratch *scratch:  The counters
+	                uint64_t *bitmap:  The records to count
+	Returns:        void
+*/
+void countBitmap(DBFuzzyScratch *scratch, const uint64_t *bitmap) {
+
+	// Establish function preconditions
+	assert_assume(scratch != NULL);
+	assert_assume(bitmap != NULL);
+
+	// A ripple-carry add of one bit per record across the planes, many records at a time
+#ifdef DB_FUZZY_SSE2
+	for (size_t w = 0; w < DB_FUZZY_BITMAP_WORDS; w += 2) {
+		__m128i carry = _mm_loadu_si128((const __m128i *)(bitmap + w));
+		for (size_t p = 0; p < DB_FUZZY_PLANES; ++p) {
+			__m128i plane = _mm_loadu_si128((const __m128i *)(scratch->planes[p] + w));
+			_mm_storeu_si128((__m128i *)(scratch->planes[p] + w), _mm_xor_si128(plane, carry));
+			carry = _mm_and_si128(plane, carry);
+		}
+	}
+#else
+	for (size_t w = 0; w < DB_FUZZY_BITMAP_WORDS; ++w) {
+		uint64_t carry = bitmap[w];
+		for (size_t p = 0; p < DB_FUZZY_PLANES && carry != 0; ++p) {
+			uint64_t plane = scratch->planes[p][w];
+			scratch->planes[p][w] = plane ^ carry;
+			carry &= plane;
+		}
+	}
+#endif
+}
+
+
+/*	Name:           countPosting
+	Description:    Adds one to the counter of every record in a posting list
+	Parameters:     DBFuzzyScratch *scratch:  The counters
+	                DBPosting *posting:  The records to count
+	Returns:        void
+*/
+void countPosting(DBFuzzyScratch *scratch, const DBPosting *posting) {
+
+	// Establish function preconditions
+	assert_assume(scratch != NULL);
+	assert_assume(posting != NULL);
+
+	if (posting->size == 0) {
+		return;
+	}
+	if (posting->bitmap != NULL) {
+		countBitmap(scratch, posting->bitmap);
+		return;
+	}
+
+	// Arrays are spread into a bitmap and cleared again afterward
+	for (size_t i = 0; i < posting->size; ++i) {
+		scratch->spread[posting->array[i] >> 6] |= (uint64_t)1 << (posting->array[i] & 63);
+	}
+
+	countBitmap(scratch, scratch->spread);
+
+	for (size_t i = 0; i < posting->size; ++i) {
+		scratch->spread[posting->array[i] >> 6] = 0;
+	}
+}
+
+
+/*	Name:           thresholdWord
+	Description:    Compares 64 bit-sliced counters against a threshold
+	Parameters:     DBFuzzyScratch *scratch:  The counters
+	                size_t w:  The word of counters to compare
+	                unsigned threshold:  The smallest count accepted
+	Returns:        uint64_t:  A bit set for each record counted at least the threshold
+*/
+uint64_t thresholdWord(const DBFuzzyScratch *scratch, size_t w, unsigned threshold) {
+
+	// Establish function preconditions
+	assert_assume(scratch != NULL);
+	assert_assume(w < DB_FUZZY_BITMAP_WORDS);
+
+	// Compare from the most significant plane, tracking counts still equal to the threshold so far
+	uint64_t greater = 0;
+	uint64_t equal = ~(uint64_t)0;
+	for (size_t p = DB_FUZZY_PLANES; p-- > 0;) {
+		uint64_t plane = scratch->planes[p][w];
+		if ((threshold >> p) & 1) {
+			equal &= plane;
+		}
+		else {
+			greater |= equal & plane;
+			equal &= ~plane;
+		}
+	}
+
+	return greater | equal;
+}
+
+
+/*	Name:           boundedDistance
+	Description:    Computes the edit distance between two strings, giving up past a bound
+	Parameters:     char *a:  The first string
+	                size_t aLength:  The length of the first string
+	                char *b:  The second string
+	                size_t bLength:  The length of the second string
+	                unsigned bound:  The largest distance of interest
+	Returns:        unsigned:  The edit distance, or bound + 1 if it is larger than bound
+*/
+unsigned boundedDistance(const char *a, size_t aLength, const char *b, size_t bLength, unsigned bound) {
+
+	// Establish function preconditions
+	assert_assume(a != NULL && b != NULL);
+	assert_assume(aLength <= DB_FUZZY_MAX_QUERY && bLength <= DB_FUZZY_MAX_QUERY);
+
+	size_t difference = (aLength > bLength) ? aLength - bLength : bLength - aLength;
+	if (difference > bound) {
+		return bound + 1;
+	}
+
+	unsigned row[DB_FUZZY_MAX_QUERY + 1];
+	for (size_t j = 0; j <= bLength; ++j) {
+		row[j] = (unsigned)j;
+	}
+
+	for (size_t i = 1; i <= aLength; ++i) {
+
+		unsigned diagonal = row[0];
+		row[0] = (unsigned)i;
+		unsigned smallest = row[0];
+
+		for (size_t j = 1; j <= bLength; ++j) {
+			unsigned above = row[j];
+			unsigned cost = diagonal + (a[i - 1] != b[j - 1]);
+			unsigned insert = row[j - 1] + 1;
+			unsigned remove = above + 1;
+
+			row[j] = (cost < insert) ? cost : insert;
+			if (remove < row[j]) {
+				row[j] = remove;
+			}
+			if (row[j] < smallest) {
+				smallest = row[j];
+			}
+			diagonal = above;
+		}
+
+		// No later row can be smaller than the smallest entry of this one
+		if (smallest > bound) {
+			return bound + 1;
+		}
+	}
+
+	return (row[bLength] <= bound) ? row[bLength] : bound + 1;
+}
+
+
+/*	Name:           nameDistance
+	Description:    Computes the smallest edit distance from a query to the first, last or full name of a record
+	Parameters:     DBIndexedName *name:  The folded names of the record
+	                char *query:  The folded query
+	                size_t length:  The length of the query
+	                unsigned bound:  The largest distance of interest
+	Returns:        unsigned:  The edit distance, or bound + 1 if it is larger than bound
+*/
+unsigned nameDistance(const DBIndexedName *name, const char *query, size_t length, unsigned bound) {
+
+	// Establish function preconditions
+	assert_assume(name != NULL);
+	assert_assume(query != NULL);
+
+	size_t firstLength = strlen(name->first);
+	size_t lastLength = strlen(name->last);
+
+	char full[2 * DB_RECORD_NAME_SIZE];
+	memcpy(full, name->first, firstLength);
+	full[firstLength] = ' ';
+	memcpy(full + firstLength + 1, name->last, lastLength);
+
+	unsigned best = boundedDistance(query, length, name->first, firstLength, bound);
+	if (best > 0) {
+		unsigned distance = boundedDistance(query, length, name->last, lastLength, best);
+		best = (distance < best) ? distance : best;
+	}
+	if (best > 0) {
+		unsigned distance = boundedDistance(query, length, full, firstLength + 1 + lastLength, best);
+		best = (distance < best) ? distance : best;
+	}
+
+	return best;
+}
+
+
+/*	Name:           recordDistance
+	Description:    Computes the smallest edit distance from a query to the names of a record as read
+	Parameters:     DBRecord *record:  The record
+	                char *query:  The folded query
+	                size_t length:  The length of the query
+	                unsigned bound:  The largest distance of interest
+	Returns:        unsigned:  The edit distance, or bound + 1 if it is larger than bound
+*/
+unsigned recordDistance(const DBRecord *record, const char *query, size_t length, unsigned bound) {
+
+	// Establish function preconditions
+	assert_assume(record != NULL);
+
+	DBIndexedName name;
+	foldName(record->firstName, DB_RECORD_NAME_SIZE - 1, name.first);
+	foldName(record->lastName, DB_RECORD_NAME_SIZE - 1, name.last);
+
+	return nameDistance(&name, query, length, bound);
+}
+
+
+/*	Name:           rankMatch
+	Description:    Inserts a match into a list ordered by distance and then memberId, keeping the best
+	Parameters:     DBFuzzyMatch *matches:  The ranked matches
+	                size_t capacity:  The most matches kept
+	                size_t *count:  The number of matches kept so far
+	                DBIndex memberId:  The matching record
+	                unsigned distance:  The edit distance of the match
+	Returns:        void
+*/
+void rankMatch(DBFuzzyMatch *matches, size_t capacity, size_t *count, DBIndex memberId, unsigned distance) {
+
+	// Establish function preconditions
+	assert_assume(matches != NULL);
+	assert_assume(count != NULL && *count <= capacity);
+
+	// Candidates arrive in memberId order, so a match only displaces strictly farther ones
+	size_t position = *count;
+	while (position > 0 && matches[position - 1].distance > distance) {
+		--position;
+	}
+	if (position == capacity) {
+		return;
+	}
+
+	size_t kept = (*count < capacity) ? *count + 1 : capacity;
+	memmove(matches + position + 1, matches + position, (kept - position - 1) * sizeof(DBFuzzyMatch));
+	matches[position].memberId = memberId;
+	matches[position].distance = (DBIndex)distance;
+	*count = kept;
+}
+
+
+/*	Name:           searchNames
+	Description:    Finds the records whose first, last or full name is closest to a query
+	Parameters:     DBNameIndex *index:  The index to search
+	                char *query:  The name to search for, in any case
+	                DBIndex maxDistance:  The largest edit distance matched
+	                DBFuzzyMatch *matches:  The matches, ordered by distance and then memberId
+	                size_t capacity:  The most matches returned
+	                size_t *count:  The number of matches returned
+	Returns:        DBCode:  A return status code
+*/
+DBCode searchNames(DBNameIndex *index, const char *query, DBIndex maxDistance, DBFuzzyMatch *matches, size_t capacity, size_t *count) {
+
+	// Establish function preconditions
+	assert_assume(index != NULL);
+	assert_assume(query != NULL);
+	assert_assume(matches != NULL || capacity == 0);
+	assert_assume(count != NULL);
+
+	*count = 0;
+
+	if (maxDistance > DB_FUZZY_MAX_DISTANCE || strlen(query) > DB_FUZZY_MAX_QUERY) {
+		return DB_REQUEST_DENIED;
+	}
+
+	char folded[DB_FUZZY_MAX_QUERY + 1];
+	size_t length = foldName(query, DB_FUZZY_MAX_QUERY, folded);
+	if (length == 0 || capacity == 0) {
+		return DB_SUCCESS;
+	}
+
+	uint16_t grams[DB_FUZZY_MAX_GRAMS];
+	size_t gramCount = uniqueTrigrams(grams, collectTrigrams(folded, length, grams, 0));
+
+	// Each edit changes at most three trigrams, so a match shares at least this many with the query
+	int threshold = (int)gramCount - 3 * (int)maxDistance;
+
+	DBFuzzyScratch *scratch = calloc(1, sizeof(DBFuzzyScratch));
+	if (scratch == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	AcquireSRWLockShared(&index->lock);
+
+	// An incomplete index, or a threshold too low to filter on, leaves every name a candidate
+	bool filtered = (threshold > 0 && !index->degraded);
+	if (filtered) {
+		for (size_t i = 0; i < gramCount; ++i) {
+			countPosting(scratch, &index->postings[grams[i]]);
+		}
+	}
+
+	ReleaseSRWLockShared(&index->lock);
+
+	// Verification is the slow part, so the lock is only held to copy each chunk of candidates
+	for (size_t chunk = 0; chunk < DB_FUZZY_BITMAP_WORDS; chunk += DB_FUZZY_CHUNK_WORDS) {
+
+		size_t copied = 0;
+
+		AcquireSRWLockShared(&index->lock);
+
+		for (size_t w = chunk; w < chunk + DB_FUZZY_CHUNK_WORDS && w < DB_FUZZY_BITMAP_WORDS; ++w) {
+
+			uint64_t candidates = filtered ? thresholdWord(scratch, w, (unsigned)threshold) : ~(uint64_t)0;
+
+			for (; candidates != 0; candidates &= candidates - 1) {
+
+				size_t bit = 0;
+				while (((candidates >> bit) & 1) == 0) {
+					++bit;
+				}
+
+				size_t memberId = w * 64 + bit;
+				if (memberId > DB_MAX_ENTRY) {
+					break;
+				}
+				if (index->names[memberId].present) {
+					scratch->ids[copied] = (DBIndex)memberId;
+					scratch->names[copied] = index->names[memberId];
+					++copied;
+				}
+			}
+		}
+
+		ReleaseSRWLockShared(&index->lock);
+
+		for (size_t i = 0; i < copied; ++i) {
+			unsigned distance = nameDistance(&scratch->names[i], folded, length, maxDistance);
+			if (distance <= maxDistance) {
+				rankMatch(matches, capacity, count, scratch->ids[i], distance);
+			}
+		}
+	}
+
+	free(scratch);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           handleFuzzyRequest
+	Description:    Handles a database fuzzy name search request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleFuzzyRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Searches need a database opened with a name index
+	if (context->names == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Send a confirmation code
+	markTrace(DB_TRACE_SEND);
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Receive the largest distance and the query
+	markTrace(DB_TRACE_RECEIVE);
+	DBIndex maxDistance;
+	CONDITIONAL_RETURN(receiveIndex(socket, &maxDistance));
+
+	DBIndex length;
+	CONDITIONAL_RETURN(receiveIndex(socket, &length));
+	if (length == 0 || length > DB_FUZZY_MAX_QUERY) {
+		return DB_REQUEST_DENIED;
+	}
+
+	char query[DB_FUZZY_MAX_QUERY + 1];
+	int result = recv(socket, query, length, MSG_WAITALL);
+	if (result == SOCKET_ERROR) {
+		return DB_SOCKET_ERROR;
+	}
+	else if (result != length) {
+		return DB_SOCKET_MISMATCH;
+	}
+	query[length] = '\0';
+
+	// Rank the candidates of the index
+	markTrace(DB_TRACE_IO);
+	DBFuzzyMatch matches[DB_FUZZY_MAX_RESULTS];
+	size_t count;
+	CONDITIONAL_RETURN(searchNames(context->names, query, maxDistance, matches, DB_FUZZY_MAX_RESULTS, &count));
+
+	char folded[DB_FUZZY_MAX_QUERY + 1];
+	size_t foldedLength = foldName(query, DB_FUZZY_MAX_QUERY, folded);
+
+	// Read every match before replying, so a failed read is reported in place of the confirmation
+	DBRecord records[DB_FUZZY_MAX_RESULTS];
+	size_t kept = 0;
+	for (size_t i = 0; i < count; ++i) {
+
+		records[kept].memberId = matches[i].memberId;
+		CONDITIONAL_RETURN(findRecord(context, &records[kept]));
+
+		// A record renamed since the search is ranked by the names actually sent, or dropped
+		unsigned distance = recordDistance(&records[kept], folded, foldedLength, maxDistance);
+		if (distance > maxDistance) {
+			continue;
+		}
+
+		// Keep the ranking ordered by distance and then memberId
+		size_t position = kept;
+		DBRecord record = records[kept];
+		while (position > 0 && (matches[position - 1].distance > distance
+			|| (matches[position - 1].distance == distance && matches[position - 1].memberId > record.memberId))) {
+			matches[position] = matches[position - 1];
+			records[position] = records[position - 1];
+			--position;
+		}
+		matches[position].memberId = record.memberId;
+		matches[position].distance = (DBIndex)distance;
+		records[position] = record;
+		++kept;
+	}
+
+	// Send a confirmation code
+	markTrace(DB_TRACE_SEND);
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Send the number of matches, then each distance and record in rank order
+	CONDITIONAL_RETURN(sendIndex(socket, (DBIndex)kept));
+	for (size_t i = 0; i < kept; ++i) {
+		CONDITIONAL_RETURN(sendIndex(socket, matches[i].distance));
+		CONDITIONAL_RETURN(sendRecord(socket, &records[i], true));
+	}
+
+	// Receive a completion code
+	markTrace(DB_TRACE_WAIT);
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendFuzzyRequest
+	Description:    Sends a database fuzzy name search request from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                char *query:  The name to search for
+	                DBIndex maxDistance:  The largest edit distance matched
+	                DBFuzzyCallback callback:  The function to pass each match and its distance to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendFuzzyRequest(SOCKET socket, const char *query, DBIndex maxDistance, DBFuzzyCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(query != NULL);
+	assert_assume(callback != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Never start a request the server would refuse
+	size_t length = strlen(query);
+	if (length == 0 || length > DB_FUZZY_MAX_QUERY || maxDistance > DB_FUZZY_MAX_DISTANCE) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_FUZZY));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the largest distance and the query
+	CONDITIONAL_RETURN(sendIndex(socket, maxDistance));
+	CONDITIONAL_RETURN(sendIndex(socket, (DBIndex)length));
+
+	int result = send(socket, query, (int)length, 0);
+	if (result == SOCKET_ERROR) {
+		return DB_SOCKET_ERROR;
+	}
+	else if (result != (int)length) {
+		return DB_SOCKET_MISMATCH;
+	}
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive every match, even after the callback stops
+	DBIndex count;
+	CONDITIONAL_RETURN(receiveIndex(socket, &count));
+
+	DBCode status = DB_SUCCESS;
+	for (DBIndex i = 0; i < count; ++i) {
+		DBIndex distance;
+		DBRecord record;
+		CONDITIONAL_RETURN(receiveIndex(socket, &distance));
+		CONDITIONAL_RETURN(receiveRecord(socket, &record, true));
+		if (status == DB_SUCCESS) {
+			status = callback(&record, distance, user);
+		}
+	}
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_SUCCESS));
+
+	return status;
+}
@@ -0,0 +1,379 @@
+
+#include "extra.h"
+#include "lease.h"
+#include "changes.h"
+#include "storage.h"
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// A struct to store one cached record and the end of its lease
+typedef struct DBLeaseEntry {
+
+	// The tick count at which the lease ends, or 0 if nothing is cached
+	ULONG64 expires;
+
+	DBRecord record;
+} DBLeaseEntry;
+
+
+// A struct to store the client-side cache, indexed directly by memberId
+struct DBLeaseCache {
+
+	// Every commit up to this sequence is reflected by the invalidations received
+	DBSequence sequence;
+
+	DBLeaseStats stats;
+
+	DBLeaseEntry entries[DB_MAX_ENTRY + 1];
+};
+
+
+// Prototypes for exchanging leases
+DBCode collectInvalidations(DBContext *, DBSequence, DBIndex *, DBIndex *);
+DBCode sendLeaseRequest(SOCKET, DBLeaseCache *, DBRecord *);
+
+
+
+/*	Name:           createLeaseCache
+	Description:    Allocates an empty lease cache
+	Parameters:     DBLeaseCache **cache:  The created cache
+	Returns:        DBCode:  A return status code
+*/
+DBCode createLeaseCache(DBLeaseCache **cache) {
+
+	// Establish function preconditions
+	assert_assume(cache != NULL);
+
+	DBLeaseCache *temp = calloc(1, sizeof(DBLeaseCache));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	*cache = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           destroyLeaseCache
+	Description:    Frees a lease cache
+	Parameters:     DBLeaseCache *cache:  The cache to destroy
+	Returns:        void
+*/
+void destroyLeaseCache(DBLeaseCache *cache) {
+	free(cache);
+}
+
+
+/*	Name:           invalidateLeaseCache
+	Description:    Drops a cached record, such as after the client updates it itself
+	Parameters:     DBLeaseCache *cache:  The cache to update
+	                DBIndex memberId:  The record to drop
+	Returns:        void
+*/
+void invalidateLeaseCache(DBLeaseCache *cache, DBIndex memberId) {
+
+	// Establish function preconditions
+	assert_assume(cache != NULL);
+
+	if (memberId <= DB_MAX_ENTRY) {
+		cache->entries[memberId].expires = 0;
+	}
+}
+
+
+/*	Name:           readLeaseStats
+	Description:    Reads the hit and invalidation counters of a lease cache
+	Parameters:     DBLeaseCache *cache:  The cache to read
+	                DBLeaseStats *stats:  The counters
+	Returns:        void
+*/
+void readLeaseStats(const DBLeaseCache *cache, DBLeaseStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(cache != NULL);
+	assert_assume(stats != NULL);
+
+	*stats = cache->stats;
+}
+
+
+/*	Name:           collectInvalidations
+	Description:    Lists the records changed by commits after a client's sequence
+	Parameters:     DBContext *context:  The database state to read changes from
+	                DBSequence sequence:  The last sequence the client has seen
+	                DBIndex *memberIds:  The buffer of DB_LEASE_MAX_INVALIDATIONS to fill
+	                DBIndex *count:  The number of memberIds, or DB_LEASE_RESET
+	Returns:        DBCode:  A return status code
+*/
+DBCode collectInvalidations(DBContext *context, DBSequence sequence, DBIndex *memberIds, DBIndex *count) {
+
+	*count = 0;
+
+	// Without a change log, leases alone bound how stale a cached record can be
+	DBChangeLog *log = (context->versions != NULL) ? readChangeLog(context->versions) : NULL;
+	if (log == NULL) {
+		return DB_SUCCESS;
+	}
+
+	// A client too far behind the log must drop everything
+	uint64_t position;
+	if (seekChanges(log, sequence, &position) != DB_SUCCESS) {
+		*count = DB_LEASE_RESET;
+		return DB_SUCCESS;
+	}
+
+	DBChange *batch = allocateRequestMemory(sizeof(DBChange) * DB_CHANGE_BATCH_SIZE);
+	if (batch == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Take every change already published without waiting for more
+	for (;;) {
+
+		size_t read;
+		if (readChanges(log, &position, batch, DB_CHANGE_BATCH_SIZE, &read, 0) != DB_SUCCESS) {
+			*count = DB_LEASE_RESET;
+			break;
+		}
+		if (read == 0) {
+			break;
+		}
+		if (read > (size_t)(DB_LEASE_MAX_INVALIDATIONS - *count)) {
+			*count = DB_LEASE_RESET;
+			break;
+		}
+
+		for (size_t i = 0; i < read; ++i) {
+			memberIds[(*count)++] = batch[i].record.memberId;
+		}
+	}
+
+	freeRequestMemory(batch);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           handleLeaseRequest
+	Description:    Handles a leased find request from the server-side, returning the changes the client missed
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleLeaseRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send a confirmation code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Receive the memberId to find, or 0 to only synchronize, and the client's sequence
+	DBRecord record;
+	DBSequence sequence;
+	CONDITIONAL_RETURN(receiveIndex(socket, &record.memberId));
+	CONDITIONAL_RETURN(receiveSequence(socket, &sequence));
+
+	DBIndex *memberIds = allocateRequestMemory(sizeof(DBIndex) * DB_LEASE_MAX_INVALIDATIONS);
+	if (memberIds == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Read the sequence first, so a commit racing the reads below is invalidated again next time
+	DBSequence current = (context->versions != NULL) ? readCommitSequence(context->versions) : 0;
+
+	// Without a change log nothing would ever invalidate a cached record, so no lease is granted
+	DBIndex duration = (context->versions != NULL && readChangeLog(context->versions) != NULL) ? DB_LEASE_DURATION_MS : 0;
+
+	DBIndex count;
+	DBCode status = collectInvalidations(context, sequence, memberIds, &count);
+
+	DBCode found = DB_REQUEST_DENIED;
+	if (status == DB_SUCCESS && record.memberId != 0) {
+		found = findRecord(context, &record);
+	}
+
+	// Send the lease, then the invalidations, then the record if it was found
+	if (status == DB_SUCCESS) {
+		status = sendCode(socket, DB_REQUEST_SUCCESS);
+	}
+	if (status == DB_SUCCESS) {
+		status = sendSequence(socket, current);
+	}
+	if (status == DB_SUCCESS) {
+		status = sendIndex(socket, duration);
+	}
+	if (status == DB_SUCCESS) {
+		status = sendIndex(socket, count);
+	}
+	for (DBIndex i = 0; status == DB_SUCCESS && count != DB_LEASE_RESET && i < count; ++i) {
+		status = sendIndex(socket, memberIds[i]);
+	}
+	if (status == DB_SUCCESS && record.memberId != 0) {
+		status = sendCode(socket, found);
+		if (status == DB_SUCCESS && found == DB_SUCCESS) {
+			status = sendRecord(socket, &record, true);
+		}
+	}
+
+	freeRequestMemory(memberIds);
+
+	CONDITIONAL_RETURN(status);
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendLeaseRequest
+	Description:    Sends a leased find request, applying the invalidations returned with it
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBLeaseCache *cache:  The cache to update
+	                DBRecord *record:  The record to find by memberId, or NULL to only synchronize
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendLeaseRequest(SOCKET socket, DBLeaseCache *cache, DBRecord *record) {
+
+	// The lease is measured from before the request, so it never outlives the server's grant
+	ULONG64 sent = GetTickCount64();
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_LEASE));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the memberId to find and the last sequence seen
+	CONDITIONAL_RETURN(sendIndex(socket, (record != NULL) ? record->memberId : 0));
+	CONDITIONAL_RETURN(sendSequence(socket, cache->sequence));
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	DBSequence sequence;
+	DBIndex duration;
+	DBIndex count;
+	CONDITIONAL_RETURN(receiveSequence(socket, &sequence));
+	CONDITIONAL_RETURN(receiveIndex(socket, &duration));
+	CONDITIONAL_RETURN(receiveIndex(socket, &count));
+
+	// Drop the records changed since the last exchange
+	if (count == DB_LEASE_RESET) {
+		for (size_t i = 0; i <= DB_MAX_ENTRY; ++i) {
+			cache->entries[i].expires = 0;
+		}
+		++cache->stats.resets;
+	}
+	for (DBIndex i = 0; count != DB_LEASE_RESET && i < count; ++i) {
+		DBIndex memberId;
+		CONDITIONAL_RETURN(receiveIndex(socket, &memberId));
+		invalidateLeaseCache(cache, memberId);
+		++cache->stats.invalidations;
+	}
+
+	cache->sequence = sequence;
+
+	// Receive the record and cache it for the length of the lease
+	DBCode found = DB_SUCCESS;
+	if (record != NULL) {
+
+		CONDITIONAL_RETURN(receiveCode(socket, &found));
+		if (found == DB_SUCCESS) {
+			CONDITIONAL_RETURN(receiveRecord(socket, record, true));
+
+			if (duration != 0 && record->memberId <= DB_MAX_ENTRY) {
+				cache->entries[record->memberId].record = *record;
+				cache->entries[record->memberId].expires = sent + duration;
+			}
+		}
+	}
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_SUCCESS));
+
+	return found;
+}
+
+
+/*	Name:           sendCachedFindRequest
+	Description:    Finds a record, serving it from the cache while its lease lasts
+	Parameters:     SOCKET socket:  The database socket to send the request with on a miss
+	                DBLeaseCache *cache:  The cache to read and update
+	                DBRecord *record:  The record to find by memberId
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendCachedFindRequest(SOCKET socket, DBLeaseCache *cache, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(cache != NULL);
+	assert_assume(record != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	if (record->memberId < DB_MIN_ENTRY || record->memberId > DB_MAX_ENTRY) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBLeaseEntry *entry = &cache->entries[record->memberId];
+	if (entry->expires != 0 && GetTickCount64() < entry->expires) {
+		*record = entry->record;
+		++cache->stats.hits;
+		return DB_SUCCESS;
+	}
+
+	++cache->stats.misses;
+
+	return sendLeaseRequest(socket, cache, record);
+}
+
+
+/*	Name:           sendCachedUpdateRequest
+	Description:    Updates a record, dropping it from the cache so the client never reads back its old image
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBLeaseCache *cache:  The cache to update
+	                DBRecord *record:  The record to update
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendCachedUpdateRequest(SOCKET socket, DBLeaseCache *cache, const DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(cache != NULL);
+	assert_assume(record != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Drop the record even if the update fails, since it may still have been applied
+	DBCode status = sendUpdateRequest(socket, record);
+	invalidateLeaseCache(cache, record->memberId);
+
+	return status;
+}
+
+
+/*	Name:           syncLeaseCache
+	Description:    Applies the server's invalidations without finding a record
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBLeaseCache *cache:  The cache to update
+	Returns:        DBCode:  A return status code
+*/
+DBCode syncLeaseCache(SOCKET socket, DBLeaseCache *cache) {
+
+	// Establish function preconditions
+	assert_assume(cache != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	return sendLeaseRequest(socket, cache, NULL);
+}
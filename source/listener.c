@@ -0,0 +1,412 @@
+
+#include "extra.h"
+#include "listener.h"
+#include "socket.h"
+#include "numa.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// The listening sockets of a listener
+typedef enum DBListenerSocket {
+	DB_LISTENER_TCP,
+	DB_LISTENER_UNIX,
+	DB_LISTENER_SOCKETS
+} DBListenerSocket;
+
+
+// A struct to store one thread accepting on a listening socket
+typedef struct DBAcceptor {
+	DBListener *listener;
+	SOCKET socket;
+	HANDLE thread;
+} DBAcceptor;
+
+
+// A struct to store the connection handed to a connection thread
+typedef struct DBConnection {
+	DBListener *listener;
+	size_t slot;
+} DBConnection;
+
+
+// A struct to store the state of a listener
+struct DBListener {
+
+	DBContext *context;
+	DBSlabPool *slabs;
+
+	SOCKET sockets[DB_LISTENER_SOCKETS];
+
+	// The socket file to remove on stop, or NULL
+	char *unixPath;
+
+	size_t acceptorCount;
+	DBAcceptor acceptors[DB_LISTENER_SOCKETS * DB_LISTENER_MAX_ACCEPTORS];
+
+	// Guards the connection table and statistics
+	SRWLOCK lock;
+	SOCKET connections[DB_LISTENER_MAX_CONNECTIONS];
+	DBListenerStats stats;
+
+	// The thread serving each slot, kept until joined so the listener outlives it, or NULL once the slot is free
+	HANDLE threads[DB_LISTENER_MAX_CONNECTIONS];
+
+	volatile LONG stopping;
+};
+
+
+// Prototypes for accepting and serving connections
+DWORD WINAPI acceptorThread(LPVOID);
+DWORD WINAPI connectionThread(LPVOID);
+void serveConnection(DBListener *, SOCKET);
+void releaseConnection(DBListener *, size_t);
+void joinConnection(DBListener *, size_t);
+
+
+
+/*	Name:           startListener
+	Description:    Opens the configured listening sockets and starts accepting connections on each
+	Parameters:     DBListenerConfig *config:  The sockets to listen on and the threads accepting on each
+	                DBContext *context:  The database to serve, versioned since connections run concurrently
+	                DBListener **listener:  The started listener
+	Returns:        DBCode:  A return status code
+*/
+DBCode startListener(const DBListenerConfig *config, DBContext *context, DBListener **listener) {
+
+	// Establish function preconditions
+	assert_assume(config != NULL);
+	assert_assume(config->host != NULL || config->unixPath != NULL);
+	assert_assume(0 < config->acceptors && config->acceptors <= DB_LISTENER_MAX_ACCEPTORS);
+	assert_assume(context != NULL);
+	assert_assume(listener != NULL);
+
+	// Connections are served concurrently, which only a versioned database allows
+	if (context->versions == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBListener *temp = calloc(1, sizeof(DBListener));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	temp->context = context;
+	temp->slabs = config->slabs;
+	InitializeSRWLock(&temp->lock);
+
+	for (size_t i = 0; i < DB_LISTENER_SOCKETS; ++i) {
+		temp->sockets[i] = INVALID_SOCKET;
+	}
+	for (size_t i = 0; i < DB_LISTENER_MAX_CONNECTIONS; ++i) {
+		temp->connections[i] = INVALID_SOCKET;
+	}
+
+	DBCode status = DB_SUCCESS;
+
+	if (config->host != NULL) {
+		temp->sockets[DB_LISTENER_TCP] = createListener(config->host);
+		if (temp->sockets[DB_LISTENER_TCP] == INVALID_SOCKET) {
+			status = DB_SOCKET_ERROR;
+		}
+	}
+
+	if (status == DB_SUCCESS && config->unixPath != NULL) {
+		temp->sockets[DB_LISTENER_UNIX] = createUnixListener(config->unixPath);
+		if (temp->sockets[DB_LISTENER_UNIX] == INVALID_SOCKET) {
+			status = DB_SOCKET_ERROR;
+		}
+		else if (config->unixPath[0] != '@') {
+			size_t length = strlen(config->unixPath);
+			temp->unixPath = malloc(length + 1);
+			if (temp->unixPath == NULL) {
+				status = DB_REQUEST_DENIED;
+			}
+			else {
+				memcpy(temp->unixPath, config->unixPath, length + 1);
+			}
+		}
+	}
+
+	// Several threads blocked in accept on one socket take turns, which spreads connection storms over cores
+	for (size_t i = 0; status == DB_SUCCESS && i < DB_LISTENER_SOCKETS; ++i) {
+		for (unsigned j = 0; status == DB_SUCCESS && temp->sockets[i] != INVALID_SOCKET && j < config->acceptors; ++j) {
+
+			DBAcceptor *acceptor = &temp->acceptors[temp->acceptorCount];
+			acceptor->listener = temp;
+			acceptor->socket = temp->sockets[i];
+			acceptor->thread = startNodeThread(acceptorThread, acceptor, j);
+
+			if (acceptor->thread == NULL) {
+				status = DB_REQUEST_DENIED;
+			}
+			else {
+				++temp->acceptorCount;
+			}
+		}
+	}
+
+	if (status != DB_SUCCESS) {
+		stopListener(temp);
+		return status;
+	}
+
+	*listener = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopListener
+	Description:    Closes the listening sockets and every connection, waiting for their threads
+	Parameters:     DBListener *listener:  The listener to stop
+	Returns:        void
+*/
+void stopListener(DBListener *listener) {
+
+	if (listener == NULL) {
+		return;
+	}
+
+	InterlockedExchange(&listener->stopping, 1);
+
+	// Closing a listening socket fails the accepts blocked on it
+	for (size_t i = 0; i < DB_LISTENER_SOCKETS; ++i) {
+		if (listener->sockets[i] != INVALID_SOCKET) {
+			closesocket(listener->sockets[i]);
+		}
+	}
+
+	for (size_t i = 0; i < listener->acceptorCount; ++i) {
+		WaitForSingleObject(listener->acceptors[i].thread, INFINITE);
+		CloseHandle(listener->acceptors[i].thread);
+	}
+
+	// No connection starts now, so shutting down the open ones ends every connection thread
+	AcquireSRWLockExclusive(&listener->lock);
+	for (size_t i = 0; i < DB_LISTENER_MAX_CONNECTIONS; ++i) {
+		if (listener->connections[i] != INVALID_SOCKET) {
+			shutdown(listener->connections[i], SD_BOTH);
+		}
+	}
+	ReleaseSRWLockExclusive(&listener->lock);
+
+	// Join every connection thread, so none touches the listener after it is freed
+	for (size_t i = 0; i < DB_LISTENER_MAX_CONNECTIONS; ++i) {
+		joinConnection(listener, i);
+	}
+
+	if (listener->unixPath != NULL) {
+		DeleteFileA(listener->unixPath);
+		free(listener->unixPath);
+	}
+
+	free(listener);
+}
+
+
+/*	Name:           readListenerStats
+	Description:    Reads the connections seen by a listener
+	Parameters:     DBListener *listener:  The listener to read
+	                DBListenerStats *stats:  The statistics read
+	Returns:        void
+*/
+void readListenerStats(DBListener *listener, DBListenerStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(listener != NULL);
+	assert_assume(stats != NULL);
+
+	AcquireSRWLockShared(&listener->lock);
+	*stats = listener->stats;
+	ReleaseSRWLockShared(&listener->lock);
+}
+
+
+/*	Name:           acceptorThread
+	Description:    Accepts connections on a listening socket until it is closed
+	Parameters:     LPVOID param:  The acceptor
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI acceptorThread(LPVOID param) {
+
+	DBAcceptor *acceptor = param;
+	DBListener *listener = acceptor->listener;
+
+	DWORD backoff = 0;
+	for (;;) {
+
+		SOCKET client = accept(acceptor->socket, NULL, NULL);
+		if (client != INVALID_SOCKET) {
+			backoff = 0;
+			serveConnection(listener, client);
+			continue;
+		}
+
+		// A connection reset before it was accepted is not the socket failing
+		int error = WSAGetLastError();
+		if (listener->stopping || error == WSAENOTSOCK || error == WSAEINVAL || error == WSAEINTR) {
+			break;
+		}
+
+		// Running out of sockets or buffers lasts until connections close, so wait instead of spinning on it
+		if (error == WSAEMFILE || error == WSAENOBUFS) {
+			backoff = (backoff == 0) ? DB_LISTENER_MIN_BACKOFF_MS : backoff * 2;
+			if (backoff > DB_LISTENER_MAX_BACKOFF_MS) {
+				backoff = DB_LISTENER_MAX_BACKOFF_MS;
+			}
+			Sleep(backoff);
+		}
+	}
+
+	return 0;
+}
+
+
+/*	Name:           serveConnection
+	Description:    Claims a connection slot and starts a thread serving an accepted connection
+	Parameters:     DBListener *listener:  The listener the connection was accepted on
+	                SOCKET client:  The accepted connection
+	Returns:        void
+*/
+void serveConnection(DBListener *listener, SOCKET client) {
+
+	// Fail a stalled send rather than blocking forever, while idle clients may wait to send
+	DBConnection *connection = NULL;
+	if (setSocketTimeouts(client, 0, DEFAULT_SEND_TIMEOUT_MS)) {
+		connection = malloc(sizeof(DBConnection));
+	}
+	if (connection == NULL) {
+		free(connection);
+		closesocket(client);
+		return;
+	}
+
+	AcquireSRWLockExclusive(&listener->lock);
+
+	// A slot whose thread has released it is joined before reuse, which waits at most for the thread to return
+	size_t slot = DB_LISTENER_MAX_CONNECTIONS;
+	for (size_t i = 0; i < DB_LISTENER_MAX_CONNECTIONS; ++i) {
+		if (listener->connections[i] == INVALID_SOCKET && listener->threads[i] != INVALID_HANDLE_VALUE) {
+			slot = i;
+			break;
+		}
+	}
+	if (slot != DB_LISTENER_MAX_CONNECTIONS && listener->threads[slot] != NULL) {
+		WaitForSingleObject(listener->threads[slot], INFINITE);
+		CloseHandle(listener->threads[slot]);
+		listener->threads[slot] = NULL;
+	}
+
+	if (slot == DB_LISTENER_MAX_CONNECTIONS) {
+		++listener->stats.refused;
+		ReleaseSRWLockExclusive(&listener->lock);
+		free(connection);
+		closesocket(client);
+		return;
+	}
+
+	// The slot is held as starting until its thread handle is stored
+	listener->connections[slot] = client;
+	listener->threads[slot] = INVALID_HANDLE_VALUE;
+	++listener->stats.accepted;
+	if (++listener->stats.active > listener->stats.peakActive) {
+		listener->stats.peakActive = listener->stats.active;
+	}
+
+	ReleaseSRWLockExclusive(&listener->lock);
+
+	connection->listener = listener;
+	connection->slot = slot;
+
+	// Connection threads are spread over the nodes like the acceptors
+	HANDLE thread = startNodeThread(connectionThread, connection, slot);
+	if (thread == NULL) {
+		free(connection);
+		releaseConnection(listener, slot);
+	}
+
+	AcquireSRWLockExclusive(&listener->lock);
+	listener->threads[slot] = thread;
+	ReleaseSRWLockExclusive(&listener->lock);
+}
+
+
+/*	Name:           connectionThread
+	Description:    Handles requests from one connection until it closes
+	Parameters:     LPVOID param:  The connection
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI connectionThread(LPVOID param) {
+
+	DBConnection *connection = param;
+	DBListener *listener = connection->listener;
+	size_t slot = connection->slot;
+	free(connection);
+
+	// The slot keeps its socket until it is released, so reading it needs no lock
+	SOCKET socket = listener->connections[slot];
+
+	DBArena arena;
+	if (listener->slabs != NULL) {
+		initArena(&arena, listener->slabs);
+		bindArena(&arena);
+	}
+
+	// Errors the client was told about leave the connection usable
+	DBCode command;
+	while (receiveCode(socket, &command) == DB_SUCCESS) {
+		DBCode status = handleContextRequest(listener->context, socket, command);
+		if (status & (DB_SOCKET_ERROR | DB_SOCKET_MISMATCH)) {
+			break;
+		}
+	}
+
+	if (listener->slabs != NULL) {
+		bindArena(NULL);
+		releaseArena(&arena);
+	}
+
+	releaseConnection(listener, slot);
+
+	return 0;
+}
+
+
+/*	Name:           releaseConnection
+	Description:    Closes a connection, leaving its slot to be joined before reuse
+	Parameters:     DBListener *listener:  The listener the connection was accepted on
+	                size_t slot:  The connection slot
+	Returns:        void
+*/
+void releaseConnection(DBListener *listener, size_t slot) {
+
+	AcquireSRWLockExclusive(&listener->lock);
+
+	closesocket(listener->connections[slot]);
+	listener->connections[slot] = INVALID_SOCKET;
+	--listener->stats.active;
+
+	ReleaseSRWLockExclusive(&listener->lock);
+}
+
+
+/*	Name:           joinConnection
+	Description:    Waits for the thread of a connection slot to return and frees the slot
+	Parameters:     DBListener *listener:  The listener owning the slot, with no acceptor running
+	                size_t slot:  The connection slot
+	Returns:        void
+*/
+void joinConnection(DBListener *listener, size_t slot) {
+
+	// Without acceptors no other thread changes the handle, so it is waited on outside the lock
+	HANDLE thread = listener->threads[slot];
+	if (thread == NULL) {
+		return;
+	}
+
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+	listener->threads[slot] = NULL;
+}
@@ -0,0 +1,545 @@
+
+#include "extra.h"
+#include "loader.h"
+#include "storage.h"
+#include "record.h"
+#include "numa.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// A struct to store the state of one parsing thread
+typedef struct DBLoadChunk {
+
+	// The input lines to parse, starting at a line boundary
+	const char *begin;
+	const char *end;
+	char delimiter;
+
+	// The records parsed, in input order
+	DBRecord *records;
+	size_t count;
+	size_t capacity;
+
+	// The lines read, and the 1-based line within the chunk of the first rejected row
+	size_t lines;
+	size_t rows;
+	size_t rejected;
+	size_t firstRejected;
+
+	DBCode status;
+} DBLoadChunk;
+
+
+// Prototypes for parsing delimited text
+bool parseField(const char **, const char *, char, char *, size_t);
+bool parseDate(const char *, DBDate *);
+bool parseRow(const char *, const char *, char, DBRecord *);
+DWORD WINAPI loadThread(LPVOID);
+char *readInput(const char *, size_t *);
+
+
+
+/*	Name:           parseField
+	Description:    Parses one field of a row, which may be quoted to contain the delimiter
+	Parameters:     char **cursor:  The start of the field, advanced past its delimiter
+	                char *end:  The end of the row
+	                char delimiter:  The field delimiter
+	                char *field:  The buffer to copy the field to
+	                size_t size:  The size of the buffer
+	Returns:        bool:  Whether the field was well formed and fit in the buffer
+*/
+bool parseField(const char **cursor, const char *end, char delimiter, char *field, size_t size) {
+
+	const char *p = *cursor;
+	size_t length = 0;
+
+	if (p < end && *p == '"') {
+
+		// A doubled quote inside a quoted field is a literal quote
+		for (++p;; ++p) {
+			if (p == end) {
+				return false;
+			}
+			if (*p == '"') {
+				if (p + 1 == end || p[1] != '"') {
+					++p;
+					break;
+				}
+				++p;
+			}
+			if (length + 1 >= size) {
+				return false;
+			}
+			field[length++] = *p;
+		}
+
+		if (p < end && *p != delimiter) {
+			return false;
+		}
+	}
+	else {
+
+		// The CRT memchr is vectorized, scanning a line for the delimiter many bytes at a time
+		const char *stop = memchr(p, delimiter, (size_t)(end - p));
+		if (stop == NULL) {
+			stop = end;
+		}
+
+		length = (size_t)(stop - p);
+		if (length >= size) {
+			return false;
+		}
+		memcpy(field, p, length);
+		p = stop;
+	}
+
+	field[length] = '\0';
+
+	// Step over the delimiter
+	if (p < end) {
+		++p;
+	}
+	*cursor = p;
+
+	return true;
+}
+
+
+/*	Name:           parseDate
+	Description:    Parses and validates a date written as year-month-day
+	Parameters:     char *text:  The date text, separated by '-' or '/'
+	                DBDate *date:  The parsed date
+	Returns:        bool:  Whether the text was a valid date
+*/
+bool parseDate(const char *text, DBDate *date) {
+
+	static const uint8_t monthDays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	unsigned parts[3] = { 0, 0, 0 };
+	const size_t digits[3] = { 5, 2, 2 };
+
+	for (size_t i = 0; i < 3; ++i) {
+
+		size_t length = 0;
+		while (*text >= '0' && *text <= '9') {
+			if (++length > digits[i]) {
+				return false;
+			}
+			parts[i] = parts[i] * 10 + (unsigned)(*text++ - '0');
+		}
+		if (length == 0) {
+			return false;
+		}
+
+		if (i < 2) {
+			if (*text != '-' && *text != '/') {
+				return false;
+			}
+			++text;
+		}
+	}
+	if (*text != '\0') {
+		return false;
+	}
+
+	unsigned year = parts[0];
+	unsigned month = parts[1];
+	unsigned day = parts[2];
+
+	// Validate against the range the slot format can store
+	if (year < 1 || year > DB_SLOT_MAX_YEAR || month < JAN || month > DEC || day < 1) {
+		return false;
+	}
+	if (day > monthDays[month - 1]) {
+		return false;
+	}
+	if (month == FEB && day == 29 && !(year % 4 == 0 && (year % 100 != 0 || year % 400 == 0))) {
+		return false;
+	}
+
+	date->year = (DBDateYear)year;
+	date->month = (DBDateMonth)month;
+	date->day = (DBDateDay)day;
+
+	return true;
+}
+
+
+/*	Name:           parseRow
+	Description:    Parses a row of firstName, lastName and birthDate fields into a record
+	Parameters:     char *line:  The start of the row
+	                char *end:  The end of the row, excluding the line ending
+	                char delimiter:  The field delimiter
+	                DBRecord *record:  The parsed record
+	Returns:        bool:  Whether the row was valid
+*/
+bool parseRow(const char *line, const char *end, char delimiter, DBRecord *record) {
+
+	char date[16];
+
+	bool valid = parseField(&line, end, delimiter, record->firstName, DB_RECORD_NAME_SIZE)
+		&& parseField(&line, end, delimiter, record->lastName, DB_RECORD_NAME_SIZE)
+		&& parseField(&line, end, delimiter, date, sizeof(date))
+		&& line == end;
+
+	return valid
+		&& record->firstName[0] != '\0'
+		&& record->lastName[0] != '\0'
+		&& parseDate(date, &record->birthDate);
+}
+
+
+/*	Name:           loadThread
+	Description:    Parses every line of one chunk of the input
+	Parameters:     LPVOID param:  The chunk to parse
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI loadThread(LPVOID param) {
+
+	DBLoadChunk *chunk = param;
+	chunk->status = DB_SUCCESS;
+
+	const char *p = chunk->begin;
+	while (p < chunk->end) {
+
+		const char *newline = memchr(p, '\n', (size_t)(chunk->end - p));
+		const char *stop = (newline != NULL) ? newline : chunk->end;
+		const char *next = (newline != NULL) ? newline + 1 : chunk->end;
+		if (stop > p && stop[-1] == '\r') {
+			--stop;
+		}
+
+		++chunk->lines;
+
+		// Blank lines are skipped rather than rejected
+		if (stop != p) {
+			++chunk->rows;
+
+			if (chunk->count == chunk->capacity) {
+				size_t capacity = (chunk->capacity == 0) ? 1024 : chunk->capacity * 2;
+				DBRecord *records = realloc(chunk->records, sizeof(DBRecord) * capacity);
+				if (records == NULL) {
+					chunk->status = DB_REQUEST_DENIED;
+					return 1;
+				}
+				chunk->records = records;
+				chunk->capacity = capacity;
+			}
+
+			if (parseRow(p, stop, chunk->delimiter, &chunk->records[chunk->count])) {
+				++chunk->count;
+			}
+			else {
+				++chunk->rejected;
+				if (chunk->firstRejected == 0) {
+					chunk->firstRejected = chunk->lines;
+				}
+			}
+		}
+
+		p = next;
+	}
+
+	return 0;
+}
+
+
+/*	Name:           readInput
+	Description:    Reads a whole input file into memory
+	Parameters:     char *path:  The input file path
+	                size_t *size:  The size of the file
+	Returns:        char *:  The allocated file contents, or NULL
+*/
+char *readInput(const char *path, size_t *size) {
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return NULL;
+	}
+
+	long length = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+	char *buffer = (length >= 0 && fseek(file, 0, SEEK_SET) == 0) ? malloc((size_t)length + 1) : NULL;
+
+	if (buffer != NULL && fread(buffer, 1, (size_t)length, file) != (size_t)length) {
+		free(buffer);
+		buffer = NULL;
+	}
+
+	fclose(file);
+
+	if (buffer != NULL) {
+		*size = (size_t)length;
+	}
+
+	return buffer;
+}
+
+
+/*	Name:           loadDelimited
+	Description:    Parses a CSV or TSV file in parallel and appends its valid rows with one contiguous write
+	Parameters:     DBContext *context:  The database to load into
+	                char *path:  The input file of firstName, lastName, birthDate rows
+	                char delimiter:  The field delimiter, or 0 to detect a tab or comma
+	                bool header:  Whether the first line is a header to skip
+	                DBLoadStats *stats:  The results of the load
+	Returns:        DBCode:  A return status code
+*/
+DBCode loadDelimited(DBContext *context, const char *path, char delimiter, bool header, DBLoadStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(path != NULL);
+	assert_assume(stats != NULL);
+
+	memset(stats, 0, sizeof(DBLoadStats));
+
+	size_t size = 0;
+	char *input = readInput(path, &size);
+	if (input == NULL) {
+		return DB_FILE_ERROR;
+	}
+
+	const char *begin = input;
+	const char *end = input + size;
+
+	const char *firstLine = memchr(begin, '\n', size);
+	if (firstLine == NULL) {
+		firstLine = end;
+	}
+
+	// A tab in the first line means the file is tab separated
+	if (delimiter == '\0') {
+		delimiter = (memchr(begin, '\t', (size_t)(firstLine - begin)) != NULL) ? '\t' : ',';
+	}
+
+	size_t skipped = 0;
+	if (header && begin != end) {
+		begin = (firstLine == end) ? end : firstLine + 1;
+		skipped = 1;
+	}
+
+	// Use one thread per core, but only when each has enough input to be worth it
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t threads = info.dwNumberOfProcessors;
+	if (threads > DB_LOAD_MAX_THREADS) {
+		threads = DB_LOAD_MAX_THREADS;
+	}
+	if (threads > (size_t)(end - begin) / DB_LOAD_MIN_CHUNK) {
+		threads = (size_t)(end - begin) / DB_LOAD_MIN_CHUNK;
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	DBLoadChunk chunks[DB_LOAD_MAX_THREADS];
+	HANDLE handles[DB_LOAD_MAX_THREADS];
+	memset(chunks, 0, sizeof(chunks));
+
+	// Move each split forward to the next line boundary
+	const char *split = begin;
+	for (size_t i = 0; i < threads; ++i) {
+
+		chunks[i].begin = split;
+		chunks[i].delimiter = delimiter;
+		chunks[i].status = DB_REQUEST_DENIED;
+
+		split = begin + (size_t)(end - begin) * (i + 1) / threads;
+		if (split < chunks[i].begin) {
+			split = chunks[i].begin;
+		}
+		if (i + 1 == threads) {
+			split = end;
+		}
+		else if (split != begin && split[-1] != '\n') {
+			const char *newline = memchr(split, '\n', (size_t)(end - split));
+			split = (newline != NULL) ? newline + 1 : end;
+		}
+
+		chunks[i].end = split;
+	}
+
+	size_t started = 0;
+	for (size_t i = 0; i < threads; ++i) {
+		// Each chunk's records are first touched by its own thread, so they stay on its node
+		handles[i] = startNodeThread(loadThread, &chunks[i], i);
+		if (handles[i] == NULL) {
+			break;
+		}
+		++started;
+	}
+
+	if (started != 0) {
+		WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+	}
+	for (size_t i = 0; i < started; ++i) {
+		CloseHandle(handles[i]);
+	}
+
+	// Gather the results in input order
+	DBCode status = (started == threads) ? DB_SUCCESS : DB_REQUEST_DENIED;
+	size_t line = skipped;
+	size_t total = 0;
+	for (size_t i = 0; i < threads; ++i) {
+
+		if (status == DB_SUCCESS) {
+			status = chunks[i].status;
+		}
+
+		stats->rows += chunks[i].rows;
+		stats->rejected += chunks[i].rejected;
+		if (stats->firstRejected == 0 && chunks[i].firstRejected != 0) {
+			stats->firstRejected = line + chunks[i].firstRejected;
+		}
+
+		line += chunks[i].lines;
+		total += chunks[i].count;
+	}
+
+	free(input);
+
+	// Refuse the whole load rather than filling the database part way
+	if (status == DB_SUCCESS && total > (size_t)(DB_MAX_ENTRY - context->entries)) {
+		status = DB_REQUEST_DENIED;
+	}
+
+	DBRecord *records = NULL;
+	if (status == DB_SUCCESS && total != 0) {
+		records = malloc(sizeof(DBRecord) * total);
+		if (records == NULL) {
+			status = DB_REQUEST_DENIED;
+		}
+	}
+
+	size_t offset = 0;
+	for (size_t i = 0; i < threads; ++i) {
+		if (records != NULL) {
+			memcpy(records + offset, chunks[i].records, sizeof(DBRecord) * chunks[i].count);
+			offset += chunks[i].count;
+		}
+		free(chunks[i].records);
+	}
+
+	// Write every record at once, updating the entry count a single time
+	if (status == DB_SUCCESS) {
+		status = appendRecords(context, records, (DBIndex)total, &stats->first);
+	}
+	if (status == DB_SUCCESS) {
+		stats->loaded = total;
+	}
+
+	free(records);
+
+	return status;
+}
+
+
+/*	Name:           handleLoadRequest
+	Description:    Handles a database bulk load request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleLoadRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	// Send a confirmation code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Receive the number of records to load
+	DBIndex count;
+	CONDITIONAL_RETURN(receiveIndex(socket, &count));
+
+	// Refuse a load that cannot fit before the client sends it
+	if (count > DB_MAX_ENTRY - context->entries) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBRecord *records = malloc(sizeof(DBRecord) * ((count != 0) ? count : 1));
+	if (records == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Send a confirmation code
+	DBCode status = sendCode(socket, DB_REQUEST_SUCCESS);
+
+	// Receive the records back to back in a single round trip
+	for (DBIndex i = 0; status == DB_SUCCESS && i < count; ++i) {
+		status = receiveRecord(socket, &records[i], false);
+	}
+
+	DBIndex first = 0;
+	if (status == DB_SUCCESS) {
+		status = appendRecords(context, records, count, &first);
+	}
+
+	free(records);
+
+	CONDITIONAL_RETURN(status);
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Send the memberId assigned to the first record
+	CONDITIONAL_RETURN(sendIndex(socket, first));
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendLoadRequest
+	Description:    Sends a block of records to append as one write from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBRecord *records:  The records to load
+	                DBIndex count:  The number of records
+	                DBIndex *first:  The memberId assigned to the first record
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendLoadRequest(SOCKET socket, const DBRecord *records, DBIndex count, DBIndex *first) {
+
+	// Establish function preconditions
+	assert_assume(records != NULL || count == 0);
+	assert_assume(first != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_LOAD));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the number of records
+	CONDITIONAL_RETURN(sendIndex(socket, count));
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the records
+	for (DBIndex i = 0; i < count; ++i) {
+		CONDITIONAL_RETURN(sendRecord(socket, &records[i], false));
+	}
+
+	// Receive a completion code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive the memberId assigned to the first record
+	CONDITIONAL_RETURN(receiveIndex(socket, first));
+
+	return response;
+}
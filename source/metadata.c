@@ -0,0 +1,445 @@
+
+#include "extra.h"
+#include "metadata.h"
+#include "record.h"
+#include "checksum.h"
+#include "numa.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// The identifying bytes and format version at the start of a metadata file
+#define DB_METADATA_MAGIC    "DBMETA"
+#define DB_METADATA_VERSION  1
+
+// Metadata flag bits
+#define DB_METADATA_CLEAN  0x1
+
+// The size of the fixed part of a metadata file and of the largest file
+#define DB_METADATA_HEADER_SIZE  24
+#define DB_METADATA_MAX_SIZE     (DB_METADATA_HEADER_SIZE + DB_METADATA_WARM_MAX * 2 + 4)
+
+// The number of slots each rebuild thread reads at a time
+#define DB_REBUILD_BLOCK_SLOTS  256
+
+// The fewest slots worth handing to a separate rebuild thread
+#define DB_REBUILD_MIN_SLOTS  1024
+
+
+// A struct to store one rebuild thread's range and results
+typedef struct DBRebuildRange {
+
+	const char *path;
+	size_t first;
+	size_t count;
+
+	// One past the last valid slot found, or 0 if none
+	size_t lastValid;
+
+	// Invalid slots before and after lastValid within the range
+	size_t corrupt;
+	size_t trailing;
+
+	DBCode status;
+} DBRebuildRange;
+
+
+// Prototypes for little-endian field access
+void putLE(uint8_t *, uint64_t, size_t);
+uint64_t getLE(const uint8_t *, size_t);
+
+// Prototypes for metadata file handling
+char *temporaryPath(const char *);
+DWORD WINAPI rebuildThread(LPVOID);
+
+
+
+/*	Name:           putLE
+	Description:    Stores an integer in little-endian byte order
+	Parameters:     uint8_t *bytes:  The destination
+	                uint64_t value:  The value to store
+	                size_t size:  The number of bytes to store
+	Returns:        void
+*/
+void putLE(uint8_t *bytes, uint64_t value, size_t size) {
+	for (size_t i = 0; i < size; ++i) {
+		bytes[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+
+/*	Name:           getLE
+	Description:    Loads an integer stored in little-endian byte order
+	Parameters:     uint8_t *bytes:  The source
+	                size_t size:  The number of bytes to load
+	Returns:        uint64_t:  The loaded value
+*/
+uint64_t getLE(const uint8_t *bytes, size_t size) {
+	uint64_t value = 0;
+	for (size_t i = 0; i < size; ++i) {
+		value |= (uint64_t)bytes[i] << (8 * i);
+	}
+	return value;
+}
+
+
+/*	Name:           temporaryPath
+	Description:    Builds the path a metadata file is written to before it replaces the original
+	Parameters:     char *path:  The metadata file path
+	Returns:        char *:  The allocated temporary path, or NULL
+*/
+char *temporaryPath(const char *path) {
+
+	size_t length = strlen(path);
+
+	char *temp = malloc(length + sizeof(".tmp"));
+	if (temp != NULL) {
+		memcpy(temp, path, length);
+		memcpy(temp + length, ".tmp", sizeof(".tmp"));
+	}
+
+	return temp;
+}
+
+
+/*	Name:           saveMetadata
+	Description:    Atomically replaces a metadata file
+	Parameters:     char *path:  The metadata file path
+	                DBMetadata *metadata:  The metadata to save
+	                bool clean:  Whether the database file is closed and consistent
+	Returns:        DBCode:  A return status code
+*/
+DBCode saveMetadata(const char *path, const DBMetadata *metadata, bool clean) {
+
+	// Establish function preconditions
+	assert_assume(path != NULL);
+	assert_assume(metadata != NULL);
+	assert_assume(metadata->warmCount <= DB_METADATA_WARM_MAX);
+
+	uint8_t buffer[DB_METADATA_MAX_SIZE];
+
+	// Lay out the fixed header
+	memcpy(buffer, DB_METADATA_MAGIC, 6);
+	putLE(buffer + 6, DB_METADATA_VERSION, 2);
+	putLE(buffer + 8, clean ? DB_METADATA_CLEAN : 0, 4);
+	putLE(buffer + 12, metadata->entries, 2);
+	putLE(buffer + 14, metadata->warmCount, 2);
+	putLE(buffer + 16, metadata->sequence, 8);
+
+	// Append the warm set and a checksum of everything before it
+	size_t size = DB_METADATA_HEADER_SIZE;
+	for (DBIndex i = 0; i < metadata->warmCount; ++i) {
+		putLE(buffer + size, metadata->warm[i], 2);
+		size += 2;
+	}
+	putLE(buffer + size, ~updateCRC32C(~0u, buffer, size), 4);
+	size += 4;
+
+	char *temp = temporaryPath(path);
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Write a complete copy first so a crash never leaves a half-written file
+	DBCode status = DB_SUCCESS;
+	FILE *file = fopen(temp, "wb");
+	if (file == NULL) {
+		status = DB_FILE_ERROR;
+	}
+	else {
+		if (fwrite(buffer, 1, size, file) != size) {
+			status = DB_FILE_ERROR;
+		}
+		if (fclose(file) != 0) {
+			status = DB_FILE_ERROR;
+		}
+	}
+
+	if (status == DB_SUCCESS
+		&& !MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+		status = DB_FILE_ERROR;
+	}
+
+	free(temp);
+
+	return status;
+}
+
+
+/*	Name:           loadMetadata
+	Description:    Loads a metadata file and checks it describes the database file
+	Parameters:     char *path:  The metadata file path
+	                FILE *file:  The database file
+	                DBMetadata *metadata:  The loaded metadata
+	Returns:        DBCode:  DB_SUCCESS if usable, DB_FILE_FORMAT if it needs a rebuild
+*/
+DBCode loadMetadata(const char *path, FILE *file, DBMetadata *metadata) {
+
+	// Establish function preconditions
+	assert_assume(path != NULL);
+	assert_assume(file != NULL);
+	assert_assume(metadata != NULL);
+
+	uint8_t buffer[DB_METADATA_MAX_SIZE];
+
+	FILE *meta = fopen(path, "rb");
+	if (meta == NULL) {
+		return DB_FILE_ERROR;
+	}
+	size_t size = fread(buffer, 1, sizeof(buffer), meta);
+	fclose(meta);
+
+	// Validate the header and checksum
+	if (size < DB_METADATA_HEADER_SIZE + 4
+		|| memcmp(buffer, DB_METADATA_MAGIC, 6) != 0
+		|| getLE(buffer + 6, 2) != DB_METADATA_VERSION) {
+		return DB_FILE_ERROR;
+	}
+
+	DBIndex warmCount = (DBIndex)getLE(buffer + 14, 2);
+	if (warmCount > DB_METADATA_WARM_MAX
+		|| size != DB_METADATA_HEADER_SIZE + warmCount * 2u + 4) {
+		return DB_FILE_ERROR;
+	}
+	if (getLE(buffer + size - 4, 4) != (uint32_t)~updateCRC32C(~0u, buffer, size - 4)) {
+		return DB_FILE_ERROR;
+	}
+
+	metadata->entries = (DBIndex)getLE(buffer + 12, 2);
+	metadata->sequence = getLE(buffer + 16, 8);
+	metadata->warmCount = warmCount;
+	for (DBIndex i = 0; i < warmCount; ++i) {
+		metadata->warm[i] = (DBIndex)getLE(buffer + DB_METADATA_HEADER_SIZE + i * 2u, 2);
+	}
+	metadata->corrupt = 0;
+
+	// The fields are still useful after a crash, but the entry count is not trusted
+	if ((getLE(buffer + 8, 4) & DB_METADATA_CLEAN) == 0) {
+		return DB_FILE_FORMAT;
+	}
+
+	// A clean shutdown leaves at least the recorded number of slots; a torn tail may follow them
+	if (fseek(file, 0, SEEK_END) != 0) {
+		return DB_FILE_ERROR;
+	}
+	if (ftell(file) < (long)metadata->entries * DB_SLOT_SIZE) {
+		return DB_FILE_FORMAT;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           rebuildThread
+	Description:    Verifies a range of slots for a metadata rebuild
+	Parameters:     LPVOID param:  The range to verify
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI rebuildThread(LPVOID param) {
+
+	DBRebuildRange *range = param;
+
+	range->lastValid = 0;
+	range->corrupt = 0;
+	range->trailing = 0;
+
+	// Each thread reads through its own handle so the ranges proceed in parallel
+	FILE *file = fopen(range->path, "rb");
+	if (file == NULL) {
+		range->status = DB_FILE_ERROR;
+		return 1;
+	}
+
+	DBRecordSlot *block = malloc(sizeof(DBRecordSlot) * DB_REBUILD_BLOCK_SLOTS);
+	if (block == NULL || fseek(file, (long)(range->first * DB_SLOT_SIZE), SEEK_SET) != 0) {
+		free(block);
+		fclose(file);
+		range->status = DB_FILE_ERROR;
+		return 1;
+	}
+
+	range->status = DB_SUCCESS;
+
+	for (size_t done = 0; done < range->count; ) {
+
+		size_t want = range->count - done;
+		if (want > DB_REBUILD_BLOCK_SLOTS) {
+			want = DB_REBUILD_BLOCK_SLOTS;
+		}
+
+		if (scheduledRead(block, DB_SLOT_SIZE, want, file) != want) {
+			range->status = DB_FILE_ERROR;
+			break;
+		}
+
+		for (size_t i = 0; i < want; ++i) {
+			size_t slot = range->first + done + i;
+			if (verifyRecordSlot(&block[i], (DBIndex)(slot + DB_MIN_ENTRY)) == DB_SUCCESS) {
+				// Invalid slots followed by a valid one are corruption, not a torn tail
+				range->corrupt += range->trailing;
+				range->trailing = 0;
+				range->lastValid = slot + 1;
+			}
+			else {
+				++range->trailing;
+			}
+		}
+
+		done += want;
+	}
+
+	free(block);
+	fclose(file);
+
+	return 0;
+}
+
+
+/*	Name:           rebuildMetadata
+	Description:    Recovers the entry count after a crash by verifying every slot in parallel
+	Parameters:     char *path:  The database file path
+	                DBMetadata *metadata:  The metadata to update
+	Returns:        DBCode:  A return status code
+*/
+DBCode rebuildMetadata(const char *path, DBMetadata *metadata) {
+
+	// Establish function preconditions
+	assert_assume(path != NULL);
+	assert_assume(metadata != NULL);
+
+	// Count the whole slots in the file, ignoring a partially appended one
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return DB_FILE_ERROR;
+	}
+	long size = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+	fclose(file);
+	if (size < 0) {
+		return DB_FILE_ERROR;
+	}
+
+	size_t slots = (size_t)size / DB_SLOT_SIZE;
+	if (slots > DB_MAX_ENTRY) {
+		return DB_FILE_FORMAT;
+	}
+
+	// Use one thread per core, but only when each has enough slots to be worth it
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	size_t threads = info.dwNumberOfProcessors;
+	if (threads > DB_REBUILD_MAX_THREADS) {
+		threads = DB_REBUILD_MAX_THREADS;
+	}
+	if (threads > slots / DB_REBUILD_MIN_SLOTS) {
+		threads = slots / DB_REBUILD_MIN_SLOTS;
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+
+	DBRebuildRange ranges[DB_REBUILD_MAX_THREADS];
+	HANDLE handles[DB_REBUILD_MAX_THREADS];
+	size_t started = 0;
+
+	for (size_t i = 0; i < threads; ++i) {
+
+		ranges[i].path = path;
+		ranges[i].first = slots * i / threads;
+		ranges[i].count = slots * (i + 1) / threads - ranges[i].first;
+		ranges[i].status = DB_FILE_ERROR;
+
+		handles[i] = startNodeThread(rebuildThread, &ranges[i], i);
+		if (handles[i] == NULL) {
+			break;
+		}
+		++started;
+	}
+
+	if (started != 0) {
+		WaitForMultipleObjects((DWORD)started, handles, TRUE, INFINITE);
+	}
+	for (size_t i = 0; i < started; ++i) {
+		CloseHandle(handles[i]);
+	}
+	if (started != threads) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// The entry count ends at the last valid slot in the file
+	size_t entries = 0;
+	for (size_t i = 0; i < threads; ++i) {
+		CONDITIONAL_RETURN(ranges[i].status);
+		if (ranges[i].lastValid > entries) {
+			entries = ranges[i].lastValid;
+		}
+	}
+
+	// Invalid slots are corruption unless they belong to the torn tail
+	size_t corrupt = 0;
+	for (size_t i = 0; i < threads; ++i) {
+		corrupt += ranges[i].corrupt;
+		if (ranges[i].first + ranges[i].count <= entries) {
+			corrupt += ranges[i].trailing;
+		}
+	}
+
+	metadata->entries = (DBIndex)entries;
+	metadata->corrupt = (DBIndex)corrupt;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           openMetadata
+	Description:    Restores metadata on start, rebuilding it only after a crash, then marks it in use
+	Parameters:     char *metaPath:  The metadata file path
+	                char *path:  The database file path
+	                FILE *file:  The open database file
+	                DBMetadata *metadata:  The restored metadata
+	Returns:        DBCode:  A return status code
+*/
+DBCode openMetadata(const char *metaPath, const char *path, FILE *file, DBMetadata *metadata) {
+
+	// Establish function preconditions
+	assert_assume(metaPath != NULL);
+	assert_assume(path != NULL);
+	assert_assume(file != NULL);
+	assert_assume(metadata != NULL);
+
+	DBCode status = loadMetadata(metaPath, file, metadata);
+
+	// Without a readable file there is nothing worth keeping
+	if (status == DB_FILE_ERROR) {
+		memset(metadata, 0, sizeof(DBMetadata));
+	}
+
+	if (status != DB_SUCCESS) {
+		CONDITIONAL_RETURN(rebuildMetadata(path, metadata));
+	}
+
+	// Until the next clean shutdown, a restart must not trust the saved count, and
+	// must number commits past any this run hands out
+	metadata->sequence += DB_METADATA_SEQUENCE_RESERVE;
+	status = saveMetadata(metaPath, metadata, false);
+	metadata->sequence -= DB_METADATA_SEQUENCE_RESERVE;
+
+	return status;
+}
+
+
+/*	Name:           closeMetadata
+	Description:    Saves metadata on clean shutdown, after the database file is flushed
+	Parameters:     char *metaPath:  The metadata file path
+	                DBMetadata *metadata:  The metadata to save
+	Returns:        DBCode:  A return status code
+*/
+DBCode closeMetadata(const char *metaPath, const DBMetadata *metadata) {
+
+	// Establish function preconditions
+	assert_assume(metaPath != NULL);
+	assert_assume(metadata != NULL);
+
+	return saveMetadata(metaPath, metadata, true);
+}
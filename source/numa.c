@@ -0,0 +1,224 @@
+
+#include "extra.h"
+#include "numa.h"
+
+#include <Psapi.h>
+
+
+// Placement counters shared by every allocation and thread
+static volatile LONG64 largeBytes;
+static volatile LONG64 smallBytes;
+static volatile LONG64 largeFallbacks;
+static volatile LONG64 pinnedThreads;
+
+
+
+/*	Name:           enableLargePages
+	Description:    Enables the lock-memory privilege that large page allocations require
+	Parameters:     void
+	Returns:        bool:  Whether large pages can be allocated
+*/
+bool enableLargePages(void) {
+
+	if (GetLargePageMinimum() == 0) {
+		return false;
+	}
+
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+		return false;
+	}
+
+	TOKEN_PRIVILEGES privileges;
+	privileges.PrivilegeCount = 1;
+	privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+	// The call succeeds without granting anything when the account lacks the privilege
+	bool enabled = LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)
+		&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL)
+		&& GetLastError() == ERROR_SUCCESS;
+
+	CloseHandle(token);
+
+	return enabled;
+}
+
+
+/*	Name:           allocatePages
+	Description:    Allocates zeroed memory directly from the system, optionally with large pages or on a node
+	Parameters:     size_t size:  The number of bytes to allocate
+	                bool large:  Whether to try large pages, falling back to ordinary pages
+	                ULONG node:  The preferred node, or DB_NODE_ANY
+	Returns:        void *:  The allocated memory, or NULL
+*/
+void *allocatePages(size_t size, bool large, ULONG node) {
+
+	// Establish function preconditions
+	assert_assume(size != 0);
+
+	HANDLE process = GetCurrentProcess();
+	DWORD flags = MEM_RESERVE | MEM_COMMIT;
+	void *memory = NULL;
+
+	// Large pages must be allocated in whole multiples of the large page size
+	if (large && enableLargePages()) {
+
+		size_t granule = GetLargePageMinimum();
+		size_t rounded = (size + granule - 1) / granule * granule;
+
+		memory = (node == DB_NODE_ANY)
+			? VirtualAlloc(NULL, rounded, flags | MEM_LARGE_PAGES, PAGE_READWRITE)
+			: VirtualAllocExNuma(process, NULL, rounded, flags | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+
+		if (memory != NULL) {
+			InterlockedExchangeAdd64(&largeBytes, (LONG64)rounded);
+			return memory;
+		}
+	}
+
+	if (large) {
+		InterlockedIncrement64(&largeFallbacks);
+	}
+
+	memory = (node == DB_NODE_ANY)
+		? VirtualAlloc(NULL, size, flags, PAGE_READWRITE)
+		: VirtualAllocExNuma(process, NULL, size, flags, PAGE_READWRITE, node);
+
+	if (memory != NULL) {
+		InterlockedExchangeAdd64(&smallBytes, (LONG64)size);
+	}
+
+	return memory;
+}
+
+
+/*	Name:           freePages
+	Description:    Frees memory allocated with allocatePages
+	Parameters:     void *memory:  The memory to free
+	Returns:        void
+*/
+void freePages(void *memory) {
+
+	if (memory != NULL) {
+		VirtualFree(memory, 0, MEM_RELEASE);
+	}
+}
+
+
+/*	Name:           countNumaNodes
+	Description:    Reads the number of NUMA nodes in the system
+	Parameters:     void
+	Returns:        ULONG:  The number of nodes, at least one
+*/
+ULONG countNumaNodes(void) {
+
+	ULONG highest = 0;
+	if (!GetNumaHighestNodeNumber(&highest)) {
+		return 1;
+	}
+
+	return highest + 1;
+}
+
+
+/*	Name:           pinThreadToNode
+	Description:    Restricts a thread to the processors of one node
+	Parameters:     HANDLE thread:  The thread to pin
+	                ULONG node:  The node to pin the thread to
+	Returns:        bool:  Whether the thread was pinned
+*/
+bool pinThreadToNode(HANDLE thread, ULONG node) {
+
+	// Establish function preconditions
+	assert_assume(thread != NULL);
+
+	// Node numbers may be sparse, and nodes without processors cannot run threads
+	GROUP_AFFINITY affinity = { 0 };
+	if (!GetNumaNodeProcessorMaskEx((USHORT)node, &affinity) || affinity.Mask == 0) {
+		return false;
+	}
+	if (!SetThreadGroupAffinity(thread, &affinity, NULL)) {
+		return false;
+	}
+
+	InterlockedIncrement64(&pinnedThreads);
+
+	return true;
+}
+
+
+/*	Name:           startNodeThread
+	Description:    Starts a worker thread pinned to a node chosen round-robin by its index
+	Parameters:     LPTHREAD_START_ROUTINE routine:  The thread function
+	                void *param:  The parameter passed to the thread function
+	                size_t index:  The index of the worker among its siblings
+	Returns:        HANDLE:  The started thread, or NULL
+*/
+HANDLE startNodeThread(LPTHREAD_START_ROUTINE routine, void *param, size_t index) {
+
+	// Establish function preconditions
+	assert_assume(routine != NULL);
+
+	// The thread is pinned before it runs, so memory it touches first is local to its node
+	HANDLE thread = CreateThread(NULL, 0, routine, param, CREATE_SUSPENDED, NULL);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	ULONG nodes = countNumaNodes();
+	if (nodes > 1) {
+		pinThreadToNode(thread, (ULONG)(index % nodes));
+	}
+
+	ResumeThread(thread);
+
+	return thread;
+}
+
+
+/*	Name:           readPageNode
+	Description:    Reads the node holding a resident page and whether it is a large page
+	Parameters:     void *address:  An address in the page
+	                ULONG *node:  The node holding the page
+	                bool *large:  Whether the page is a large page
+	Returns:        DBCode:  A return status code
+*/
+DBCode readPageNode(const void *address, ULONG *node, bool *large) {
+
+	// Establish function preconditions
+	assert_assume(address != NULL);
+	assert_assume(node != NULL);
+	assert_assume(large != NULL);
+
+	PSAPI_WORKING_SET_EX_INFORMATION info = { 0 };
+	info.VirtualAddress = (PVOID)address;
+
+	// Pages that are not resident report no placement
+	if (!QueryWorkingSetEx(GetCurrentProcess(), &info, sizeof(info)) || !info.VirtualAttributes.Valid) {
+		return DB_REQUEST_DENIED;
+	}
+
+	*node = (ULONG)info.VirtualAttributes.Node;
+	*large = info.VirtualAttributes.LargePage != 0;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           readMemoryStats
+	Description:    Reads how memory and threads were placed
+	Parameters:     DBMemoryStats *stats:  The statistics read
+	Returns:        void
+*/
+void readMemoryStats(DBMemoryStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(stats != NULL);
+
+	stats->largePageSize = GetLargePageMinimum();
+	stats->largeBytes = (uint64_t)InterlockedCompareExchange64(&largeBytes, 0, 0);
+	stats->smallBytes = (uint64_t)InterlockedCompareExchange64(&smallBytes, 0, 0);
+	stats->largeFallbacks = (uint64_t)InterlockedCompareExchange64(&largeFallbacks, 0, 0);
+	stats->pinnedThreads = (uint64_t)InterlockedCompareExchange64(&pinnedThreads, 0, 0);
+	stats->nodes = countNumaNodes();
+}
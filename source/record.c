@@ -0,0 +1,245 @@
+
+#include "extra.h"
+#include "record.h"
+#include "checksum.h"
+#include "scheduler.h"
+
+#include <string.h>
+
+
+// The number of slots written per call when converting files
+#define DB_CONVERT_BLOCK  256
+
+
+// The layout must match the specification exactly
+static_assert(sizeof(DBRecordSlot) == DB_SLOT_SIZE, "DBRecordSlot must be one 64-byte slot");
+static_assert(offsetof(DBRecordSlot, checksum) == 0, "DBRecordSlot checksum offset");
+static_assert(offsetof(DBRecordSlot, versionFlags) == 4, "DBRecordSlot versionFlags offset");
+static_assert(offsetof(DBRecordSlot, birthDate) == 5, "DBRecordSlot birthDate offset");
+static_assert(offsetof(DBRecordSlot, firstName) == 8, "DBRecordSlot firstName offset");
+static_assert(offsetof(DBRecordSlot, lastName) == 36, "DBRecordSlot lastName offset");
+
+
+/*	Name:           computeSlotChecksum
+	Description:    Computes the checksum of a slot stored at a memberId
+	Parameters:     DBRecordSlot *slot:  The slot to checksum
+	                DBIndex memberId:  The memberId the slot is stored at
+	Returns:        uint32_t:  The checksum
+*/
+uint32_t computeSlotChecksum(const DBRecordSlot *slot, DBIndex memberId) {
+
+	// Establish function preconditions
+	assert_assume(slot != NULL);
+
+	uint8_t seed[2] = { (uint8_t)memberId, (uint8_t)(memberId >> 8) };
+
+	uint32_t crc = ~0u;
+	crc = updateCRC32C(crc, seed, sizeof(seed));
+	crc = updateCRC32C(crc, &slot->versionFlags, DB_SLOT_SIZE - sizeof(slot->checksum));
+
+	return ~crc;
+}
+
+
+/*	Name:           validRecordDate
+	Description:    Checks that a date fits the packed birthDate field without losing bits
+	Parameters:     DBDate *date:  The date to check
+	Returns:        bool:  Whether the date can be stored
+*/
+bool validRecordDate(const DBDate *date) {
+
+	// Establish function preconditions
+	assert_assume(date != NULL);
+
+	return date->day <= 0x1F
+		&& date->month <= 0x0F
+		&& date->year <= DB_SLOT_MAX_YEAR;
+}
+
+
+/*	Name:           encodeRecordSlot
+	Description:    Lays out a record in the on-disk slot format
+	Parameters:     DBRecord *record:  The record to encode
+	                DBRecordSlot *slot:  The encoded slot
+	Returns:        void
+*/
+void encodeRecordSlot(const DBRecord *record, DBRecordSlot *slot) {
+
+	// Establish function preconditions
+	assert_assume(record != NULL);
+	assert_assume(slot != NULL);
+	assert(validRecordDate(&record->birthDate));
+
+	slot->versionFlags = DB_SLOT_VERSION_FLAGS(DB_SLOT_VERSION, DB_SLOT_FLAG_LIVE);
+
+	// Pack the date into 24 bits
+	uint32_t date = (uint32_t)(record->birthDate.day & 0x1F)
+		| (uint32_t)(record->birthDate.month & 0x0F) << 5
+		| (uint32_t)(record->birthDate.year & DB_SLOT_MAX_YEAR) << 9;
+	slot->birthDate[0] = (uint8_t)date;
+	slot->birthDate[1] = (uint8_t)(date >> 8);
+	slot->birthDate[2] = (uint8_t)(date >> 16);
+
+	// Copy the names, padding the unused bytes with NULs
+	strncpy(slot->firstName, record->firstName, DB_SLOT_NAME_SIZE);
+	strncpy(slot->lastName, record->lastName, DB_SLOT_NAME_SIZE);
+
+	// Supported targets are little-endian, so the checksum is stored natively
+	slot->checksum = computeSlotChecksum(slot, record->memberId);
+}
+
+
+/*	Name:           decodeRecordSlot
+	Description:    Converts an on-disk slot back into a record
+	Parameters:     DBRecordSlot *slot:  The slot to decode
+	                DBIndex memberId:  The memberId the slot is stored at
+	                DBRecord *record:  The decoded record
+	Returns:        void
+*/
+void decodeRecordSlot(const DBRecordSlot *slot, DBIndex memberId, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(slot != NULL);
+	assert_assume(record != NULL);
+
+	record->memberId = memberId;
+
+	// Unpack the 24-bit date
+	uint32_t date = (uint32_t)slot->birthDate[0]
+		| (uint32_t)slot->birthDate[1] << 8
+		| (uint32_t)slot->birthDate[2] << 16;
+	record->birthDate.day = (DBDateDay)(date & 0x1F);
+	record->birthDate.month = (DBDateMonth)((date >> 5) & 0x0F);
+	record->birthDate.year = (DBDateYear)((date >> 9) & DB_SLOT_MAX_YEAR);
+
+	// Names fill the slot field exactly, so terminate them explicitly
+	memcpy(record->firstName, slot->firstName, DB_SLOT_NAME_SIZE);
+	record->firstName[DB_SLOT_NAME_SIZE] = '\0';
+	memcpy(record->lastName, slot->lastName, DB_SLOT_NAME_SIZE);
+	record->lastName[DB_SLOT_NAME_SIZE] = '\0';
+}
+
+
+/*	Name:           verifyRecordSlot
+	Description:    Checks a slot's format version and checksum
+	Parameters:     DBRecordSlot *slot:  The slot to verify
+	                DBIndex memberId:  The memberId the slot is stored at
+	Returns:        DBCode:  A return status code
+*/
+DBCode verifyRecordSlot(const DBRecordSlot *slot, DBIndex memberId) {
+
+	// Establish function preconditions
+	assert_assume(slot != NULL);
+
+	if (DB_SLOT_VERSION_OF(slot->versionFlags) != DB_SLOT_VERSION) {
+		return DB_FILE_FORMAT;
+	}
+	if (slot->checksum != computeSlotChecksum(slot, memberId)) {
+		return DB_FILE_FORMAT;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           readRecordV1
+	Description:    Reads a record stored in the original compiler-defined layout
+	Parameters:     FILE *file:  The file to read the record from
+	                DBRecord *record:  The record to read from the file
+	Returns:        DBCode:  A return status code
+*/
+DBCode readRecordV1(FILE *file, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(record != NULL);
+	assert_assume(file != NULL);
+
+	// Temporary union for type-punning
+	union {
+		DBRecord record;
+		char buffer[sizeof(DBRecord)];
+	} temp;
+
+	// Read the file contents into the temp variable buffer
+	if (scheduledRead(temp.buffer, sizeof(char), sizeof(DBRecord), file) != sizeof(DBRecord)) {
+		return DB_FILE_ERROR;
+	}
+
+	// Convert integers to host byte order
+	temp.record.memberId = ntohs(temp.record.memberId);
+	temp.record.birthDate.year = ntohs(temp.record.birthDate.year);
+
+	// Copy the temp variable into the record
+	*record = temp.record;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           convertRecordFile
+	Description:    Rewrites an original layout database file in the slot format
+	Parameters:     FILE *source:  The original layout file, positioned at its start
+	                FILE *destination:  The file to write slots to, positioned at its start
+	                DBIndex *converted:  The number of records converted
+	Returns:        DBCode:  A return status code
+*/
+DBCode convertRecordFile(FILE *source, FILE *destination, DBIndex *converted) {
+
+	// Establish function preconditions
+	assert_assume(source != NULL);
+	assert_assume(destination != NULL);
+	assert_assume(converted != NULL);
+
+	// Size the conversion from the original file length
+	if (fseek(source, 0, SEEK_END) != 0) {
+		return DB_FILE_ERROR;
+	}
+	long size = ftell(source);
+	if (size < 0 || size % sizeof(DBRecord) != 0 || size / sizeof(DBRecord) > DB_MAX_ENTRY) {
+		return DB_FILE_FORMAT;
+	}
+	if (fseek(source, 0, SEEK_SET) != 0) {
+		return DB_FILE_ERROR;
+	}
+
+	DBIndex entries = (DBIndex)(size / sizeof(DBRecord));
+	*converted = 0;
+
+	// Convert a block at a time so slots are written in large contiguous runs
+	DBRecordSlot block[DB_CONVERT_BLOCK];
+
+	while (*converted < entries) {
+
+		size_t count = entries - *converted;
+		if (count > DB_CONVERT_BLOCK) {
+			count = DB_CONVERT_BLOCK;
+		}
+
+		for (size_t i = 0; i < count; ++i) {
+
+			DBRecord record;
+			CONDITIONAL_RETURN(readRecordV1(source, &record));
+
+			// A date the old layout held but the slot cannot is corruption, not something to truncate
+			if (!validRecordDate(&record.birthDate)) {
+				return DB_FILE_ERROR;
+			}
+
+			// The slot position, not the stored field, defines the memberId
+			record.memberId = (DBIndex)(*converted + i + DB_MIN_ENTRY);
+			encodeRecordSlot(&record, &block[i]);
+		}
+
+		if (scheduledWrite(block, sizeof(DBRecordSlot), count, destination) != count) {
+			return DB_FILE_ERROR;
+		}
+
+		*converted += (DBIndex)count;
+	}
+
+	if (scheduledFlush(destination) != 0) {
+		return DB_FILE_ERROR;
+	}
+
+	return DB_SUCCESS;
+}
@@ -0,0 +1,74 @@
+
+#include "extra.h"
+#include "scan.h"
+#include "snapshot.h"
+#include "arena.h"
+#include "scheduler.h"
+
+
+/*	Name:           scanSlots
+	Description:    Passes every slot to a callback a verified block at a time
+	Parameters:     DBContext *context:  The database state to scan
+	                DBSlotCallback callback:  The function to pass each block to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode scanSlots(DBContext *context, DBSlotCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(callback != NULL);
+
+	DBRecordSlot *block = allocateRequestMemory(sizeof(DBRecordSlot) * DB_SCAN_BLOCK_SLOTS);
+	if (block == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Pin a snapshot so the scan is consistent without blocking writers between blocks
+	DBSnapshot snapshot;
+	DBIndex entries = context->entries;
+	if (context->versions != NULL) {
+		beginSnapshot(context->versions, &context->entries, &snapshot);
+		entries = snapshot.entries;
+	}
+	else if (fseek(context->file, 0, SEEK_SET) != 0) {
+		freeRequestMemory(block);
+		return DB_FILE_ERROR;
+	}
+
+	DBCode status = DB_SUCCESS;
+	for (size_t done = 0; status == DB_SUCCESS && done < entries; ) {
+
+		size_t count = entries - done;
+		if (count > DB_SCAN_BLOCK_SLOTS) {
+			count = DB_SCAN_BLOCK_SLOTS;
+		}
+		DBIndex first = (DBIndex)(done + DB_MIN_ENTRY);
+
+		// Without a version store nothing else moves the file position between blocks
+		if (context->versions != NULL) {
+			status = readSnapshotSlots(context->versions, context->file, &snapshot, first, count, block);
+		}
+		else if (scheduledRead(block, DB_SLOT_SIZE, count, context->file) != count) {
+			status = DB_FILE_ERROR;
+		}
+
+		for (size_t i = 0; status == DB_SUCCESS && i < count; ++i) {
+			status = verifyRecordSlot(&block[i], (DBIndex)(first + i));
+		}
+
+		if (status == DB_SUCCESS) {
+			status = callback(block, first, count, user);
+		}
+
+		done += count;
+	}
+
+	if (context->versions != NULL) {
+		endSnapshot(context->versions, &snapshot);
+	}
+
+	freeRequestMemory(block);
+
+	return status;
+}
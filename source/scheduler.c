@@ -0,0 +1,440 @@
+
+#include "extra.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+
+
+// The background may save up at most this long at its current rate, but always at least one minimum burst
+#define DB_IO_BURST_MS     100
+#define DB_IO_MIN_BURST    ((int64_t)64 * 1024)
+
+// Above the latency target the rate halves, down to this fraction of the configured rate
+#define DB_IO_MIN_RATE_DIVISOR  64
+
+// Below the latency target the rate recovers by this fraction of the configured rate
+#define DB_IO_RECOVER_DIVISOR  16
+
+// The weight of each new foreground latency in the smoothed latency, as a shift
+#define DB_IO_SMOOTHING_SHIFT  3
+
+
+// A struct to store the state of the process I/O scheduler
+struct DBIOScheduler {
+
+	// Guards the token bucket and the current rate
+	SRWLOCK lock;
+
+	// The configured and currently allowed background rates in bytes per second
+	uint64_t baseRate;
+	uint64_t rate;
+
+	// Bytes the background may still use, negative while it is in debt
+	int64_t tokens;
+
+	// Performance counter ticks at the last refill and the last rate adjustment
+	LONGLONG refilled;
+	LONGLONG adjusted;
+
+	LONGLONG frequency;
+	LONGLONG target;
+
+	// Smoothed foreground latency, and the ticks at which the last foreground I/O finished
+	volatile LONG64 latency;
+	volatile LONG64 lastForeground;
+
+	volatile LONG64 foregroundOps;
+	volatile LONG64 foregroundBytes;
+	volatile LONG64 backgroundOps;
+	volatile LONG64 backgroundBytes;
+	volatile LONG64 throttledMs;
+};
+
+
+// Prototypes for scheduling storage I/O
+void adjustRate(DBIOScheduler *, LONGLONG);
+DWORD takeTokens(DBIOScheduler *, size_t);
+void noteForeground(DBIOScheduler *, LONGLONG, size_t);
+
+
+
+// The running scheduler, published once set up and read on every storage I/O
+static DBIOScheduler *volatile activeScheduler = NULL;
+
+// Excludes I/O while the scheduler is being stopped
+static SRWLOCK schedulerLock = SRWLOCK_INIT;
+
+// The class of the calling thread's I/O
+static thread_storage DBIOClass ioClass = DB_IO_FOREGROUND;
+
+
+/*	Name:           startIOScheduler
+	Description:    Starts scheduling storage I/O, rate limiting the background
+	Parameters:     size_t rate:  The background rate in bytes per second
+	                DWORD targetUs:  The smoothed foreground latency above which the background is slowed
+	                DBIOScheduler **scheduler:  The started scheduler
+	Returns:        DBCode:  A return status code
+*/
+DBCode startIOScheduler(size_t rate, DWORD targetUs, DBIOScheduler **scheduler) {
+
+	// Establish function preconditions
+	assert_assume(rate != 0);
+	assert_assume(targetUs != 0);
+	assert_assume(scheduler != NULL);
+
+	DBIOScheduler *temp = calloc(1, sizeof(DBIOScheduler));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+	temp->baseRate = rate;
+	temp->rate = rate;
+	temp->tokens = DB_IO_MIN_BURST;
+
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&counter);
+	temp->frequency = counter.QuadPart;
+	temp->target = temp->frequency * targetUs / 1'000'000;
+	QueryPerformanceCounter(&counter);
+	temp->refilled = counter.QuadPart;
+	temp->adjusted = counter.QuadPart;
+
+	// Only one scheduler runs in a process, so a racing start is checked under the same lock it publishes with
+	AcquireSRWLockExclusive(&schedulerLock);
+	bool running = activeScheduler != NULL;
+	if (!running) {
+		activeScheduler = temp;
+	}
+	ReleaseSRWLockExclusive(&schedulerLock);
+
+	if (running) {
+		free(temp);
+		return DB_REQUEST_DENIED;
+	}
+
+	*scheduler = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopIOScheduler
+	Description:    Stops scheduling storage I/O, so it proceeds unscheduled, and frees the scheduler
+	Parameters:     DBIOScheduler *scheduler:  The scheduler to stop
+	Returns:        void
+*/
+void stopIOScheduler(DBIOScheduler *scheduler) {
+
+	if (scheduler == NULL) {
+		return;
+	}
+
+	// Once this returns no thread is using the scheduler and none will again
+	AcquireSRWLockExclusive(&schedulerLock);
+	activeScheduler = NULL;
+	ReleaseSRWLockExclusive(&schedulerLock);
+
+	free(scheduler);
+}
+
+
+/*	Name:           setBackgroundRate
+	Description:    Changes the background rate, restarting any throttling from it
+	Parameters:     DBIOScheduler *scheduler:  The scheduler to change
+	                size_t rate:  The background rate in bytes per second
+	Returns:        void
+*/
+void setBackgroundRate(DBIOScheduler *scheduler, size_t rate) {
+
+	// Establish function preconditions
+	assert_assume(scheduler != NULL);
+	assert_assume(rate != 0);
+
+	AcquireSRWLockExclusive(&scheduler->lock);
+	scheduler->baseRate = rate;
+	scheduler->rate = rate;
+	ReleaseSRWLockExclusive(&scheduler->lock);
+}
+
+
+/*	Name:           readIOStats
+	Description:    Reads the storage I/O seen by a scheduler
+	Parameters:     DBIOScheduler *scheduler:  The scheduler to read
+	                DBIOStats *stats:  The statistics read
+	Returns:        void
+*/
+void readIOStats(DBIOScheduler *scheduler, DBIOStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(scheduler != NULL);
+	assert_assume(stats != NULL);
+
+	stats->foregroundOps = (uint64_t)InterlockedCompareExchange64(&scheduler->foregroundOps, 0, 0);
+	stats->foregroundBytes = (uint64_t)InterlockedCompareExchange64(&scheduler->foregroundBytes, 0, 0);
+	stats->backgroundOps = (uint64_t)InterlockedCompareExchange64(&scheduler->backgroundOps, 0, 0);
+	stats->backgroundBytes = (uint64_t)InterlockedCompareExchange64(&scheduler->backgroundBytes, 0, 0);
+	stats->throttledMs = (uint64_t)InterlockedCompareExchange64(&scheduler->throttledMs, 0, 0);
+
+	LONG64 latency = InterlockedCompareExchange64(&scheduler->latency, 0, 0);
+	stats->foregroundLatencyUs = (uint64_t)(latency * 1'000'000 / scheduler->frequency);
+
+	AcquireSRWLockShared(&scheduler->lock);
+	stats->backgroundRate = scheduler->rate;
+	ReleaseSRWLockShared(&scheduler->lock);
+}
+
+
+/*	Name:           setIOClass
+	Description:    Sets the class of the calling thread's storage I/O, foreground by default
+	Parameters:     DBIOClass type:  The class of I/O the thread performs
+	Returns:        void
+*/
+void setIOClass(DBIOClass type) {
+
+	// Establish function preconditions
+	assert_assume(type == DB_IO_FOREGROUND || type == DB_IO_BACKGROUND);
+
+	ioClass = type;
+}
+
+
+/*	Name:           adjustRate
+	Description:    Halves the background rate while the foreground is slow and recovers it otherwise
+	Parameters:     DBIOScheduler *scheduler:  The scheduler, locked exclusively
+	                LONGLONG now:  The current performance counter ticks
+	Returns:        void
+*/
+void adjustRate(DBIOScheduler *scheduler, LONGLONG now) {
+
+	if (now - scheduler->adjusted < scheduler->frequency * DB_IO_ADJUST_INTERVAL_MS / 1000) {
+		return;
+	}
+	scheduler->adjusted = now;
+
+	// A foreground that has gone quiet no longer holds the background back
+	LONG64 last = InterlockedCompareExchange64(&scheduler->lastForeground, 0, 0);
+	bool recent = (now - last) < scheduler->frequency * DB_IO_IDLE_MS / 1000;
+	bool slow = recent && InterlockedCompareExchange64(&scheduler->latency, 0, 0) > scheduler->target;
+
+	uint64_t minimum = scheduler->baseRate / DB_IO_MIN_RATE_DIVISOR;
+	if (minimum == 0) {
+		minimum = 1;
+	}
+
+	if (slow) {
+		scheduler->rate /= 2;
+		if (scheduler->rate < minimum) {
+			scheduler->rate = minimum;
+		}
+	}
+	else if (scheduler->rate < scheduler->baseRate) {
+		scheduler->rate += scheduler->baseRate / DB_IO_RECOVER_DIVISOR + 1;
+		if (scheduler->rate > scheduler->baseRate) {
+			scheduler->rate = scheduler->baseRate;
+		}
+	}
+}
+
+
+/*	Name:           takeTokens
+	Description:    Takes tokens for background I/O from the bucket, going into debt if there are too few
+	Parameters:     DBIOScheduler *scheduler:  The scheduler
+	                size_t bytes:  The size of the I/O
+	Returns:        DWORD:  The milliseconds to wait before the I/O to repay any debt
+*/
+DWORD takeTokens(DBIOScheduler *scheduler, size_t bytes) {
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	AcquireSRWLockExclusive(&scheduler->lock);
+
+	adjustRate(scheduler, now.QuadPart);
+
+	// Refill for the time since the last refill, up to one burst
+	int64_t burst = (int64_t)(scheduler->rate * DB_IO_BURST_MS / 1000);
+	if (burst < DB_IO_MIN_BURST) {
+		burst = DB_IO_MIN_BURST;
+	}
+
+	LONGLONG elapsed = now.QuadPart - scheduler->refilled;
+	if (elapsed > scheduler->frequency) {
+		elapsed = scheduler->frequency;
+	}
+	scheduler->tokens += (int64_t)((uint64_t)elapsed * scheduler->rate / (uint64_t)scheduler->frequency);
+	if (scheduler->tokens > burst) {
+		scheduler->tokens = burst;
+	}
+	scheduler->refilled = now.QuadPart;
+
+	scheduler->tokens -= (int64_t)bytes;
+
+	DWORD wait = 0;
+	if (scheduler->tokens < 0) {
+		wait = (DWORD)((uint64_t)-scheduler->tokens * 1000 / scheduler->rate);
+	}
+
+	ReleaseSRWLockExclusive(&scheduler->lock);
+
+	return wait;
+}
+
+
+/*	Name:           paceIO
+	Description:    Waits until the background rate allows I/O of a size, returning at once for foreground threads
+	Parameters:     size_t bytes:  The size of the I/O about to be issued
+	Returns:        void
+*/
+void paceIO(size_t bytes) {
+
+	if (ioClass != DB_IO_BACKGROUND || bytes == 0) {
+		return;
+	}
+
+	// The wait is taken after the scheduler lock is released, so stopping never waits on it
+	DWORD wait = 0;
+
+	AcquireSRWLockShared(&schedulerLock);
+
+	DBIOScheduler *scheduler = activeScheduler;
+	if (scheduler != NULL) {
+		wait = takeTokens(scheduler, bytes);
+		InterlockedIncrement64(&scheduler->backgroundOps);
+		InterlockedExchangeAdd64(&scheduler->backgroundBytes, (LONG64)bytes);
+		InterlockedExchangeAdd64(&scheduler->throttledMs, (LONG64)wait);
+	}
+
+	ReleaseSRWLockShared(&schedulerLock);
+
+	if (wait != 0) {
+		Sleep(wait);
+	}
+}
+
+
+/*	Name:           noteForeground
+	Description:    Folds the latency of a foreground I/O into the smoothed latency
+	Parameters:     DBIOScheduler *scheduler:  The scheduler
+	                LONGLONG begin:  The performance counter ticks when the I/O was issued
+	                size_t bytes:  The size of the I/O
+	Returns:        void
+*/
+void noteForeground(DBIOScheduler *scheduler, LONGLONG begin, size_t bytes) {
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	LONG64 sample = now.QuadPart - begin;
+
+	// An exponential moving average, updated without a lock
+	LONG64 latency = InterlockedCompareExchange64(&scheduler->latency, 0, 0);
+	for (;;) {
+		LONG64 smoothed = latency + ((sample - latency) >> DB_IO_SMOOTHING_SHIFT);
+		LONG64 seen = InterlockedCompareExchange64(&scheduler->latency, smoothed, latency);
+		if (seen == latency) {
+			break;
+		}
+		latency = seen;
+	}
+
+	InterlockedExchange64(&scheduler->lastForeground, now.QuadPart);
+	InterlockedIncrement64(&scheduler->foregroundOps);
+	InterlockedExchangeAdd64(&scheduler->foregroundBytes, (LONG64)bytes);
+}
+
+
+/*	Name:           scheduledRead
+	Description:    Reads from a storage file like fread, pacing background threads and timing foreground ones
+	Parameters:     void *buffer:  The buffer to read into
+	                size_t size:  The size of each element
+	                size_t count:  The number of elements
+	                FILE *file:  The file to read from
+	Returns:        size_t:  The number of elements read
+*/
+size_t scheduledRead(void *buffer, size_t size, size_t count, FILE *file) {
+
+	if (ioClass == DB_IO_BACKGROUND) {
+		paceIO(size * count);
+		return fread(buffer, size, count, file);
+	}
+
+	// Volatile reads have acquire semantics under MSVC
+	if (activeScheduler == NULL) {
+		return fread(buffer, size, count, file);
+	}
+
+	LARGE_INTEGER begin;
+	QueryPerformanceCounter(&begin);
+
+	size_t result = fread(buffer, size, count, file);
+
+	AcquireSRWLockShared(&schedulerLock);
+	if (activeScheduler != NULL) {
+		noteForeground(activeScheduler, begin.QuadPart, size * result);
+	}
+	ReleaseSRWLockShared(&schedulerLock);
+
+	return result;
+}
+
+
+/*	Name:           scheduledWrite
+	Description:    Writes to a storage file like fwrite, pacing background threads and timing foreground ones
+	Parameters:     void *buffer:  The buffer to write from
+	                size_t size:  The size of each element
+	                size_t count:  The number of elements
+	                FILE *file:  The file to write to
+	Returns:        size_t:  The number of elements written
+*/
+size_t scheduledWrite(const void *buffer, size_t size, size_t count, FILE *file) {
+
+	if (ioClass == DB_IO_BACKGROUND) {
+		paceIO(size * count);
+		return fwrite(buffer, size, count, file);
+	}
+
+	if (activeScheduler == NULL) {
+		return fwrite(buffer, size, count, file);
+	}
+
+	LARGE_INTEGER begin;
+	QueryPerformanceCounter(&begin);
+
+	size_t result = fwrite(buffer, size, count, file);
+
+	AcquireSRWLockShared(&schedulerLock);
+	if (activeScheduler != NULL) {
+		noteForeground(activeScheduler, begin.QuadPart, size * result);
+	}
+	ReleaseSRWLockShared(&schedulerLock);
+
+	return result;
+}
+
+
+/*	Name:           scheduledFlush
+	Description:    Flushes a storage file like fflush, timing foreground threads
+	Parameters:     FILE *file:  The file to flush
+	Returns:        int:  Zero on success, as fflush
+*/
+int scheduledFlush(FILE *file) {
+
+	// Background flushes are paced by their callers, who know how much is dirty
+	if (ioClass == DB_IO_BACKGROUND || activeScheduler == NULL) {
+		return fflush(file);
+	}
+
+	LARGE_INTEGER begin;
+	QueryPerformanceCounter(&begin);
+
+	int result = fflush(file);
+
+	AcquireSRWLockShared(&schedulerLock);
+	if (activeScheduler != NULL) {
+		noteForeground(activeScheduler, begin.QuadPart, 0);
+	}
+	ReleaseSRWLockShared(&schedulerLock);
+
+	return result;
+}
@@ -0,0 +1,252 @@
+
+#include "extra.h"
+#include "scrubber.h"
+#include "record.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+
+
+// A struct to store the state of the scrubber thread
+struct DBScrubber {
+
+	// A private read-only handle, so scrubbing never moves the server's file position
+	FILE *file;
+
+	// The scrub rate in bytes per second
+	volatile LONG64 rate;
+
+	SRWLOCK lock;
+	DBScrubStats stats;
+
+	HANDLE thread;
+	HANDLE stopEvent;
+};
+
+
+// Prototypes for scrubbing
+bool scrubSlot(DBScrubber *, DBRecordSlot *, DBIndex);
+DWORD WINAPI scrubberThread(LPVOID);
+
+
+
+/*	Name:           scrubSlot
+	Description:    Verifies a slot, re-reading it once to rule out a write in flight
+	Parameters:     DBScrubber *scrubber:  The scrubber reading the slot
+	                DBRecordSlot *slot:  The slot as first read
+	                DBIndex memberId:  The memberId the slot is stored at
+	Returns:        bool:  Whether the slot is intact
+*/
+bool scrubSlot(DBScrubber *scrubber, DBRecordSlot *slot, DBIndex memberId) {
+
+	if (verifyRecordSlot(slot, memberId) == DB_SUCCESS) {
+		return true;
+	}
+
+	// The server may have been part way through rewriting the slot
+	long resume = ftell(scrubber->file);
+	Sleep(1);
+
+	bool intact = fseek(scrubber->file, (long)(memberId - DB_MIN_ENTRY) * DB_SLOT_SIZE, SEEK_SET) == 0
+		&& scheduledRead(slot, DB_SLOT_SIZE, 1, scrubber->file) == 1
+		&& verifyRecordSlot(slot, memberId) == DB_SUCCESS;
+
+	fseek(scrubber->file, resume, SEEK_SET);
+
+	return intact;
+}
+
+
+/*	Name:           scrubberThread
+	Description:    Repeatedly verifies every slot in the file at the configured rate
+	Parameters:     LPVOID param:  The scrubber
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI scrubberThread(LPVOID param) {
+
+	DBScrubber *scrubber = param;
+
+	// Scrubbing is maintenance, so it gives way to requests
+	setIOClass(DB_IO_BACKGROUND);
+
+	DBRecordSlot *block = malloc(sizeof(DBRecordSlot) * DB_SCRUB_BLOCK_SLOTS);
+	if (block == NULL) {
+		return 1;
+	}
+
+	// Bytes read beyond the configured rate, in byte-milliseconds, carried across blocks so
+	// blocks too small to pause after on their own still add up to a pause
+	int64_t debt = 0;
+	ULONG64 last = GetTickCount64();
+
+	DWORD pause = 0;
+	while (WaitForSingleObject(scrubber->stopEvent, pause) == WAIT_TIMEOUT) {
+
+		// Time spent sleeping, reading or resting pays the debt off at the current rate, and a
+		// timer that oversleeps leaves a little credit, bounded so a long rest allows only a short burst
+		LONG64 rate = scrubber->rate;
+		int64_t perSecond = (rate > 0) ? rate : 1;
+		ULONG64 now = GetTickCount64();
+		debt -= (int64_t)(now - last) * perSecond;
+		if (debt < -2 * DB_SCRUB_MIN_PAUSE_MS * perSecond) {
+			debt = -2 * DB_SCRUB_MIN_PAUSE_MS * perSecond;
+		}
+		last = now;
+
+		// Pick up slots appended by the server since the last block
+		clearerr(scrubber->file);
+
+		// A slot only partly appended when last read leaves the position unaligned
+		long pos = ftell(scrubber->file);
+		if (pos % DB_SLOT_SIZE != 0) {
+			pos -= pos % DB_SLOT_SIZE;
+			fseek(scrubber->file, pos, SEEK_SET);
+		}
+
+		size_t count = scheduledRead(block, DB_SLOT_SIZE, DB_SCRUB_BLOCK_SLOTS, scrubber->file);
+
+		// Start the next pass after a rest once the end of the file is reached
+		if (count == 0) {
+			AcquireSRWLockExclusive(&scrubber->lock);
+			++scrubber->stats.passes;
+			ReleaseSRWLockExclusive(&scrubber->lock);
+
+			fseek(scrubber->file, 0, SEEK_SET);
+			pause = DB_SCRUB_PASS_INTERVAL_MS;
+			continue;
+		}
+
+		DBIndex first = (DBIndex)(pos / DB_SLOT_SIZE + DB_MIN_ENTRY);
+		uint64_t corrupt = 0;
+		DBIndex lastCorrupt = 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			if (!scrubSlot(scrubber, &block[i], (DBIndex)(first + i))) {
+				++corrupt;
+				lastCorrupt = (DBIndex)(first + i);
+			}
+		}
+
+		AcquireSRWLockExclusive(&scrubber->lock);
+		scrubber->stats.slotsChecked += count;
+		scrubber->stats.corruptSlots += corrupt;
+		if (lastCorrupt != 0) {
+			scrubber->stats.lastCorrupt = lastCorrupt;
+		}
+		ReleaseSRWLockExclusive(&scrubber->lock);
+
+		// Sleep long enough to hold the configured byte rate, in steps the system timer can honour
+		debt += (int64_t)count * DB_SLOT_SIZE * 1000;
+		int64_t owed = debt / perSecond;
+		pause = (owed >= DB_SCRUB_MIN_PAUSE_MS) ? (DWORD)owed : 0;
+	}
+
+	free(block);
+
+	return 0;
+}
+
+
+/*	Name:           startScrubber
+	Description:    Starts verifying the checksums of a database file in the background
+	Parameters:     char *path:  The path of the database file
+	                size_t rate:  The scrub rate in bytes per second
+	                DBScrubber **scrubber:  The started scrubber
+	Returns:        DBCode:  A return status code
+*/
+DBCode startScrubber(const char *path, size_t rate, DBScrubber **scrubber) {
+
+	// Establish function preconditions
+	assert_assume(path != NULL);
+	assert_assume(rate != 0);
+	assert_assume(scrubber != NULL);
+
+	DBScrubber *temp = calloc(1, sizeof(DBScrubber));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+	temp->rate = (LONG64)rate;
+
+	temp->file = fopen(path, "rb");
+	if (temp->file == NULL) {
+		free(temp);
+		return DB_FILE_ERROR;
+	}
+
+	temp->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (temp->stopEvent == NULL) {
+		fclose(temp->file);
+		free(temp);
+		return DB_REQUEST_DENIED;
+	}
+
+	temp->thread = CreateThread(NULL, 0, scrubberThread, temp, 0, NULL);
+	if (temp->thread == NULL) {
+		CloseHandle(temp->stopEvent);
+		fclose(temp->file);
+		free(temp);
+		return DB_REQUEST_DENIED;
+	}
+
+	*scrubber = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopScrubber
+	Description:    Stops the scrubber thread and frees the scrubber
+	Parameters:     DBScrubber *scrubber:  The scrubber to stop
+	Returns:        void
+*/
+void stopScrubber(DBScrubber *scrubber) {
+
+	if (scrubber == NULL) {
+		return;
+	}
+
+	SetEvent(scrubber->stopEvent);
+	WaitForSingleObject(scrubber->thread, INFINITE);
+
+	CloseHandle(scrubber->thread);
+	CloseHandle(scrubber->stopEvent);
+	fclose(scrubber->file);
+
+	free(scrubber);
+}
+
+
+/*	Name:           setScrubberRate
+	Description:    Changes the scrub rate, taking effect from the next block
+	Parameters:     DBScrubber *scrubber:  The scrubber to change
+	                size_t rate:  The scrub rate in bytes per second
+	Returns:        void
+*/
+void setScrubberRate(DBScrubber *scrubber, size_t rate) {
+
+	// Establish function preconditions
+	assert_assume(scrubber != NULL);
+	assert_assume(rate != 0);
+
+	InterlockedExchange64(&scrubber->rate, (LONG64)rate);
+}
+
+
+/*	Name:           readScrubberStats
+	Description:    Reads the results of scrubbing so far
+	Parameters:     DBScrubber *scrubber:  The scrubber to read
+	                DBScrubStats *stats:  The results read
+	Returns:        void
+*/
+void readScrubberStats(DBScrubber *scrubber, DBScrubStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(scrubber != NULL);
+	assert_assume(stats != NULL);
+
+	AcquireSRWLockShared(&scrubber->lock);
+	*stats = scrubber->stats;
+	ReleaseSRWLockShared(&scrubber->lock);
+}
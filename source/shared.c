@@ -0,0 +1,649 @@
+
+#include "extra.h"
+#include "shared.h"
+#include "storage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Identifies a mapping created by a compatible server
+#define DB_SHARED_MAGIC  ((uint32_t)0x4442'5348)
+
+// The maximum length of a mapping or event name
+#define DB_SHARED_NAME_SIZE  256
+
+
+// A single-producer single-consumer ring of frames
+typedef struct DBRing {
+
+	// The producer and consumer positions are kept on separate cache lines
+	align_as(64) volatile LONG head;
+	align_as(64) volatile LONG tail;
+
+	align_as(64) DBSharedFrame frames[DB_SHARED_RING_FRAMES];
+} DBRing;
+
+
+// A struct to store the rings owned by one attached client
+typedef struct DBSharedChannel {
+
+	align_as(64) volatile LONG attached;
+
+	// The process id of the attached client, so the server can reclaim the channel if it exits
+	volatile LONG process;
+
+	// Set by the client before it sleeps on its response event
+	volatile LONG sleeping;
+
+	DBRing requests;
+	DBRing responses;
+} DBSharedChannel;
+
+
+// The layout of the shared mapping
+typedef struct DBSharedRegion {
+
+	uint32_t magic;
+	uint32_t size;
+	volatile LONG running;
+
+	// Set by the server before it sleeps on the request event
+	align_as(64) volatile LONG sleeping;
+
+	DBSharedChannel channels[DB_SHARED_MAX_CLIENTS];
+} DBSharedRegion;
+
+
+// A struct to store the state of the shared memory server
+struct DBSharedServer {
+
+	DBContext *context;
+	unsigned spin;
+
+	HANDLE mapping;
+	DBSharedRegion *region;
+
+	HANDLE requestEvent;
+	HANDLE responseEvents[DB_SHARED_MAX_CLIENTS];
+
+	// A handle to the process attached to each channel, which also keeps its id from being reused
+	HANDLE owners[DB_SHARED_MAX_CLIENTS];
+	DWORD ownerIds[DB_SHARED_MAX_CLIENTS];
+
+	HANDLE thread;
+	volatile LONG stopping;
+};
+
+
+// A struct to store the state of an attached client
+struct DBSharedClient {
+
+	unsigned spin;
+
+	HANDLE mapping;
+	DBSharedRegion *region;
+	DBSharedChannel *channel;
+
+	HANDLE requestEvent;
+	HANDLE responseEvent;
+};
+
+
+// Prototypes for moving frames through the rings
+bool pushFrame(DBRing *, const DBSharedFrame *);
+bool popFrame(DBRing *, DBSharedFrame *);
+bool ringFull(const DBRing *);
+
+// Prototypes for serving requests
+bool sharedName(char *, const char *, const char *, int);
+void handleSharedFrame(DBContext *, DBSharedFrame *);
+void reclaimChannels(DBSharedServer *);
+DWORD WINAPI sharedServerThread(LPVOID);
+DBCode waitForResponse(DBSharedClient *, DBSharedFrame *);
+
+
+
+/*	Name:           pushFrame
+	Description:    Appends a frame to a ring from its only producer
+	Parameters:     DBRing *ring:  The ring to append to
+	                DBSharedFrame *frame:  The frame to append
+	Returns:        bool:  Whether there was room for the frame
+*/
+bool pushFrame(DBRing *ring, const DBSharedFrame *frame) {
+
+	// Volatile reads have acquire semantics under MSVC
+	LONG head = ring->head;
+	if (ringFull(ring)) {
+		return false;
+	}
+
+	ring->frames[(ULONG)head % DB_SHARED_RING_FRAMES] = *frame;
+
+	// Publish the frame with a full barrier, ordering it before the sleeping flag is read
+	InterlockedExchange(&ring->head, (LONG)((ULONG)head + 1));
+
+	return true;
+}
+
+
+/*	Name:           popFrame
+	Description:    Removes a frame from a ring from its only consumer
+	Parameters:     DBRing *ring:  The ring to remove from
+	                DBSharedFrame *frame:  The removed frame
+	Returns:        bool:  Whether a frame was available
+*/
+bool popFrame(DBRing *ring, DBSharedFrame *frame) {
+
+	LONG tail = ring->tail;
+	if (ring->head == tail) {
+		return false;
+	}
+
+	*frame = ring->frames[(ULONG)tail % DB_SHARED_RING_FRAMES];
+
+	// Release the frame back to the producer
+	InterlockedExchange(&ring->tail, (LONG)((ULONG)tail + 1));
+
+	return true;
+}
+
+
+/*	Name:           ringFull
+	Description:    Checks whether a ring has no room for another frame
+	Parameters:     DBRing *ring:  The ring to check
+	Returns:        bool:  Whether the ring is full
+*/
+bool ringFull(const DBRing *ring) {
+	return (ULONG)ring->head - (ULONG)ring->tail == DB_SHARED_RING_FRAMES;
+}
+
+
+/*	Name:           sharedName
+	Description:    Builds the name of a kernel object belonging to a shared memory server
+	Parameters:     char *buffer:  The buffer of DB_SHARED_NAME_SIZE to write to
+	                char *name:  The name of the server mapping
+	                char *suffix:  The object suffix, or NULL for the mapping itself
+	                int index:  The client channel index, or -1
+	Returns:        bool:  Whether the name fit in the buffer
+*/
+bool sharedName(char *buffer, const char *name, const char *suffix, int index) {
+
+	int length;
+	if (suffix == NULL) {
+		length = snprintf(buffer, DB_SHARED_NAME_SIZE, "%s", name);
+	}
+	else if (index < 0) {
+		length = snprintf(buffer, DB_SHARED_NAME_SIZE, "%s.%s", name, suffix);
+	}
+	else {
+		length = snprintf(buffer, DB_SHARED_NAME_SIZE, "%s.%s.%d", name, suffix, index);
+	}
+
+	return 0 <= length && length < DB_SHARED_NAME_SIZE;
+}
+
+
+/*	Name:           handleSharedFrame
+	Description:    Handles one request frame, replacing its code with the result status
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                DBSharedFrame *frame:  The request frame
+	Returns:        void
+*/
+void handleSharedFrame(DBContext *context, DBSharedFrame *frame) {
+
+	DBCode status;
+	switch (frame->code) {
+	case DB_REQUEST_INSERT:
+		status = insertRecord(context, &frame->record);
+		break;
+
+	case DB_REQUEST_UPDATE:
+		status = updateRecord(context, &frame->record);
+		break;
+
+	case DB_REQUEST_FIND:
+		status = findRecord(context, &frame->record);
+		break;
+
+	case DB_REQUEST_QUERY:
+		status = countRecords(context, &frame->entries);
+		break;
+
+	// Streaming requests are only served over sockets
+	default:
+		status = DB_REQUEST_DENIED;
+		break;
+	}
+
+	frame->code = status;
+}
+
+
+/*	Name:           reclaimChannels
+	Description:    Frees the channels of clients whose process exited without detaching
+	Parameters:     DBSharedServer *server:  The shared memory server
+	Returns:        void
+*/
+void reclaimChannels(DBSharedServer *server) {
+
+	DBSharedRegion *region = server->region;
+
+	for (int i = 0; i < DB_SHARED_MAX_CLIENTS; ++i) {
+
+		DBSharedChannel *channel = &region->channels[i];
+		DWORD process = channel->attached ? (DWORD)channel->process : 0;
+
+		// Track the process now attached, dropping the handle of one that detached
+		if (process != server->ownerIds[i]) {
+			if (server->owners[i] != NULL) {
+				CloseHandle(server->owners[i]);
+				server->owners[i] = NULL;
+			}
+			server->ownerIds[i] = process;
+			if (process != 0) {
+				server->owners[i] = OpenProcess(SYNCHRONIZE, FALSE, process);
+			}
+		}
+
+		// A client that cannot be opened has already exited
+		if (process == 0
+			|| (server->owners[i] != NULL && WaitForSingleObject(server->owners[i], 0) != WAIT_OBJECT_0)) {
+			continue;
+		}
+
+		// Only this thread touches the rings of a dead client, so they can be emptied in place
+		channel->requests.tail = channel->requests.head;
+		channel->responses.head = channel->responses.tail;
+		channel->sleeping = 0;
+		channel->process = 0;
+		InterlockedExchange(&channel->attached, 0);
+
+		if (server->owners[i] != NULL) {
+			CloseHandle(server->owners[i]);
+			server->owners[i] = NULL;
+		}
+		server->ownerIds[i] = 0;
+	}
+}
+
+
+/*	Name:           sharedServerThread
+	Description:    Drains every client's request ring, polling before sleeping when idle
+	Parameters:     LPVOID param:  The shared memory server
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI sharedServerThread(LPVOID param) {
+
+	DBSharedServer *server = param;
+	DBSharedRegion *region = server->region;
+
+	unsigned idle = 0;
+	ULONG64 nextReclaim = 0;
+	while (!server->stopping) {
+
+		if (GetTickCount64() >= nextReclaim) {
+			reclaimChannels(server);
+			nextReclaim = GetTickCount64() + DB_SHARED_LIVENESS_MS;
+		}
+
+		bool worked = false;
+		for (int i = 0; i < DB_SHARED_MAX_CLIENTS; ++i) {
+
+			DBSharedChannel *channel = &region->channels[i];
+
+			// A request is only taken once its response has room, so a client that stops reading stalls only itself
+			bool answered = false;
+			DBSharedFrame frame;
+			while (!ringFull(&channel->responses) && popFrame(&channel->requests, &frame)) {
+				handleSharedFrame(server->context, &frame);
+				pushFrame(&channel->responses, &frame);
+				answered = true;
+			}
+
+			if (answered) {
+				if (channel->sleeping) {
+					SetEvent(server->responseEvents[i]);
+				}
+				worked = true;
+			}
+		}
+
+		if (worked) {
+			idle = 0;
+			continue;
+		}
+
+		// Busy-poll for a while, since a sleeping server costs the client a system call
+		if (idle < server->spin) {
+			++idle;
+			YieldProcessor();
+			continue;
+		}
+
+		// Announce the sleep, then look once more so a request published meanwhile is not missed
+		InterlockedExchange(&region->sleeping, 1);
+
+		bool pending = false;
+		for (int i = 0; i < DB_SHARED_MAX_CLIENTS; ++i) {
+			if (region->channels[i].requests.head != region->channels[i].requests.tail) {
+				pending = true;
+			}
+		}
+		// Wake periodically to reclaim the channels of clients that exited
+		if (!pending && !server->stopping) {
+			WaitForSingleObject(server->requestEvent, DB_SHARED_LIVENESS_MS);
+		}
+
+		InterlockedExchange(&region->sleeping, 0);
+		idle = 0;
+	}
+
+	return 0;
+}
+
+
+/*	Name:           startSharedServer
+	Description:    Creates a named shared memory region and starts serving requests from it
+	Parameters:     char *name:  The name of the mapping, such as "Local\\c-database"
+	                DBContext *context:  The database to serve, versioned if also served elsewhere
+	                unsigned spin:  The number of idle polls before sleeping
+	                DBSharedServer **server:  The started server
+	Returns:        DBCode:  A return status code
+*/
+DBCode startSharedServer(const char *name, DBContext *context, unsigned spin, DBSharedServer **server) {
+
+	// Establish function preconditions
+	assert_assume(name != NULL);
+	assert_assume(context != NULL);
+	assert_assume(server != NULL);
+
+	DBSharedServer *temp = calloc(1, sizeof(DBSharedServer));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	temp->context = context;
+	temp->spin = spin;
+
+	char buffer[DB_SHARED_NAME_SIZE];
+	bool created = sharedName(buffer, name, NULL, -1);
+	if (created) {
+		temp->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(DBSharedRegion), buffer);
+
+		// Refuse to take over a region another server is using
+		if (temp->mapping != NULL && GetLastError() == ERROR_ALREADY_EXISTS) {
+			CloseHandle(temp->mapping);
+			temp->mapping = NULL;
+		}
+		created = temp->mapping != NULL;
+	}
+	if (created) {
+		temp->region = MapViewOfFile(temp->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(DBSharedRegion));
+		created = temp->region != NULL;
+	}
+	if (created) {
+		created = sharedName(buffer, name, "request", -1)
+			&& (temp->requestEvent = CreateEventA(NULL, FALSE, FALSE, buffer)) != NULL;
+	}
+	for (int i = 0; created && i < DB_SHARED_MAX_CLIENTS; ++i) {
+		created = sharedName(buffer, name, "response", i)
+			&& (temp->responseEvents[i] = CreateEventA(NULL, FALSE, FALSE, buffer)) != NULL;
+	}
+
+	if (created) {
+
+		// The mapping is zero filled, so every ring starts empty and every channel free
+		temp->region->magic = DB_SHARED_MAGIC;
+		temp->region->size = sizeof(DBSharedRegion);
+		InterlockedExchange(&temp->region->running, 1);
+
+		temp->thread = CreateThread(NULL, 0, sharedServerThread, temp, 0, NULL);
+		created = temp->thread != NULL;
+	}
+
+	if (!created) {
+		temp->thread = NULL;
+		stopSharedServer(temp);
+		return DB_SOCKET_ERROR;
+	}
+
+	*server = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopSharedServer
+	Description:    Stops serving requests and releases the shared memory region
+	Parameters:     DBSharedServer *server:  The server to stop
+	Returns:        void
+*/
+void stopSharedServer(DBSharedServer *server) {
+
+	if (server == NULL) {
+		return;
+	}
+
+	// Attached clients see the server go away the next time they wait
+	if (server->region != NULL) {
+		InterlockedExchange(&server->region->running, 0);
+	}
+
+	if (server->thread != NULL) {
+		InterlockedExchange(&server->stopping, 1);
+		SetEvent(server->requestEvent);
+		WaitForSingleObject(server->thread, INFINITE);
+		CloseHandle(server->thread);
+	}
+
+	for (int i = 0; i < DB_SHARED_MAX_CLIENTS; ++i) {
+		if (server->responseEvents[i] != NULL) {
+			SetEvent(server->responseEvents[i]);
+			CloseHandle(server->responseEvents[i]);
+		}
+		if (server->owners[i] != NULL) {
+			CloseHandle(server->owners[i]);
+		}
+	}
+
+	if (server->requestEvent != NULL) {
+		CloseHandle(server->requestEvent);
+	}
+	if (server->region != NULL) {
+		UnmapViewOfFile(server->region);
+	}
+	if (server->mapping != NULL) {
+		CloseHandle(server->mapping);
+	}
+
+	free(server);
+}
+
+
+/*	Name:           openSharedClient
+	Description:    Attaches to a running shared memory server, claiming a free channel
+	Parameters:     char *name:  The name of the server mapping
+	                unsigned spin:  The number of polls for a response before sleeping
+	                DBSharedClient **client:  The attached client
+	Returns:        DBCode:  A return status code
+*/
+DBCode openSharedClient(const char *name, unsigned spin, DBSharedClient **client) {
+
+	// Establish function preconditions
+	assert_assume(name != NULL);
+	assert_assume(client != NULL);
+
+	DBSharedClient *temp = calloc(1, sizeof(DBSharedClient));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	temp->spin = spin;
+
+	char buffer[DB_SHARED_NAME_SIZE];
+	bool opened = sharedName(buffer, name, NULL, -1)
+		&& (temp->mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, buffer)) != NULL
+		&& (temp->region = MapViewOfFile(temp->mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(DBSharedRegion))) != NULL;
+
+	// Validate that the server was built with the same layout
+	if (opened) {
+		opened = temp->region->magic == DB_SHARED_MAGIC
+			&& temp->region->size == sizeof(DBSharedRegion)
+			&& temp->region->running;
+	}
+
+	int index = -1;
+	for (int i = 0; opened && i < DB_SHARED_MAX_CLIENTS; ++i) {
+		if (InterlockedCompareExchange(&temp->region->channels[i].attached, 1, 0) == 0) {
+			index = i;
+			break;
+		}
+	}
+
+	if (index >= 0) {
+		temp->channel = &temp->region->channels[index];
+		InterlockedExchange(&temp->channel->process, (LONG)GetCurrentProcessId());
+
+		opened = sharedName(buffer, name, "request", -1)
+			&& (temp->requestEvent = OpenEventA(EVENT_MODIFY_STATE, FALSE, buffer)) != NULL
+			&& sharedName(buffer, name, "response", index)
+			&& (temp->responseEvent = OpenEventA(SYNCHRONIZE, FALSE, buffer)) != NULL;
+	}
+	else {
+		opened = false;
+	}
+
+	if (!opened) {
+		closeSharedClient(temp);
+		return DB_SOCKET_ERROR;
+	}
+
+	*client = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           closeSharedClient
+	Description:    Detaches from a shared memory server, freeing the client's channel
+	Parameters:     DBSharedClient *client:  The client to detach
+	Returns:        void
+*/
+void closeSharedClient(DBSharedClient *client) {
+
+	if (client == NULL) {
+		return;
+	}
+
+	// Every request has been answered, so the rings are empty for the next client
+	if (client->channel != NULL) {
+		InterlockedExchange(&client->channel->process, 0);
+		InterlockedExchange(&client->channel->attached, 0);
+	}
+
+	if (client->responseEvent != NULL) {
+		CloseHandle(client->responseEvent);
+	}
+	if (client->requestEvent != NULL) {
+		CloseHandle(client->requestEvent);
+	}
+	if (client->region != NULL) {
+		UnmapViewOfFile(client->region);
+	}
+	if (client->mapping != NULL) {
+		CloseHandle(client->mapping);
+	}
+
+	free(client);
+}
+
+
+/*	Name:           waitForResponse
+	Description:    Takes the next response, polling before sleeping on the response event
+	Parameters:     DBSharedClient *client:  The client waiting
+	                DBSharedFrame *frame:  The response
+	Returns:        DBCode:  A return status code
+*/
+DBCode waitForResponse(DBSharedClient *client, DBSharedFrame *frame) {
+
+	DBRing *ring = &client->channel->responses;
+
+	for (unsigned i = 0; i < client->spin; ++i) {
+		if (popFrame(ring, frame)) {
+			return DB_SUCCESS;
+		}
+		YieldProcessor();
+	}
+
+	for (;;) {
+
+		// Announce the sleep, then look once more so a response published meanwhile is not missed
+		InterlockedExchange(&client->channel->sleeping, 1);
+
+		bool ready = popFrame(ring, frame);
+		if (!ready && client->region->running) {
+			WaitForSingleObject(client->responseEvent, DB_SHARED_LIVENESS_MS);
+		}
+
+		InterlockedExchange(&client->channel->sleeping, 0);
+
+		if (ready || popFrame(ring, frame)) {
+			return DB_SUCCESS;
+		}
+		if (!client->region->running) {
+			return DB_SOCKET_ERROR;
+		}
+	}
+}
+
+
+/*	Name:           sendSharedRequests
+	Description:    Sends a batch of requests over shared memory, pipelining up to a ring of them
+	Parameters:     DBSharedClient *client:  The client to send with
+	                DBSharedFrame *frames:  The requests, each replaced by its response
+	                size_t count:  The number of requests
+	Returns:        DBCode:  A return status code for the transport, with request results in each frame
+*/
+DBCode sendSharedRequests(DBSharedClient *client, DBSharedFrame *frames, size_t count) {
+
+	// Establish function preconditions
+	assert_assume(client != NULL && client->channel != NULL);
+	assert_assume(frames != NULL || count == 0);
+
+	DBSharedChannel *channel = client->channel;
+
+	size_t sent = 0;
+	size_t received = 0;
+	while (received < count) {
+
+		// Keep the request ring full so the server can drain the batch without sleeping
+		size_t queued = sent;
+		while (sent < count && sent - received < DB_SHARED_RING_FRAMES && pushFrame(&channel->requests, &frames[sent])) {
+			++sent;
+		}
+		if (sent != queued && client->region->sleeping) {
+			SetEvent(client->requestEvent);
+		}
+
+		// Responses arrive in request order
+		CONDITIONAL_RETURN(waitForResponse(client, &frames[received]));
+		++received;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendSharedRequest
+	Description:    Sends one request over shared memory
+	Parameters:     DBSharedClient *client:  The client to send with
+	                DBSharedFrame *frame:  The request, replaced by its response
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendSharedRequest(DBSharedClient *client, DBSharedFrame *frame) {
+
+	CONDITIONAL_RETURN(sendSharedRequests(client, frame, 1));
+
+	return frame->code;
+}
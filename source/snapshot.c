@@ -0,0 +1,656 @@
+
+#include "extra.h"
+#include "snapshot.h"
+#include "changes.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+
+
+// A struct to store the before-image of a record overwritten by a commit
+typedef struct DBVersion {
+
+	// The commit that replaced this image; snapshots older than it still see it
+	DBSequence sequence;
+
+	DBRecord record;
+
+	// The next older version of the same record
+	struct DBVersion *older;
+} DBVersion;
+
+
+// A struct to store the versioning state shared by all connections
+struct DBVersionStore {
+
+	// Serializes commits and all access to the database file position
+	SRWLOCK lock;
+
+	// The sequence of the most recently applied commit
+	DBSequence committed;
+
+	// Whether a commit is currently open
+	bool committing;
+
+	// The list of pinned snapshots, oldest first
+	DBSnapshot *oldest;
+	DBSnapshot *newest;
+
+	// The newest version of each record, indexed by memberId
+	DBVersion *chains[DB_MAX_ENTRY + 1];
+
+	// The number of retained versions
+	size_t versions;
+
+	// Receives every record written by a commit, when attached
+	DBChangeLog *changes;
+
+	// The background reclaimer thread and its stop signal
+	HANDLE reclaimer;
+	HANDLE stopEvent;
+};
+
+
+/*	Name:           createVersionStore
+	Description:    Allocates an empty version store
+	Parameters:     DBVersionStore **store:  The created store
+	Returns:        DBCode:  A return status code
+*/
+DBCode createVersionStore(DBVersionStore **store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	DBVersionStore *temp = calloc(1, sizeof(DBVersionStore));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+
+	*store = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           destroyVersionStore
+	Description:    Stops the reclaimer and frees every retained version
+	Parameters:     DBVersionStore *store:  The store to destroy
+	Returns:        void
+*/
+void destroyVersionStore(DBVersionStore *store) {
+
+	if (store == NULL) {
+		return;
+	}
+
+	stopVersionReclaimer(store);
+
+	// Snapshots must not outlive the store
+	assert(store->oldest == NULL);
+
+	for (size_t i = 0; i <= DB_MAX_ENTRY; ++i) {
+		DBVersion *version = store->chains[i];
+		while (version != NULL) {
+			DBVersion *older = version->older;
+			free(version);
+			version = older;
+		}
+	}
+
+	free(store);
+}
+
+
+/*	Name:           beginSnapshot
+	Description:    Pins a consistent view of the current database contents
+	Parameters:     DBVersionStore *store:  The store to pin the snapshot in
+	                DBIndex *entries:  The live number of entries in the database
+	                DBSnapshot *snapshot:  The snapshot to pin
+	Returns:        DBCode:  A return status code
+*/
+DBCode beginSnapshot(DBVersionStore *store, const DBIndex *entries, DBSnapshot *snapshot) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(entries != NULL);
+	assert_assume(snapshot != NULL);
+
+	AcquireSRWLockExclusive(&store->lock);
+
+	snapshot->sequence = store->committed;
+	snapshot->entries = *entries;
+
+	// Append the snapshot so the list stays ordered by sequence
+	snapshot->next = NULL;
+	snapshot->prev = store->newest;
+	if (store->newest != NULL) {
+		store->newest->next = snapshot;
+	}
+	else {
+		store->oldest = snapshot;
+	}
+	store->newest = snapshot;
+
+	ReleaseSRWLockExclusive(&store->lock);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           endSnapshot
+	Description:    Releases a pinned snapshot so its versions can be reclaimed
+	Parameters:     DBVersionStore *store:  The store the snapshot was pinned in
+	                DBSnapshot *snapshot:  The snapshot to release
+	Returns:        void
+*/
+void endSnapshot(DBVersionStore *store, DBSnapshot *snapshot) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(snapshot != NULL);
+
+	AcquireSRWLockExclusive(&store->lock);
+
+	if (snapshot->prev != NULL) {
+		snapshot->prev->next = snapshot->next;
+	}
+	else {
+		store->oldest = snapshot->next;
+	}
+	if (snapshot->next != NULL) {
+		snapshot->next->prev = snapshot->prev;
+	}
+	else {
+		store->newest = snapshot->prev;
+	}
+
+	snapshot->prev = NULL;
+	snapshot->next = NULL;
+
+	ReleaseSRWLockExclusive(&store->lock);
+}
+
+
+/*	Name:           readSnapshotRecord
+	Description:    Reads a record as it was when the snapshot was pinned
+	Parameters:     DBVersionStore *store:  The store the snapshot was pinned in
+	                FILE *file:  The database file to read from
+	                DBSnapshot *snapshot:  The snapshot to read through
+	                DBRecord *record:  The record to read, selected by memberId
+	Returns:        DBCode:  A return status code
+*/
+DBCode readSnapshotRecord(DBVersionStore *store, FILE *file, const DBSnapshot *snapshot, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(file != NULL);
+	assert_assume(snapshot != NULL);
+	assert_assume(record != NULL);
+
+	DBIndex memberId = record->memberId;
+
+	// Records inserted after the snapshot was pinned are invisible
+	if (memberId < DB_MIN_ENTRY || memberId > snapshot->entries) {
+		return DB_REQUEST_DENIED;
+	}
+
+	AcquireSRWLockShared(&store->lock);
+
+	// Find the oldest image replaced after the snapshot was pinned
+	const DBVersion *visible = NULL;
+	for (const DBVersion *version = store->chains[memberId];
+		version != NULL && version->sequence > snapshot->sequence;
+		version = version->older) {
+		visible = version;
+	}
+
+	if (visible != NULL) {
+		*record = visible->record;
+		ReleaseSRWLockShared(&store->lock);
+		return DB_SUCCESS;
+	}
+
+	ReleaseSRWLockShared(&store->lock);
+
+	// The file still holds the visible image; the file position needs exclusive access
+	AcquireSRWLockExclusive(&store->lock);
+
+	DBCode status = seekRecord(file, memberId);
+	if (status == DB_SUCCESS) {
+		status = readRecord(file, record);
+	}
+
+	// A commit may have landed between the two lock acquisitions
+	if (status == DB_SUCCESS) {
+		for (const DBVersion *version = store->chains[memberId];
+			version != NULL && version->sequence > snapshot->sequence;
+			version = version->older) {
+			*record = version->record;
+		}
+	}
+
+	ReleaseSRWLockExclusive(&store->lock);
+
+	return status;
+}
+
+
+/*	Name:           readSnapshotSlots
+	Description:    Reads a block of raw slots as they were when the snapshot was pinned
+	Parameters:     DBVersionStore *store:  The store the snapshot was pinned in
+	                FILE *file:  The database file to read from
+	                DBSnapshot *snapshot:  The snapshot to read through
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots to read
+	                DBRecordSlot *slots:  The slots read
+	Returns:        DBCode:  A return status code
+*/
+DBCode readSnapshotSlots(DBVersionStore *store, FILE *file, const DBSnapshot *snapshot, DBIndex first, size_t count, DBRecordSlot *slots) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(file != NULL);
+	assert_assume(snapshot != NULL);
+	assert_assume(slots != NULL);
+
+	// Slots inserted after the snapshot was pinned are invisible
+	if (first < DB_MIN_ENTRY || first - DB_MIN_ENTRY + count > snapshot->entries) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// One lock hold covers the whole block, so writers wait for at most one read
+	AcquireSRWLockExclusive(&store->lock);
+
+	DBCode status = seekRecord(file, first);
+	if (status == DB_SUCCESS && scheduledRead(slots, DB_SLOT_SIZE, count, file) != count) {
+		status = DB_FILE_ERROR;
+	}
+
+	// Replace slots overwritten since the snapshot with their visible versions
+	for (size_t i = 0; status == DB_SUCCESS && store->versions != 0 && i < count; ++i) {
+
+		const DBVersion *visible = NULL;
+		for (const DBVersion *version = store->chains[first + i];
+			version != NULL && version->sequence > snapshot->sequence;
+			version = version->older) {
+			visible = version;
+		}
+
+		if (visible != NULL) {
+			encodeRecordSlot(&visible->record, &slots[i]);
+		}
+	}
+
+	ReleaseSRWLockExclusive(&store->lock);
+
+	return status;
+}
+
+
+/*	Name:           beginCommit
+	Description:    Opens a commit, excluding other writers until endCommit
+	Parameters:     DBVersionStore *store:  The store to commit to
+	Returns:        void
+*/
+void beginCommit(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	AcquireSRWLockExclusive(&store->lock);
+
+	assert(!store->committing);
+	store->committing = true;
+}
+
+
+/*	Name:           preserveRecord
+	Description:    Keeps the current image of a record for snapshots before the open commit overwrites it
+	Parameters:     DBVersionStore *store:  The store holding the open commit
+	                FILE *file:  The database file holding the record
+	                DBIndex memberId:  The memberId of the record about to be written
+	                DBIndex entries:  The number of entries in the database
+	Returns:        DBCode:  A return status code
+*/
+DBCode preserveRecord(DBVersionStore *store, FILE *file, DBIndex memberId, DBIndex entries) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(file != NULL);
+	assert_assume(store->committing);
+	assert_assume(DB_MIN_ENTRY <= memberId && memberId <= entries + 1);
+
+	// Preserve the current image only if a pinned snapshot could still read it
+	if (store->oldest == NULL || memberId > entries) {
+		return DB_SUCCESS;
+	}
+
+	DBVersion *version = malloc(sizeof(DBVersion));
+	if (version == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBCode status = seekRecord(file, memberId);
+	if (status == DB_SUCCESS) {
+		status = readRecord(file, &version->record);
+	}
+	if (status != DB_SUCCESS) {
+		free(version);
+		return status;
+	}
+
+	// The image stays visible to every snapshot pinned before this commit
+	version->sequence = store->committed + 1;
+	version->older = store->chains[memberId];
+	store->chains[memberId] = version;
+	++store->versions;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           commitRecord
+	Description:    Writes a record as part of the open commit, keeping the old image for snapshots
+	Parameters:     DBVersionStore *store:  The store holding the open commit
+	                FILE *file:  The database file to write to
+	                DBRecord *record:  The record to write
+	                DBIndex entries:  The number of entries in the database
+	Returns:        DBCode:  A return status code
+*/
+DBCode commitRecord(DBVersionStore *store, FILE *file, const DBRecord *record, DBIndex entries) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(file != NULL);
+	assert_assume(record != NULL);
+	assert_assume(store->committing);
+	assert_assume(DB_MIN_ENTRY <= record->memberId && record->memberId <= entries + 1);
+
+	CONDITIONAL_RETURN(preserveRecord(store, file, record->memberId, entries));
+
+	// Seek the file to the correct position
+	CONDITIONAL_RETURN(seekRecord(file, record->memberId));
+
+	// Write the record to the file
+	CONDITIONAL_RETURN(writeRecord(file, record));
+
+	logCommitRecord(store, record, entries);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           endCommit
+	Description:    Flushes the open commit and publishes it to new snapshots
+	Parameters:     DBVersionStore *store:  The store holding the open commit
+	                FILE *file:  The database file written by the commit
+	Returns:        DBCode:  A return status code
+*/
+DBCode endCommit(DBVersionStore *store, FILE *file) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(file != NULL);
+	assert_assume(store->committing);
+
+	DBCode status = DB_SUCCESS;
+
+	// One flush covers every record written by the commit
+	if (scheduledFlush(file) != 0) {
+		status = DB_FILE_ERROR;
+	}
+
+	++store->committed;
+	store->committing = false;
+
+	// Subscribers only ever see whole commits
+	if (store->changes != NULL) {
+		publishChanges(store->changes, store->committed);
+	}
+
+	ReleaseSRWLockExclusive(&store->lock);
+
+	return status;
+}
+
+
+/*	Name:           attachChangeLog
+	Description:    Records every record written by later commits in a change log
+	Parameters:     DBVersionStore *store:  The store to attach to
+	                DBChangeLog *log:  The log to record changes in, or NULL to detach
+	Returns:        void
+*/
+void attachChangeLog(DBVersionStore *store, DBChangeLog *log) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	AcquireSRWLockExclusive(&store->lock);
+	store->changes = log;
+	ReleaseSRWLockExclusive(&store->lock);
+}
+
+
+/*	Name:           readChangeLog
+	Description:    Reads the change log attached to a store
+	Parameters:     DBVersionStore *store:  The store to read
+	Returns:        DBChangeLog *:  The attached log, or NULL
+*/
+DBChangeLog *readChangeLog(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	AcquireSRWLockShared(&store->lock);
+	DBChangeLog *log = store->changes;
+	ReleaseSRWLockShared(&store->lock);
+
+	return log;
+}
+
+
+/*	Name:           logCommitRecord
+	Description:    Records a record written by the open commit in the attached change log
+	Parameters:     DBVersionStore *store:  The store holding the open commit
+	                DBRecord *record:  The record as written
+	                DBIndex entries:  The number of entries before the record was written
+	Returns:        void
+*/
+void logCommitRecord(DBVersionStore *store, const DBRecord *record, DBIndex entries) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(record != NULL);
+	assert_assume(store->committing);
+
+	if (store->changes != NULL) {
+		DBChangeKind kind = (record->memberId <= entries) ? DB_CHANGE_UPDATE : DB_CHANGE_INSERT;
+		appendChange(store->changes, store->committed + 1, kind, record);
+	}
+}
+
+
+/*	Name:           readCommitSequence
+	Description:    Reads the sequence of the most recently applied commit
+	Parameters:     DBVersionStore *store:  The store to read
+	Returns:        DBSequence:  The commit sequence
+*/
+DBSequence readCommitSequence(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	AcquireSRWLockShared(&store->lock);
+	DBSequence sequence = store->committed;
+	ReleaseSRWLockShared(&store->lock);
+
+	return sequence;
+}
+
+
+/*	Name:           restoreCommitSequence
+	Description:    Continues commit numbering from a sequence saved before a restart
+	Parameters:     DBVersionStore *store:  The store to restore
+	                DBSequence sequence:  The saved commit sequence
+	Returns:        void
+*/
+void restoreCommitSequence(DBVersionStore *store, DBSequence sequence) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	AcquireSRWLockExclusive(&store->lock);
+
+	// Sequences only move forward
+	if (sequence > store->committed) {
+		store->committed = sequence;
+	}
+
+	ReleaseSRWLockExclusive(&store->lock);
+}
+
+
+/*	Name:           lockVersionStore
+	Description:    Acquires exclusive access to the database file outside of a commit
+	Parameters:     DBVersionStore *store:  The store to lock
+	Returns:        void
+*/
+void lockVersionStore(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	AcquireSRWLockExclusive(&store->lock);
+}
+
+
+/*	Name:           unlockVersionStore
+	Description:    Releases access acquired with lockVersionStore
+	Parameters:     DBVersionStore *store:  The store to unlock
+	Returns:        void
+*/
+void unlockVersionStore(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	ReleaseSRWLockExclusive(&store->lock);
+}
+
+
+/*	Name:           reclaimVersions
+	Description:    Frees every version that no pinned snapshot can see
+	Parameters:     DBVersionStore *store:  The store to reclaim from
+	Returns:        size_t:  The number of versions freed
+*/
+size_t reclaimVersions(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	size_t freed = 0;
+
+	AcquireSRWLockExclusive(&store->lock);
+
+	if (store->versions != 0) {
+
+		// A version is needed only by snapshots pinned before its commit
+		DBSequence horizon = (store->oldest != NULL) ? store->oldest->sequence : store->committed;
+
+		for (size_t i = DB_MIN_ENTRY; i <= DB_MAX_ENTRY; ++i) {
+
+			// Chains are newest first, so everything past the first unneeded version goes too
+			DBVersion **link = &store->chains[i];
+			while (*link != NULL && (*link)->sequence > horizon) {
+				link = &(*link)->older;
+			}
+
+			DBVersion *version = *link;
+			*link = NULL;
+
+			while (version != NULL) {
+				DBVersion *older = version->older;
+				free(version);
+				version = older;
+				++freed;
+			}
+		}
+
+		store->versions -= freed;
+	}
+
+	ReleaseSRWLockExclusive(&store->lock);
+
+	return freed;
+}
+
+
+/*	Name:           reclaimerThread
+	Description:    Periodically reclaims versions until signalled to stop
+	Parameters:     LPVOID param:  The store to reclaim from
+	Returns:        DWORD:  The thread exit code
+*/
+static DWORD WINAPI reclaimerThread(LPVOID param) {
+
+	DBVersionStore *store = param;
+
+	while (WaitForSingleObject(store->stopEvent, DB_RECLAIM_INTERVAL_MS) == WAIT_TIMEOUT) {
+		reclaimVersions(store);
+	}
+
+	return 0;
+}
+
+
+/*	Name:           startVersionReclaimer
+	Description:    Starts the background thread that frees unreachable versions
+	Parameters:     DBVersionStore *store:  The store to reclaim from
+	Returns:        DBCode:  A return status code
+*/
+DBCode startVersionReclaimer(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+	assert_assume(store->reclaimer == NULL);
+
+	store->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (store->stopEvent == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	store->reclaimer = CreateThread(NULL, 0, reclaimerThread, store, 0, NULL);
+	if (store->reclaimer == NULL) {
+		CloseHandle(store->stopEvent);
+		store->stopEvent = NULL;
+		return DB_REQUEST_DENIED;
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopVersionReclaimer
+	Description:    Signals the reclaimer thread to stop and waits for it
+	Parameters:     DBVersionStore *store:  The store being reclaimed
+	Returns:        void
+*/
+void stopVersionReclaimer(DBVersionStore *store) {
+
+	// Establish function preconditions
+	assert_assume(store != NULL);
+
+	if (store->reclaimer == NULL) {
+		return;
+	}
+
+	SetEvent(store->stopEvent);
+	WaitForSingleObject(store->reclaimer, INFINITE);
+
+	CloseHandle(store->reclaimer);
+	CloseHandle(store->stopEvent);
+
+	store->reclaimer = NULL;
+	store->stopEvent = NULL;
+}
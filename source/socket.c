@@ -2,11 +2,43 @@
 #include "extra.h"
 #include "socket.h"
 
+#include <stddef.h>
 #include <string.h>
 
 
 SOCKET createServer(const char *serverName) {
 
+	SOCKET ListenSocket = createListener(serverName);
+	if (ListenSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+
+	// Accept a client socket
+	SOCKET ClientSocket = accept(ListenSocket, NULL, NULL);
+	if (ClientSocket == INVALID_SOCKET) {
+
+		closesocket(ListenSocket);
+
+		return INVALID_SOCKET;
+	}
+
+	// No longer need server socket
+	closesocket(ListenSocket);
+
+	// Fail a stalled send rather than blocking forever, while idle clients may wait to send
+	if (!setSocketTimeouts(ClientSocket, 0, DEFAULT_SEND_TIMEOUT_MS)) {
+
+		closesocket(ClientSocket);
+
+		return INVALID_SOCKET;
+	}
+
+	return ClientSocket;
+}
+
+
+SOCKET createListener(const char *serverName) {
+
 	struct addrinfo hints;
 
 	memset(&hints, 0, sizeof(hints));
@@ -42,25 +74,13 @@ SOCKET createServer(const char *serverName) {
 
 	freeaddrinfo(address);
 
-	if (listen(ListenSocket, SOMAXCONN) == SOCKET_ERROR) {
+	if (listen(ListenSocket, DEFAULT_BACKLOG) == SOCKET_ERROR) {
 
 		closesocket(ListenSocket);
 		return INVALID_SOCKET;
 	}
 
-	// Accept a client socket
-	SOCKET ClientSocket = accept(ListenSocket, NULL, NULL);
-	if (ClientSocket == INVALID_SOCKET) {
-
-		closesocket(ListenSocket);
-
-		return INVALID_SOCKET;
-	}
-
-	// No longer need server socket
-	closesocket(ListenSocket);
-
-	return ClientSocket;
+	return ListenSocket;
 }
 
 
@@ -107,3 +127,121 @@ SOCKET createClient(const char *serverName) {
 
 	return ConnectSocket;
 }
+
+
+bool setSocketTimeouts(SOCKET socket, DWORD receive, DWORD send) {
+
+	assert_assume(socket != INVALID_SOCKET);
+
+	// A value of 0 blocks without a limit
+	return setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char *)&receive, sizeof(receive)) != SOCKET_ERROR
+		&& setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&send, sizeof(send)) != SOCKET_ERROR;
+}
+
+
+bool unixAddress(const char *path, struct sockaddr_un *address, int *length) {
+
+	assert_assume(path != NULL);
+	assert_assume(address != NULL && length != NULL);
+
+	// Abstract names are marked by a leading '@' and bound with a leading null instead
+	size_t size = strlen(path);
+	if (size == 0 || size >= sizeof(address->sun_path)) {
+		return false;
+	}
+
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	memcpy(address->sun_path, path, size);
+
+	if (path[0] == '@') {
+		address->sun_path[0] = '\0';
+		*length = (int)(offsetof(struct sockaddr_un, sun_path) + size);
+	}
+	else {
+		*length = (int)sizeof(*address);
+	}
+
+	return true;
+}
+
+
+SOCKET createUnixListener(const char *path) {
+
+	struct sockaddr_un address;
+	int length;
+	if (!unixAddress(path, &address, &length)) {
+		return INVALID_SOCKET;
+	}
+
+	SOCKET ListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ListenSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+
+	// A socket file left behind by a server that did not shut down cleanly would fail the bind
+	if (path[0] != '@' && staleUnixSocket(path)) {
+		DeleteFileA(path);
+	}
+
+	if (bind(ListenSocket, (struct sockaddr *)&address, length) == SOCKET_ERROR
+		|| listen(ListenSocket, DEFAULT_BACKLOG) == SOCKET_ERROR) {
+
+		closesocket(ListenSocket);
+		return INVALID_SOCKET;
+	}
+
+	return ListenSocket;
+}
+
+
+bool staleUnixSocket(const char *path) {
+
+	assert_assume(path != NULL);
+
+	// Any other file at the path is left alone, so the bind fails instead of deleting it
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(path, &data);
+	if (find == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	FindClose(find);
+
+	if ((data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0
+		|| data.dwReserved0 != IO_REPARSE_TAG_AF_UNIX) {
+		return false;
+	}
+
+	// A socket that still accepts connections belongs to a running server
+	SOCKET probe = createUnixClient(path);
+	if (probe != INVALID_SOCKET) {
+		closesocket(probe);
+		return false;
+	}
+
+	return true;
+}
+
+
+SOCKET createUnixClient(const char *path) {
+
+	struct sockaddr_un address;
+	int length;
+	if (!unixAddress(path, &address, &length)) {
+		return INVALID_SOCKET;
+	}
+
+	SOCKET ConnectSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (ConnectSocket == INVALID_SOCKET) {
+		return INVALID_SOCKET;
+	}
+
+	// Connect to server
+	if (connect(ConnectSocket, (struct sockaddr *)&address, length) == SOCKET_ERROR) {
+
+		closesocket(ConnectSocket);
+		return INVALID_SOCKET;
+	}
+
+	return ConnectSocket;
+}
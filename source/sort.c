@@ -0,0 +1,622 @@
+
+#include "extra.h"
+#include "sort.h"
+#include "scan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// A struct to store one sorted run and its position in the merge
+typedef struct DBSortRun {
+
+	DBSortKey key;
+
+	// The run while it is in memory, then the merge read buffer once spilled
+	DBRecord *records;
+	size_t count;
+
+	// The temporary file holding a spilled run, or NULL for a run kept in memory
+	bool spill;
+	FILE *file;
+
+	HANDLE thread;
+	DBCode status;
+
+	// The buffered records and the records still in the file
+	size_t buffered;
+	size_t next;
+	size_t remaining;
+} DBSortRun;
+
+
+// A struct to store the state of a sorted scan
+struct DBSortedScan {
+
+	DBSortKey key;
+	size_t threads;
+
+	// The records collected for the next run
+	DBRecord *current;
+	size_t filled;
+	size_t runRecords;
+
+	// The runs created, of which those below joined have finished sorting
+	DBSortRun *runs;
+	size_t runCount;
+	size_t runCapacity;
+	size_t joined;
+
+	DBIndex total;
+
+	// A binary min-heap of the runs with records left to merge
+	size_t *heap;
+	size_t heapSize;
+};
+
+
+// Prototypes for sorting runs
+int compareRecords(const DBRecord *, const DBRecord *, DBSortKey);
+int compareByName(const void *, const void *);
+int compareByBirthDate(const void *, const void *);
+FILE *openSpillFile(void);
+DWORD WINAPI sortRunThread(LPVOID);
+DBCode startRun(DBSortedScan *, bool);
+DBCode joinRun(DBSortRun *);
+DBCode collectBlock(const DBRecordSlot *, DBIndex, size_t, void *);
+
+// Prototypes for merging runs
+DBCode fillRun(DBSortRun *);
+bool runPrecedes(const DBSortedScan *, size_t, size_t);
+void siftDown(DBSortedScan *, size_t);
+DBCode sendSortedRecord(const DBRecord *, void *);
+
+
+
+/*	Name:           compareRecords
+	Description:    Orders two records by a sort key, breaking ties by memberId
+	Parameters:     DBRecord *a:  The first record
+	                DBRecord *b:  The second record
+	                DBSortKey key:  The order to compare in
+	Returns:        int:  Negative, zero or positive as a sorts before, with or after b
+*/
+int compareRecords(const DBRecord *a, const DBRecord *b, DBSortKey key) {
+
+	int order = 0;
+
+	if (key == DB_SORT_NAME) {
+		order = strncmp(a->lastName, b->lastName, DB_RECORD_NAME_SIZE);
+		if (order == 0) {
+			order = strncmp(a->firstName, b->firstName, DB_RECORD_NAME_SIZE);
+		}
+	}
+	else {
+		order = (int)a->birthDate.year - (int)b->birthDate.year;
+		if (order == 0) {
+			order = (int)a->birthDate.month - (int)b->birthDate.month;
+		}
+		if (order == 0) {
+			order = (int)a->birthDate.day - (int)b->birthDate.day;
+		}
+	}
+
+	if (order == 0) {
+		order = (int)a->memberId - (int)b->memberId;
+	}
+
+	return order;
+}
+
+
+/*	Name:           compareByName
+	Description:    Orders two records by lastName then firstName for qsort
+	Parameters:     void *a:  The first record
+	                void *b:  The second record
+	Returns:        int:  The ordering of the records
+*/
+int compareByName(const void *a, const void *b) {
+	return compareRecords(a, b, DB_SORT_NAME);
+}
+
+
+/*	Name:           compareByBirthDate
+	Description:    Orders two records by birthDate for qsort
+	Parameters:     void *a:  The first record
+	                void *b:  The second record
+	Returns:        int:  The ordering of the records
+*/
+int compareByBirthDate(const void *a, const void *b) {
+	return compareRecords(a, b, DB_SORT_BIRTH_DATE);
+}
+
+
+/*	Name:           openSpillFile
+	Description:    Opens a temporary file that is deleted when it is closed
+	Parameters:     void
+	Returns:        FILE *:  The open file, or NULL
+*/
+FILE *openSpillFile(void) {
+
+	char directory[MAX_PATH];
+	char path[MAX_PATH];
+
+	DWORD length = GetTempPathA(MAX_PATH, directory);
+	if (length == 0 || length > MAX_PATH) {
+		return NULL;
+	}
+	if (GetTempFileNameA(directory, "cdb", 0, path) == 0) {
+		return NULL;
+	}
+
+	// Keep the file in the cache where possible and delete it when closed
+	return fopen(path, "w+bTD");
+}
+
+
+/*	Name:           sortRunThread
+	Description:    Sorts one run and spills it to a temporary file if requested
+	Parameters:     LPVOID param:  The run to sort
+	Returns:        DWORD:  The thread exit code
+*/
+DWORD WINAPI sortRunThread(LPVOID param) {
+
+	DBSortRun *run = param;
+
+	qsort(run->records, run->count, sizeof(DBRecord), (run->key == DB_SORT_NAME) ? compareByName : compareByBirthDate);
+
+	run->status = DB_SUCCESS;
+	if (run->spill) {
+
+		run->file = openSpillFile();
+		if (run->file == NULL
+			|| fwrite(run->records, sizeof(DBRecord), run->count, run->file) != run->count
+			|| fseek(run->file, 0, SEEK_SET) != 0) {
+			run->status = DB_FILE_ERROR;
+		}
+
+		// The spilled run no longer counts against the memory budget
+		free(run->records);
+		run->records = NULL;
+	}
+
+	return 0;
+}
+
+
+/*	Name:           startRun
+	Description:    Hands the collected records to a thread to be sorted as a run
+	Parameters:     DBSortedScan *scan:  The sorted scan
+	                bool spill:  Whether the run should be spilled, as more records will follow
+	Returns:        DBCode:  A return status code
+*/
+DBCode startRun(DBSortedScan *scan, bool spill) {
+
+	// Establish function preconditions
+	assert_assume(scan->runCount < scan->runCapacity);
+
+	// Bound the memory in use by waiting for the oldest run once every thread is busy
+	while (scan->runCount - scan->joined >= scan->threads) {
+		CONDITIONAL_RETURN(joinRun(&scan->runs[scan->joined++]));
+	}
+
+	DBSortRun *run = &scan->runs[scan->runCount++];
+	run->key = scan->key;
+	run->records = scan->current;
+	run->count = scan->filled;
+	run->spill = spill;
+	run->status = DB_FILE_ERROR;
+
+	scan->total += (DBIndex)scan->filled;
+	scan->current = NULL;
+	scan->filled = 0;
+
+	// Sort on the calling thread if no thread can be started
+	run->thread = CreateThread(NULL, 0, sortRunThread, run, 0, NULL);
+	if (run->thread == NULL) {
+		sortRunThread(run);
+	}
+
+	if (spill) {
+		scan->current = malloc(sizeof(DBRecord) * scan->runRecords);
+		if (scan->current == NULL) {
+			return DB_REQUEST_DENIED;
+		}
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           joinRun
+	Description:    Waits for a run to finish sorting
+	Parameters:     DBSortRun *run:  The run to wait for
+	Returns:        DBCode:  The status of the run
+*/
+DBCode joinRun(DBSortRun *run) {
+
+	if (run->thread != NULL) {
+		WaitForSingleObject(run->thread, INFINITE);
+		CloseHandle(run->thread);
+		run->thread = NULL;
+	}
+
+	return run->status;
+}
+
+
+/*	Name:           collectBlock
+	Description:    Decodes a block of slots into the current run, starting a new run when it is full
+	Parameters:     DBRecordSlot *slots:  The block of slots
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots
+	                void *user:  The sorted scan
+	Returns:        DBCode:  A return status code
+*/
+DBCode collectBlock(const DBRecordSlot *slots, DBIndex first, size_t count, void *user) {
+
+	DBSortedScan *scan = user;
+
+	for (size_t i = 0; i < count; ++i) {
+
+		decodeRecordSlot(&slots[i], (DBIndex)(first + i), &scan->current[scan->filled++]);
+
+		if (scan->filled == scan->runRecords) {
+			CONDITIONAL_RETURN(startRun(scan, true));
+		}
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           fillRun
+	Description:    Reads the next records of a spilled run into its merge buffer
+	Parameters:     DBSortRun *run:  The run to read
+	Returns:        DBCode:  A return status code
+*/
+DBCode fillRun(DBSortRun *run) {
+
+	size_t count = (run->remaining < DB_SORT_READ_RECORDS) ? run->remaining : DB_SORT_READ_RECORDS;
+
+	if (count != 0 && fread(run->records, sizeof(DBRecord), count, run->file) != count) {
+		return DB_FILE_ERROR;
+	}
+
+	run->buffered = count;
+	run->next = 0;
+	run->remaining -= count;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           runPrecedes
+	Description:    Compares the next records of two runs in the merge
+	Parameters:     DBSortedScan *scan:  The sorted scan
+	                size_t a:  The index of the first run
+	                size_t b:  The index of the second run
+	Returns:        bool:  Whether the first run's next record sorts first
+*/
+bool runPrecedes(const DBSortedScan *scan, size_t a, size_t b) {
+
+	const DBSortRun *x = &scan->runs[a];
+	const DBSortRun *y = &scan->runs[b];
+
+	return compareRecords(&x->records[x->next], &y->records[y->next], scan->key) < 0;
+}
+
+
+/*	Name:           siftDown
+	Description:    Restores the heap order below a position
+	Parameters:     DBSortedScan *scan:  The sorted scan
+	                size_t i:  The position to sift down from
+	Returns:        void
+*/
+void siftDown(DBSortedScan *scan, size_t i) {
+
+	for (;;) {
+
+		size_t smallest = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+
+		if (left < scan->heapSize && runPrecedes(scan, scan->heap[left], scan->heap[smallest])) {
+			smallest = left;
+		}
+		if (right < scan->heapSize && runPrecedes(scan, scan->heap[right], scan->heap[smallest])) {
+			smallest = right;
+		}
+		if (smallest == i) {
+			return;
+		}
+
+		size_t temp = scan->heap[i];
+		scan->heap[i] = scan->heap[smallest];
+		scan->heap[smallest] = temp;
+		i = smallest;
+	}
+}
+
+
+/*	Name:           beginSortedScan
+	Description:    Sorts a consistent view of the database into runs, spilling those beyond the memory budget
+	Parameters:     DBContext *context:  The database to sort
+	                DBSortKey key:  The order to sort in
+	                DBSortedScan **scan:  The sorted scan, ready to be read
+	                DBIndex *entries:  The number of records the scan will return
+	Returns:        DBCode:  A return status code
+*/
+DBCode beginSortedScan(DBContext *context, DBSortKey key, DBSortedScan **scan, DBIndex *entries) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL);
+	assert_assume(key < DB_SORT_KINDS);
+	assert_assume(scan != NULL);
+	assert_assume(entries != NULL);
+
+	DBSortedScan *temp = calloc(1, sizeof(DBSortedScan));
+	if (temp == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	temp->threads = info.dwNumberOfProcessors;
+	if (temp->threads > DB_SORT_MAX_THREADS) {
+		temp->threads = DB_SORT_MAX_THREADS;
+	}
+	if (temp->threads == 0) {
+		temp->threads = 1;
+	}
+
+	// The runs being sorted and the one being collected share the budget
+	temp->key = key;
+	temp->runRecords = DB_SORT_MEMORY_BUDGET / sizeof(DBRecord) / (temp->threads + 1);
+	temp->runCapacity = DB_MAX_ENTRY / temp->runRecords + 2;
+
+	temp->current = malloc(sizeof(DBRecord) * temp->runRecords);
+	temp->runs = calloc(temp->runCapacity, sizeof(DBSortRun));
+	temp->heap = malloc(sizeof(size_t) * temp->runCapacity);
+
+	DBCode status = DB_SUCCESS;
+	if (temp->current == NULL || temp->runs == NULL || temp->heap == NULL) {
+		status = DB_REQUEST_DENIED;
+	}
+
+	// Sort full runs while the scan continues, keeping the final run in memory
+	if (status == DB_SUCCESS) {
+		status = scanSlots(context, collectBlock, temp);
+	}
+	if (status == DB_SUCCESS) {
+		status = startRun(temp, false);
+	}
+
+	while (temp->joined < temp->runCount) {
+		DBCode result = joinRun(&temp->runs[temp->joined++]);
+		if (status == DB_SUCCESS) {
+			status = result;
+		}
+	}
+
+	// Prepare each run for the merge
+	for (size_t i = 0; status == DB_SUCCESS && i < temp->runCount; ++i) {
+
+		DBSortRun *run = &temp->runs[i];
+		if (run->spill) {
+			run->remaining = run->count;
+			run->records = malloc(sizeof(DBRecord) * DB_SORT_READ_RECORDS);
+			status = (run->records != NULL) ? fillRun(run) : DB_REQUEST_DENIED;
+		}
+		else {
+			run->buffered = run->count;
+			run->next = 0;
+		}
+
+		if (status == DB_SUCCESS && run->buffered != 0) {
+			temp->heap[temp->heapSize++] = i;
+		}
+	}
+
+	if (status != DB_SUCCESS) {
+		endSortedScan(temp);
+		return status;
+	}
+
+	for (size_t i = temp->heapSize / 2; i-- > 0;) {
+		siftDown(temp, i);
+	}
+
+	*scan = temp;
+	*entries = temp->total;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           readSortedScan
+	Description:    Merges the sorted runs, passing every record to a callback in order
+	Parameters:     DBSortedScan *scan:  The sorted scan to read once
+	                DBRecordCallback callback:  The function to pass each record to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode readSortedScan(DBSortedScan *scan, DBRecordCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(scan != NULL);
+	assert_assume(callback != NULL);
+
+	while (scan->heapSize != 0) {
+
+		DBSortRun *run = &scan->runs[scan->heap[0]];
+		CONDITIONAL_RETURN(callback(&run->records[run->next], user));
+
+		// Refill a spilled run, and drop a run from the heap once it is exhausted
+		if (++run->next == run->buffered && run->remaining != 0) {
+			CONDITIONAL_RETURN(fillRun(run));
+		}
+		if (run->next == run->buffered) {
+			scan->heap[0] = scan->heap[--scan->heapSize];
+		}
+
+		siftDown(scan, 0);
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           endSortedScan
+	Description:    Releases a sorted scan and deletes its temporary files
+	Parameters:     DBSortedScan *scan:  The sorted scan to release
+	Returns:        void
+*/
+void endSortedScan(DBSortedScan *scan) {
+
+	if (scan == NULL) {
+		return;
+	}
+
+	for (size_t i = 0; i < scan->runCount; ++i) {
+		DBSortRun *run = &scan->runs[i];
+		joinRun(run);
+		if (run->file != NULL) {
+			fclose(run->file);
+		}
+		free(run->records);
+	}
+
+	free(scan->current);
+	free(scan->runs);
+	free(scan->heap);
+	free(scan);
+}
+
+
+/*	Name:           sendSortedRecord
+	Description:    Sends one record of an ordered export, preceded by its read status
+	Parameters:     DBRecord *record:  The record to send
+	                void *user:  The socket to send the record to
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendSortedRecord(const DBRecord *record, void *user) {
+	CONDITIONAL_RETURN(sendCode(*(SOCKET *)user, DB_SUCCESS));
+	return sendRecord(*(SOCKET *)user, record, true);
+}
+
+
+/*	Name:           handleSortedExportRequest
+	Description:    Handles a database ordered export request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleSortedExportRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send a confirmation code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Receive the order to sort by
+	DBCode key;
+	CONDITIONAL_RETURN(receiveCode(socket, &key));
+	if (key >= DB_SORT_KINDS) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Sort before replying, so the number of records is known
+	DBSortedScan *scan;
+	DBIndex entries;
+	CONDITIONAL_RETURN(beginSortedScan(context, (DBSortKey)key, &scan, &entries));
+
+	// Send a confirmation code and the number of records, then stream the merge
+	DBCode status = sendCode(socket, DB_REQUEST_SUCCESS);
+	if (status == DB_SUCCESS) {
+		status = sendIndex(socket, entries);
+	}
+	if (status == DB_SUCCESS) {
+		status = readSortedScan(scan, sendSortedRecord, &socket);
+	}
+
+	// A spilled run only fails to refill with records still to come, so the failure ends the export in place of the next one
+	if (status != DB_SUCCESS && status != DB_SOCKET_ERROR) {
+		status = sendCode(socket, status);
+	}
+
+	endSortedScan(scan);
+
+	CONDITIONAL_RETURN(status);
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	// A read failure was already sent in the stream, so it must not be sent again
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendSortedExportRequest
+	Description:    Sends a database ordered export request from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	                DBSortKey key:  The order to export in
+	                DBRecordCallback callback:  The function to pass each record to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendSortedExportRequest(SOCKET socket, DBSortKey key, DBRecordCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(key < DB_SORT_KINDS);
+	assert_assume(callback != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SORTED));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Send the order to sort by
+	CONDITIONAL_RETURN(sendCode(socket, (DBCode)key));
+
+	// Receive a confirmation code
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive the number of records in the export
+	DBIndex entries;
+	CONDITIONAL_RETURN(receiveIndex(socket, &entries));
+
+	// Receive every record, even after the callback stops, to keep the stream in sync
+	DBCode status = DB_SUCCESS;
+	for (DBIndex i = 0; i < entries; ++i) {
+
+		// A failed read on the server ends the export in place of the record
+		CONDITIONAL_RETURN(receiveCode(socket, &response));
+		if (response != DB_SUCCESS) {
+			status = response;
+			break;
+		}
+
+		DBRecord record;
+		CONDITIONAL_RETURN(receiveRecord(socket, &record, true));
+		if (status == DB_SUCCESS) {
+			status = callback(&record, user);
+		}
+	}
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_SUCCESS));
+
+	return status;
+}
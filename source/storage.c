@@ -0,0 +1,556 @@
+
+#include "extra.h"
+#include "storage.h"
+#include "snapshot.h"
+#include "changes.h"
+#include "metadata.h"
+#include "scan.h"
+#include "bufferpool.h"
+#include "trace.h"
+#include "fuzzy.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+// A struct to store the state of a record scan
+typedef struct DBRecordScan {
+	DBRecordCallback callback;
+	void *user;
+} DBRecordScan;
+
+
+// Prototypes for opening databases
+char *metadataPath(const char *);
+DBCode decodeBlock(const DBRecordSlot *, DBIndex, size_t, void *);
+
+
+
+/*	Name:           metadataPath
+	Description:    Builds the metadata file path of a database
+	Parameters:     char *path:  The database file path
+	Returns:        char *:  The allocated metadata path, or NULL
+*/
+char *metadataPath(const char *path) {
+
+	size_t length = strlen(path);
+
+	char *meta = malloc(length + sizeof(DB_METADATA_SUFFIX));
+	if (meta != NULL) {
+		memcpy(meta, path, length);
+		memcpy(meta + length, DB_METADATA_SUFFIX, sizeof(DB_METADATA_SUFFIX));
+	}
+
+	return meta;
+}
+
+
+/*	Name:           openDatabase
+	Description:    Opens a database file for direct in-process access
+	Parameters:     char *path:  The database file path
+	                unsigned flags:  DB_OPEN_CREATE, DB_OPEN_VERSIONED, DB_OPEN_CHANGES, DB_OPEN_POOL, DB_OPEN_LARGE_PAGES and DB_OPEN_NAMES
+	                DBContext **context:  The opened database
+	Returns:        DBCode:  A return status code
+*/
+DBCode openDatabase(const char *path, unsigned flags, DBContext **context) {
+
+	// Establish function preconditions
+	assert_assume(path != NULL);
+	assert_assume(context != NULL);
+
+	DBContext *temp = calloc(1, sizeof(DBContext));
+	DBMetadata *metadata = calloc(1, sizeof(DBMetadata));
+	char *meta = metadataPath(path);
+	size_t length = strlen(path);
+	char *copy = malloc(length + 1);
+
+	DBCode status = DB_SUCCESS;
+	if (temp == NULL || metadata == NULL || meta == NULL || copy == NULL) {
+		status = DB_REQUEST_DENIED;
+	}
+	else {
+		memcpy(copy, path, length + 1);
+		temp->path = copy;
+		temp->metadata = metadata;
+
+		temp->file = fopen(path, DB_STDIO_FILE_MODE);
+		if (temp->file == NULL && (flags & DB_OPEN_CREATE)) {
+			temp->file = fopen(path, "wb+");
+		}
+		if (temp->file == NULL) {
+			status = DB_FILE_ERROR;
+		}
+	}
+
+	// Restore the entry count in constant time after a clean shutdown
+	if (status == DB_SUCCESS) {
+		status = openMetadata(meta, path, temp->file, metadata);
+		temp->entries = metadata->entries;
+	}
+
+	if (status == DB_SUCCESS && (flags & DB_OPEN_VERSIONED)) {
+		status = createVersionStore(&temp->versions);
+		if (status == DB_SUCCESS) {
+			restoreCommitSequence(temp->versions, metadata->sequence);
+			status = startVersionReclaimer(temp->versions);
+		}
+	}
+
+	// Changes are recorded at commit, so a change log needs a version store
+	if (status == DB_SUCCESS && (flags & DB_OPEN_CHANGES)) {
+		DBChangeLog *changes = NULL;
+		status = (temp->versions != NULL)
+			? createChangeLog(metadata->sequence, DB_CHANGE_DEFAULT_CAPACITY, &changes)
+			: DB_REQUEST_DENIED;
+		if (status == DB_SUCCESS) {
+			attachChangeLog(temp->versions, changes);
+		}
+	}
+
+	// The pool starts with the pages that were resident at the last clean shutdown
+	if (status == DB_SUCCESS && (flags & DB_OPEN_POOL)) {
+		status = createBufferPool(DB_POOL_DEFAULT_PAGES, DB_EVICT_LRU2, (flags & DB_OPEN_LARGE_PAGES) != 0, &temp->pool);
+		if (status == DB_SUCCESS) {
+			status = warmBufferPool(temp, metadata->warm, metadata->warmCount);
+		}
+		if (status == DB_SUCCESS) {
+			status = startPoolFlusher(temp);
+		}
+	}
+
+	// Names are indexed from the file, so searches see every record from the start
+	if (status == DB_SUCCESS && (flags & DB_OPEN_NAMES)) {
+		status = createNameIndex(&temp->names);
+		if (status == DB_SUCCESS) {
+			status = buildNameIndex(temp);
+		}
+	}
+
+	free(meta);
+
+	if (status != DB_SUCCESS) {
+		if (temp != NULL) {
+			DBChangeLog *changes = (temp->versions != NULL) ? readChangeLog(temp->versions) : NULL;
+			destroyNameIndex(temp->names);
+			destroyBufferPool(temp->pool);
+			destroyVersionStore(temp->versions);
+			destroyChangeLog(changes);
+			if (temp->file != NULL) {
+				fclose(temp->file);
+			}
+		}
+		free(copy);
+		free(metadata);
+		free(temp);
+		return status;
+	}
+
+	*context = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           closeDatabase
+	Description:    Flushes and closes a database opened with openDatabase
+	Parameters:     DBContext *context:  The database to close
+	Returns:        DBCode:  A return status code, DB_REQUEST_DENIED with the database still open if a subscription would not end
+*/
+DBCode closeDatabase(DBContext *context) {
+
+	if (context == NULL) {
+		return DB_SUCCESS;
+	}
+
+	// Establish function preconditions
+	assert_assume(context->path != NULL && context->metadata != NULL);
+
+	// Subscriptions wait on the change log outside of any request, so end them before anything is freed
+	DBChangeLog *changes = NULL;
+	if (context->versions != NULL) {
+		changes = readChangeLog(context->versions);
+		closeChangeLog(changes);
+
+		// A subscriber stuck sending its acknowledgement keeps the database open rather than reading freed memory
+		if (!waitChangeReaders(changes, DB_CHANGE_CLOSE_TIMEOUT_MS)) {
+			return DB_REQUEST_DENIED;
+		}
+	}
+
+	DBMetadata *metadata = context->metadata;
+	metadata->entries = context->entries;
+
+	if (context->pool != NULL) {
+		stopPoolFlusher(context->pool);
+		metadata->warmCount = readPoolWarmSet(context->pool, metadata->warm, DB_METADATA_WARM_MAX);
+		destroyBufferPool(context->pool);
+	}
+
+	destroyNameIndex(context->names);
+
+	if (context->versions != NULL) {
+		metadata->sequence = readCommitSequence(context->versions);
+	}
+
+	destroyVersionStore(context->versions);
+	destroyChangeLog(changes);
+
+	// Only a fully flushed file may be recorded as cleanly shut down
+	DBCode status = DB_SUCCESS;
+	if (fclose(context->file) != 0) {
+		status = DB_FILE_ERROR;
+	}
+
+	char *meta = metadataPath(context->path);
+	if (meta == NULL) {
+		status = DB_REQUEST_DENIED;
+	}
+	else if (status == DB_SUCCESS) {
+		status = closeMetadata(meta, metadata);
+	}
+
+	free(meta);
+	free(context->path);
+	free(metadata);
+	free(context);
+
+	return status;
+}
+
+
+/*	Name:           insertRecord
+	Description:    Appends a record, assigning it the next memberId
+	Parameters:     DBContext *context:  The database to insert into
+	                DBRecord *record:  The record to insert, receiving its memberId
+	Returns:        DBCode:  A return status code
+*/
+DBCode insertRecord(DBContext *context, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(record != NULL);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	// Validate the record date
+	if (!validRecordDate(&record->birthDate)) {
+		return DB_REQUEST_DENIED;
+	}
+
+	if (context->versions != NULL) {
+
+		beginCommit(context->versions);
+
+		// Capacity is checked while other writers are excluded
+		DBCode status = DB_REQUEST_DENIED;
+		if (context->entries < DB_MAX_ENTRY) {
+			record->memberId = context->entries + 1;
+			status = commitRecord(context->versions, context->file, record, context->entries);
+			if (status == DB_SUCCESS) {
+				++context->entries;
+				noteRecordWrites(context, record, 1);
+			}
+		}
+
+		DBCode result = endCommit(context->versions, context->file);
+		CONDITIONAL_RETURN(status);
+		CONDITIONAL_RETURN(result);
+	}
+	else {
+
+		// Validate the database capacity
+		if (context->entries == DB_MAX_ENTRY) {
+			return DB_REQUEST_DENIED;
+		}
+
+		// Seek past the last entry, overwriting any torn tail left by a crash
+		record->memberId = context->entries + 1;
+		CONDITIONAL_RETURN(seekRecord(context->file, record->memberId));
+
+		// Write the record to the file
+		CONDITIONAL_RETURN(writeRecord(context->file, record));
+
+		// Increment the database entry count
+		++context->entries;
+
+		noteRecordWrites(context, record, 1);
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           appendRecords
+	Description:    Appends a block of records with one contiguous write, assigning consecutive memberIds
+	Parameters:     DBContext *context:  The database to append to
+	                DBRecord *records:  The records to append, whose memberIds are ignored
+	                DBIndex count:  The number of records
+	                DBIndex *first:  The memberId assigned to the first record
+	Returns:        DBCode:  A return status code
+*/
+DBCode appendRecords(DBContext *context, const DBRecord *records, DBIndex count, DBIndex *first) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(records != NULL || count == 0);
+	assert_assume(first != NULL);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	if (count == 0) {
+		*first = 0;
+		return DB_SUCCESS;
+	}
+
+	// Validate every date before anything is written, so the load stays all or nothing
+	for (DBIndex i = 0; i < count; ++i) {
+		if (!validRecordDate(&records[i].birthDate)) {
+			return DB_REQUEST_DENIED;
+		}
+	}
+
+	DBRecordSlot *slots = malloc(sizeof(DBRecordSlot) * count);
+	if (slots == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+
+	if (context->versions != NULL) {
+		beginCommit(context->versions);
+	}
+
+	// Capacity is checked while other writers are excluded, so the load is all or nothing
+	DBCode status = DB_REQUEST_DENIED;
+	if (count <= DB_MAX_ENTRY - context->entries) {
+
+		// The checksums are seeded with the memberIds, so slots are encoded once they are known
+		DBIndex base = context->entries + 1;
+		for (DBIndex i = 0; i < count; ++i) {
+			DBRecord record = records[i];
+			record.memberId = base + i;
+			encodeRecordSlot(&record, &slots[i]);
+		}
+
+		// New slots lie past every pinned snapshot, so no before-images are needed
+		status = seekRecord(context->file, base);
+		if (status == DB_SUCCESS && scheduledWrite(slots, DB_SLOT_SIZE, count, context->file) != count) {
+			status = DB_FILE_ERROR;
+		}
+
+		// Every appended record is its own insert in the change log
+		for (DBIndex i = 0; status == DB_SUCCESS && context->versions != NULL && i < count; ++i) {
+			DBRecord record = records[i];
+			record.memberId = base + i;
+			logCommitRecord(context->versions, &record, context->entries);
+		}
+
+		// Resident pages and indexes are extended while other writers are still excluded, the pages all at once
+		if (status == DB_SUCCESS && context->pool != NULL) {
+			writePoolSlots(context->pool, base, slots, count);
+		}
+		for (DBIndex i = 0; status == DB_SUCCESS && context->names != NULL && i < count; ++i) {
+			DBRecord record = records[i];
+			record.memberId = base + i;
+			indexRecordName(context->names, &record);
+		}
+
+		if (status == DB_SUCCESS) {
+			context->entries += count;
+			*first = base;
+		}
+	}
+
+	DBCode result = DB_SUCCESS;
+	if (context->versions != NULL) {
+		result = endCommit(context->versions, context->file);
+	}
+
+	free(slots);
+
+	CONDITIONAL_RETURN(status);
+	CONDITIONAL_RETURN(result);
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           updateRecord
+	Description:    Overwrites an existing record
+	Parameters:     DBContext *context:  The database to update
+	                DBRecord *record:  The record to write, selected by memberId
+	Returns:        DBCode:  A return status code
+*/
+DBCode updateRecord(DBContext *context, const DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(record != NULL);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	// Validate the record memberId
+	markTrace(DB_TRACE_VALIDATE);
+	if (record->memberId < DB_MIN_ENTRY) {
+		return DB_REQUEST_DENIED;
+	}
+	if (record->memberId > context->entries) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Validate the record date
+	if (!validRecordDate(&record->birthDate)) {
+		return DB_REQUEST_DENIED;
+	}
+
+	markTrace(DB_TRACE_IO);
+
+	if (context->versions != NULL) {
+
+		// Write a new version, keeping the old one for pinned snapshots
+		beginCommit(context->versions);
+		DBCode status = commitRecord(context->versions, context->file, record, context->entries);
+		if (status == DB_SUCCESS) {
+			noteRecordWrites(context, record, 1);
+		}
+		DBCode result = endCommit(context->versions, context->file);
+		CONDITIONAL_RETURN(status);
+		CONDITIONAL_RETURN(result);
+	}
+	else {
+
+		// Seek the file to the correct position
+		CONDITIONAL_RETURN(seekRecord(context->file, record->memberId));
+
+		// Write the record to the file
+		CONDITIONAL_RETURN(writeRecord(context->file, record));
+
+		noteRecordWrites(context, record, 1);
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           findRecord
+	Description:    Reads a record by memberId
+	Parameters:     DBContext *context:  The database to read from
+	                DBRecord *record:  The record to read, selected by memberId
+	Returns:        DBCode:  A return status code
+*/
+DBCode findRecord(DBContext *context, DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(record != NULL);
+	assert_assume(0 <= context->entries && context->entries <= DB_MAX_ENTRY);
+
+	// Validate the memberId
+	markTrace(DB_TRACE_VALIDATE);
+	if (record->memberId < DB_MIN_ENTRY) {
+		return DB_REQUEST_DENIED;
+	}
+	if (record->memberId > context->entries) {
+		return DB_REQUEST_DENIED;
+	}
+
+	markTrace(DB_TRACE_IO);
+
+	if (context->pool != NULL) {
+		return readPoolRecord(context, record);
+	}
+
+	// Serialize the seek and read against concurrent writers
+	if (context->versions != NULL) {
+		lockVersionStore(context->versions);
+	}
+
+	// Seek the file to the correct position and read the record
+	DBCode status = seekRecord(context->file, record->memberId);
+	if (status == DB_SUCCESS) {
+		status = readRecord(context->file, record);
+	}
+
+	if (context->versions != NULL) {
+		unlockVersionStore(context->versions);
+	}
+
+	return status;
+}
+
+
+/*	Name:           countRecords
+	Description:    Reads the number of records in the database
+	Parameters:     DBContext *context:  The database to count
+	                DBIndex *entries:  The number of records
+	Returns:        DBCode:  A return status code
+*/
+DBCode countRecords(DBContext *context, DBIndex *entries) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL);
+	assert_assume(entries != NULL);
+
+	*entries = context->entries;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           decodeBlock
+	Description:    Decodes a block of slots and passes each record to the scan callback
+	Parameters:     DBRecordSlot *slots:  The block of slots
+	                DBIndex first:  The memberId of the first slot
+	                size_t count:  The number of slots
+	                void *user:  The record scan state
+	Returns:        DBCode:  A return status code
+*/
+DBCode decodeBlock(const DBRecordSlot *slots, DBIndex first, size_t count, void *user) {
+
+	DBRecordScan *scan = user;
+
+	for (size_t i = 0; i < count; ++i) {
+		DBRecord record;
+		decodeRecordSlot(&slots[i], (DBIndex)(first + i), &record);
+		CONDITIONAL_RETURN(scan->callback(&record, scan->user));
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           scanRecords
+	Description:    Passes every record in a consistent view of the database to a callback
+	Parameters:     DBContext *context:  The database to scan
+	                DBRecordCallback callback:  The function to pass each record to
+	                void *user:  The user data passed to the callback
+	Returns:        DBCode:  A return status code
+*/
+DBCode scanRecords(DBContext *context, DBRecordCallback callback, void *user) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL);
+	assert_assume(callback != NULL);
+
+	DBRecordScan scan = { callback, user };
+
+	return scanSlots(context, decodeBlock, &scan);
+}
+
+
+/*	Name:           noteRecordWrites
+	Description:    Brings the buffer pool and name index up to date with the records written by a commit
+	Parameters:     DBContext *context:  The database written to
+	                DBRecord *records:  The records written, each selected by memberId
+	                size_t count:  The number of records
+	Returns:        void
+*/
+void noteRecordWrites(DBContext *context, const DBRecord *records, size_t count) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL);
+	assert_assume(records != NULL || count == 0);
+
+	if (context->pool != NULL) {
+		writePoolRecords(context->pool, records, count);
+	}
+	for (size_t i = 0; context->names != NULL && i < count; ++i) {
+		indexRecordName(context->names, &records[i]);
+	}
+}
@@ -0,0 +1,553 @@
+
+#include "extra.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+// Portable aligned allocation for per-thread rings
+#ifdef _MSC_VER
+#include <malloc.h>
+#define allocateAligned(size)  _aligned_malloc((size), 64)
+#define freeAligned(block)     _aligned_free(block)
+#else
+#define allocateAligned(size)  aligned_alloc(64, (size))
+#define freeAligned(block)     free(block)
+#endif
+
+
+// A struct to store the phases of one request
+typedef struct DBTraceRecord {
+
+	DBCode command;
+	DBCode status;
+	bool slow;
+
+	// Performance counter ticks at the start and end of the request
+	LONGLONG begin;
+	LONGLONG end;
+
+	// The phases entered, and the ticks at which each began
+	size_t count;
+	uint8_t phases[DB_TRACE_MAX_MARKS];
+	LONGLONG marks[DB_TRACE_MAX_MARKS];
+} DBTraceRecord;
+
+
+// A struct to store the finished requests of one thread, with the thread as its only producer
+typedef struct DBTraceRing {
+
+	align_as(64) volatile LONG head;
+	align_as(64) volatile LONG tail;
+
+	DWORD threadId;
+	struct DBTraceRing *next;
+
+	DBTraceRecord records[DB_TRACE_RING_SIZE];
+} DBTraceRing;
+
+
+// A struct to store the state of the process tracer
+struct DBTracer {
+
+	// Distinguishes this tracer from earlier ones in thread-local state
+	LONG generation;
+
+	// Guards the list of rings, one per thread that has kept a request
+	SRWLOCK lock;
+	DBTraceRing *rings;
+
+	FILE *file;
+	LONGLONG origin;
+	LONGLONG frequency;
+
+	volatile LONG64 sampled;
+	volatile LONG64 slow;
+	volatile LONG64 dropped;
+	uint64_t written;
+
+	// The background flusher thread and its stop signal
+	HANDLE flusher;
+	HANDLE stopEvent;
+};
+
+
+// A struct to store the request being traced on a thread
+typedef struct DBTraceScratch {
+
+	bool active;
+	DBTraceRecord record;
+
+	// Counts requests so one in every sampled interval is kept
+	unsigned counter;
+
+	// The thread's ring and the tracer it belongs to
+	DBTraceRing *ring;
+	LONG generation;
+} DBTraceScratch;
+
+
+// Prototypes for moving traced requests to the trace file
+bool pushTrace(DBTraceRing *, const DBTraceRecord *);
+bool popTrace(DBTraceRing *, DBTraceRecord *);
+DBTraceRing *bindTraceRing(DBTracer *);
+unsigned long long traceMicroseconds(const DBTracer *, LONGLONG);
+void writeTraceRecord(DBTracer *, DWORD, const DBTraceRecord *);
+void drainTraces(DBTracer *);
+const char *requestName(DBCode);
+static DWORD WINAPI flusherThread(LPVOID);
+
+
+
+// Tracing settings, published before the tracer and read without locking on every request
+static DBTracer *volatile activeTracer = NULL;
+static volatile unsigned sampleEvery = 0;
+static volatile LONGLONG slowTicks = 0;
+
+// Excludes producers while the tracer is being stopped
+static SRWLOCK tracerLock = SRWLOCK_INIT;
+static volatile LONG generations = 0;
+
+// Set from the start of startTracer until stopTracer finishes, so racing starts cannot both open a trace
+static volatile LONG tracerClaimed = 0;
+
+// The request being traced on each thread
+static thread_storage DBTraceScratch scratch;
+
+// The trace event name of each phase
+static const char *const phaseNames[DB_TRACE_PHASES] = {
+	[DB_TRACE_RECEIVE] = "receive",
+	[DB_TRACE_ADMIT] = "admit",
+	[DB_TRACE_VALIDATE] = "validate",
+	[DB_TRACE_IO] = "io",
+	[DB_TRACE_SEND] = "send",
+	[DB_TRACE_WAIT] = "wait",
+};
+
+
+/*	Name:           startTracer
+	Description:    Starts writing sampled and slow requests to a Chrome trace file
+	Parameters:     char *path:  The trace file path
+	                unsigned sample:  Trace one request in this many, or zero for only slow requests
+	                DWORD slowMs:  Always trace requests taking at least this long
+	                DBTracer **tracer:  The started tracer
+	Returns:        DBCode:  A return status code
+*/
+DBCode startTracer(const char *path, unsigned sample, DWORD slowMs, DBTracer **tracer) {
+
+	// Establish function preconditions
+	assert_assume(path != NULL);
+	assert_assume(tracer != NULL);
+
+	// Only one tracer runs in a process
+	if (InterlockedCompareExchange(&tracerClaimed, 1, 0) != 0) {
+		return DB_REQUEST_DENIED;
+	}
+
+	DBTracer *temp = calloc(1, sizeof(DBTracer));
+	if (temp == NULL) {
+		InterlockedExchange(&tracerClaimed, 0);
+		return DB_REQUEST_DENIED;
+	}
+
+	InitializeSRWLock(&temp->lock);
+	temp->generation = InterlockedIncrement(&generations);
+
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&counter);
+	temp->frequency = counter.QuadPart;
+	QueryPerformanceCounter(&counter);
+	temp->origin = counter.QuadPart;
+
+	temp->file = fopen(path, "w");
+	if (temp->file == NULL || fputs("{\"traceEvents\":[\n", temp->file) == EOF) {
+		if (temp->file != NULL) {
+			fclose(temp->file);
+		}
+		free(temp);
+		InterlockedExchange(&tracerClaimed, 0);
+		return DB_FILE_ERROR;
+	}
+
+	temp->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	temp->flusher = (temp->stopEvent != NULL) ? CreateThread(NULL, 0, flusherThread, temp, 0, NULL) : NULL;
+	if (temp->flusher == NULL) {
+		if (temp->stopEvent != NULL) {
+			CloseHandle(temp->stopEvent);
+		}
+		fclose(temp->file);
+		free(temp);
+		InterlockedExchange(&tracerClaimed, 0);
+		return DB_REQUEST_DENIED;
+	}
+
+	// Publish the settings before the tracer, so a thread that sees one sees both
+	AcquireSRWLockExclusive(&tracerLock);
+	sampleEvery = sample;
+	slowTicks = temp->frequency * slowMs / 1000;
+	activeTracer = temp;
+	ReleaseSRWLockExclusive(&tracerLock);
+
+	*tracer = temp;
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           stopTracer
+	Description:    Stops tracing, writes every request still queued and closes the trace file
+	Parameters:     DBTracer *tracer:  The tracer to stop
+	Returns:        DBCode:  A return status code
+*/
+DBCode stopTracer(DBTracer *tracer) {
+
+	if (tracer == NULL) {
+		return DB_SUCCESS;
+	}
+
+	// Once this returns no thread is pushing and none will push again
+	AcquireSRWLockExclusive(&tracerLock);
+	activeTracer = NULL;
+	ReleaseSRWLockExclusive(&tracerLock);
+
+	SetEvent(tracer->stopEvent);
+	WaitForSingleObject(tracer->flusher, INFINITE);
+	CloseHandle(tracer->flusher);
+	CloseHandle(tracer->stopEvent);
+
+	drainTraces(tracer);
+
+	DBCode status = DB_SUCCESS;
+	if (fputs("\n]}\n", tracer->file) == EOF) {
+		status = DB_FILE_ERROR;
+	}
+	if (fclose(tracer->file) != 0) {
+		status = DB_FILE_ERROR;
+	}
+
+	DBTraceRing *ring = tracer->rings;
+	while (ring != NULL) {
+		DBTraceRing *next = ring->next;
+		freeAligned(ring);
+		ring = next;
+	}
+
+	free(tracer);
+
+	// Another tracer may start only once this one has released everything
+	InterlockedExchange(&tracerClaimed, 0);
+
+	return status;
+}
+
+
+/*	Name:           readTraceStats
+	Description:    Reads the requests seen by a tracer
+	Parameters:     DBTracer *tracer:  The tracer to read
+	                DBTraceStats *stats:  The statistics read
+	Returns:        void
+*/
+void readTraceStats(DBTracer *tracer, DBTraceStats *stats) {
+
+	// Establish function preconditions
+	assert_assume(tracer != NULL);
+	assert_assume(stats != NULL);
+
+	stats->sampled = (uint64_t)InterlockedCompareExchange64(&tracer->sampled, 0, 0);
+	stats->slow = (uint64_t)InterlockedCompareExchange64(&tracer->slow, 0, 0);
+	stats->dropped = (uint64_t)InterlockedCompareExchange64(&tracer->dropped, 0, 0);
+
+	AcquireSRWLockShared(&tracer->lock);
+	stats->written = tracer->written;
+	ReleaseSRWLockShared(&tracer->lock);
+}
+
+
+/*	Name:           beginTrace
+	Description:    Starts timing a request on the calling thread, when a tracer is running
+	Parameters:     void
+	Returns:        void
+*/
+void beginTrace(void) {
+
+	// Volatile reads have acquire semantics under MSVC
+	scratch.active = activeTracer != NULL;
+	if (!scratch.active) {
+		return;
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	scratch.record.begin = now.QuadPart;
+	scratch.record.count = 0;
+}
+
+
+/*	Name:           markTrace
+	Description:    Records that the request on the calling thread has entered a phase
+	Parameters:     DBTracePhase phase:  The phase entered
+	Returns:        void
+*/
+void markTrace(DBTracePhase phase) {
+
+	// Establish function preconditions
+	assert_assume(0 <= phase && phase < DB_TRACE_PHASES);
+
+	if (!scratch.active || scratch.record.count == DB_TRACE_MAX_MARKS) {
+		return;
+	}
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	size_t index = scratch.record.count++;
+	scratch.record.phases[index] = (uint8_t)phase;
+	scratch.record.marks[index] = now.QuadPart;
+}
+
+
+/*	Name:           endTrace
+	Description:    Finishes the request on the calling thread, keeping it if it was sampled or slow
+	Parameters:     DBCode command:  The request handled
+	                DBCode status:  The status the request finished with
+	Returns:        void
+*/
+void endTrace(DBCode command, DBCode status) {
+
+	if (!scratch.active) {
+		return;
+	}
+	scratch.active = false;
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	DBTraceRecord *record = &scratch.record;
+	record->command = command;
+	record->status = status;
+	record->end = now.QuadPart;
+
+	// Decide without locking, so requests that are not kept cost only the clock reads
+	unsigned sample = sampleEvery;
+	record->slow = record->end - record->begin >= slowTicks;
+	bool sampled = sample != 0 && ++scratch.counter % sample == 0;
+	if (!record->slow && !sampled) {
+		return;
+	}
+
+	AcquireSRWLockShared(&tracerLock);
+
+	DBTracer *tracer = activeTracer;
+	if (tracer != NULL) {
+
+		DBTraceRing *ring = bindTraceRing(tracer);
+		if (ring == NULL || !pushTrace(ring, record)) {
+			InterlockedIncrement64(&tracer->dropped);
+		}
+		else {
+			InterlockedIncrement64(record->slow ? &tracer->slow : &tracer->sampled);
+		}
+	}
+
+	ReleaseSRWLockShared(&tracerLock);
+}
+
+
+/*	Name:           bindTraceRing
+	Description:    Finds or creates the calling thread's ring in a tracer
+	Parameters:     DBTracer *tracer:  The running tracer
+	Returns:        DBTraceRing *:  The thread's ring, or NULL
+*/
+DBTraceRing *bindTraceRing(DBTracer *tracer) {
+
+	// Establish function preconditions
+	assert_assume(tracer != NULL);
+
+	// A ring from an earlier tracer has already been freed
+	if (scratch.ring != NULL && scratch.generation == tracer->generation) {
+		return scratch.ring;
+	}
+
+	DBTraceRing *ring = allocateAligned(sizeof(DBTraceRing));
+	if (ring == NULL) {
+		return NULL;
+	}
+
+	ring->head = 0;
+	ring->tail = 0;
+	ring->threadId = GetCurrentThreadId();
+
+	AcquireSRWLockExclusive(&tracer->lock);
+	ring->next = tracer->rings;
+	tracer->rings = ring;
+	ReleaseSRWLockExclusive(&tracer->lock);
+
+	scratch.ring = ring;
+	scratch.generation = tracer->generation;
+
+	return ring;
+}
+
+
+/*	Name:           pushTrace
+	Description:    Appends a finished request to a ring from its only producer
+	Parameters:     DBTraceRing *ring:  The ring to append to
+	                DBTraceRecord *record:  The request to append
+	Returns:        bool:  Whether there was room for the request
+*/
+bool pushTrace(DBTraceRing *ring, const DBTraceRecord *record) {
+
+	LONG head = ring->head;
+	if ((ULONG)head - (ULONG)ring->tail == DB_TRACE_RING_SIZE) {
+		return false;
+	}
+
+	ring->records[(ULONG)head % DB_TRACE_RING_SIZE] = *record;
+
+	// Publish the request to the flusher
+	InterlockedExchange(&ring->head, (LONG)((ULONG)head + 1));
+
+	return true;
+}
+
+
+/*	Name:           popTrace
+	Description:    Removes a finished request from a ring from its only consumer
+	Parameters:     DBTraceRing *ring:  The ring to remove from
+	                DBTraceRecord *record:  The removed request
+	Returns:        bool:  Whether a request was available
+*/
+bool popTrace(DBTraceRing *ring, DBTraceRecord *record) {
+
+	LONG tail = ring->tail;
+	if (ring->head == tail) {
+		return false;
+	}
+
+	*record = ring->records[(ULONG)tail % DB_TRACE_RING_SIZE];
+
+	// Release the slot back to the producer
+	InterlockedExchange(&ring->tail, (LONG)((ULONG)tail + 1));
+
+	return true;
+}
+
+
+/*	Name:           requestName
+	Description:    Names a request code for the trace file
+	Parameters:     DBCode command:  The request code
+	Returns:        const char *:  The name of the request
+*/
+const char *requestName(DBCode command) {
+
+	switch (command) {
+	case DB_REQUEST_INSERT:     return "insert";
+	case DB_REQUEST_UPDATE:     return "update";
+	case DB_REQUEST_FIND:       return "find";
+	case DB_REQUEST_QUERY:      return "query";
+	case DB_REQUEST_EXPORT:     return "export";
+	case DB_REQUEST_BEGIN:      return "transaction";
+	case DB_REQUEST_AGGREGATE:  return "aggregate";
+	case DB_REQUEST_FILTER:     return "filter";
+	case DB_REQUEST_LOAD:       return "load";
+	case DB_REQUEST_SORTED:     return "sorted";
+	case DB_REQUEST_SUBSCRIBE:  return "subscribe";
+	case DB_REQUEST_LEASE:      return "lease";
+	case DB_REQUEST_FUZZY:      return "fuzzy";
+	default:                    return "request";
+	}
+}
+
+
+/*	Name:           traceMicroseconds
+	Description:    Converts performance counter ticks to microseconds since the tracer started
+	Parameters:     DBTracer *tracer:  The tracer writing the file
+	                LONGLONG ticks:  The performance counter value
+	Returns:        unsigned long long:  The Chrome trace timestamp
+*/
+unsigned long long traceMicroseconds(const DBTracer *tracer, LONGLONG ticks) {
+	return (unsigned long long)(ticks - tracer->origin) * 1'000'000 / (unsigned long long)tracer->frequency;
+}
+
+
+/*	Name:           writeTraceRecord
+	Description:    Writes a request and each of its phases as complete events in the trace file
+	Parameters:     DBTracer *tracer:  The tracer writing the file
+	                DWORD threadId:  The thread that handled the request
+	                DBTraceRecord *record:  The request to write
+	Returns:        void
+*/
+void writeTraceRecord(DBTracer *tracer, DWORD threadId, const DBTraceRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(tracer != NULL && tracer->file != NULL);
+	assert_assume(record != NULL);
+
+	fprintf(tracer->file,
+		"%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%llu,\"dur\":%llu,"
+		"\"args\":{\"code\":%u,\"status\":%u}}",
+		(tracer->written != 0) ? ",\n" : "",
+		requestName(record->command), record->slow ? "slow" : "sampled", (unsigned long)threadId,
+		traceMicroseconds(tracer, record->begin),
+		traceMicroseconds(tracer, record->end) - traceMicroseconds(tracer, record->begin),
+		(unsigned)record->command, (unsigned)record->status);
+
+	// Each phase lasts until the next one begins, or until the request ends
+	for (size_t i = 0; i < record->count; ++i) {
+
+		LONGLONG end = (i + 1 < record->count) ? record->marks[i + 1] : record->end;
+
+		fprintf(tracer->file,
+			",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%llu,\"dur\":%llu}",
+			phaseNames[record->phases[i]], (unsigned long)threadId,
+			traceMicroseconds(tracer, record->marks[i]),
+			traceMicroseconds(tracer, end) - traceMicroseconds(tracer, record->marks[i]));
+	}
+
+	++tracer->written;
+}
+
+
+/*	Name:           drainTraces
+	Description:    Writes every queued request to the trace file
+	Parameters:     DBTracer *tracer:  The tracer to drain
+	Returns:        void
+*/
+void drainTraces(DBTracer *tracer) {
+
+	// Establish function preconditions
+	assert_assume(tracer != NULL);
+
+	// Only the flusher writes, so holding the list exclusively costs producers nothing but new rings
+	AcquireSRWLockExclusive(&tracer->lock);
+
+	DBTraceRecord record;
+	for (DBTraceRing *ring = tracer->rings; ring != NULL; ring = ring->next) {
+		while (popTrace(ring, &record)) {
+			writeTraceRecord(tracer, ring->threadId, &record);
+		}
+	}
+
+	fflush(tracer->file);
+
+	ReleaseSRWLockExclusive(&tracer->lock);
+}
+
+
+/*	Name:           flusherThread
+	Description:    Periodically writes queued requests until signalled to stop
+	Parameters:     LPVOID param:  The tracer to flush
+	Returns:        DWORD:  The thread exit code
+*/
+static DWORD WINAPI flusherThread(LPVOID param) {
+
+	DBTracer *tracer = param;
+
+	while (WaitForSingleObject(tracer->stopEvent, DB_TRACE_FLUSH_INTERVAL_MS) == WAIT_TIMEOUT) {
+		drainTraces(tracer);
+	}
+
+	return 0;
+}
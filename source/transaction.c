@@ -0,0 +1,375 @@
+
+#include "extra.h"
+#include "transaction.h"
+#include "snapshot.h"
+#include "arena.h"
+#include "storage.h"
+#include "record.h"
+#include "scheduler.h"
+
+#include <io.h>
+
+
+// A struct to store the writes buffered by an open transaction
+typedef struct DBWriteSet {
+
+	// The operation of each buffered write, either an insert or an update
+	DBCode operations[DB_TRANSACTION_MAX_WRITES];
+	DBRecord records[DB_TRANSACTION_MAX_WRITES];
+
+	// The image each write replaced, restored if a later write fails
+	DBRecord before[DB_TRANSACTION_MAX_WRITES];
+
+	size_t count;
+	size_t inserts;
+} DBWriteSet;
+
+
+// Prototypes for applying a write set
+DBCode validateWriteSet(const DBWriteSet *, DBIndex);
+DBCode applyWriteSet(DBContext *, DBWriteSet *, DBIndex *);
+void rollbackWriteSet(DBContext *, const DBWriteSet *, size_t, DBIndex);
+
+
+
+/*	Name:           validateWriteSet
+	Description:    Checks that every buffered write can be applied
+	Parameters:     DBWriteSet *writes:  The write set to validate
+	                DBIndex entries:  The number of entries in the database
+	Returns:        DBCode:  A return status code
+*/
+DBCode validateWriteSet(const DBWriteSet *writes, DBIndex entries) {
+
+	// Establish function preconditions
+	assert_assume(writes != NULL);
+
+	// Validate the database capacity
+	if (writes->inserts > (size_t)(DB_MAX_ENTRY - entries)) {
+		return DB_REQUEST_DENIED;
+	}
+
+	// Updates may target records inserted earlier in the same transaction
+	DBIndex visible = entries;
+	for (size_t i = 0; i < writes->count; ++i) {
+		if (!validRecordDate(&writes->records[i].birthDate)) {
+			return DB_REQUEST_DENIED;
+		}
+		if (writes->operations[i] == DB_REQUEST_INSERT) {
+			++visible;
+		}
+		else if (writes->records[i].memberId < DB_MIN_ENTRY
+			|| writes->records[i].memberId > visible) {
+			return DB_REQUEST_DENIED;
+		}
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           applyWriteSet
+	Description:    Applies every buffered write as a single commit, or none of them
+	Parameters:     DBContext *context:  The database state to apply the writes to
+	                DBWriteSet *writes:  The write set to apply
+	                DBIndex *firstInsert:  The memberId assigned to the first insert
+	Returns:        DBCode:  A return status code
+*/
+DBCode applyWriteSet(DBContext *context, DBWriteSet *writes, DBIndex *firstInsert) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(writes != NULL);
+	assert_assume(firstInsert != NULL);
+
+	// Exclude other writers and snapshots for the whole group
+	if (context->versions != NULL) {
+		beginCommit(context->versions);
+	}
+
+	DBCode status = validateWriteSet(writes, context->entries);
+
+	DBIndex entries = context->entries;
+	*firstInsert = (writes->inserts != 0) ? entries + 1 : 0;
+
+	// The number of writes that may have reached the file, including a failed one whose image was kept
+	size_t written = 0;
+	for (size_t i = 0; status == DB_SUCCESS && i < writes->count; ++i) {
+
+		DBRecord *record = &writes->records[i];
+		if (writes->operations[i] == DB_REQUEST_INSERT) {
+			record->memberId = context->entries + 1;
+		}
+
+		// Keep the image being replaced, so a later failure can put it back
+		if (record->memberId <= entries) {
+			status = seekRecord(context->file, record->memberId);
+			if (status == DB_SUCCESS) {
+				status = readRecord(context->file, &writes->before[i]);
+			}
+		}
+		if (status == DB_SUCCESS) {
+			written = i + 1;
+		}
+
+		if (status == DB_SUCCESS && context->versions != NULL) {
+			status = preserveRecord(context->versions, context->file, record->memberId, context->entries);
+		}
+		if (status == DB_SUCCESS) {
+			status = seekRecord(context->file, record->memberId);
+		}
+		if (status == DB_SUCCESS) {
+			status = writeRecord(context->file, record);
+		}
+
+		if (status == DB_SUCCESS && writes->operations[i] == DB_REQUEST_INSERT) {
+			++context->entries;
+		}
+	}
+
+	// Subscribers, resident pages and indexes only ever see the whole group
+	if (status != DB_SUCCESS && written != 0) {
+		rollbackWriteSet(context, writes, written, entries);
+	}
+	else if (status == DB_SUCCESS) {
+		for (size_t i = 0; context->versions != NULL && i < writes->count; ++i) {
+			DBIndex visible = (writes->operations[i] == DB_REQUEST_INSERT) ? writes->records[i].memberId - 1 : context->entries;
+			logCommitRecord(context->versions, &writes->records[i], visible);
+		}
+		noteRecordWrites(context, writes->records, writes->count);
+	}
+
+	// A single flush and sequence number publishes the whole group
+	if (context->versions != NULL) {
+		DBCode result = endCommit(context->versions, context->file);
+		CONDITIONAL_RETURN(status);
+		CONDITIONAL_RETURN(result);
+	}
+	else {
+		CONDITIONAL_RETURN(status);
+		if (scheduledFlush(context->file) != 0) {
+			return DB_FILE_ERROR;
+		}
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           rollbackWriteSet
+	Description:    Undoes the writes applied before one failed, restoring updated images and dropping inserts
+	Parameters:     DBContext *context:  The database state the writes were applied to
+	                DBWriteSet *writes:  The write set being applied
+	                size_t written:  The number of writes that may have reached the file
+	                DBIndex entries:  The number of entries before the first write
+	Returns:        void
+*/
+void rollbackWriteSet(DBContext *context, const DBWriteSet *writes, size_t written, DBIndex entries) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(writes != NULL);
+	assert_assume(written <= writes->count);
+
+	// Restore in reverse, so a record written twice ends with its oldest image
+	for (size_t i = written; i-- > 0;) {
+		const DBRecord *record = &writes->records[i];
+		if (record->memberId <= entries && seekRecord(context->file, record->memberId) == DB_SUCCESS) {
+			writeRecord(context->file, &writes->before[i]);
+		}
+	}
+
+	// Inserted records all lie past the old end of the file, including one that failed part way
+	if (writes->inserts != 0) {
+		fflush(context->file);
+		_chsize_s(_fileno(context->file), (long long)entries * DB_SLOT_SIZE);
+		context->entries = entries;
+	}
+}
+
+
+/*	Name:           handleTransactionRequest
+	Description:    Handles a database transaction request from the server-side
+	Parameters:     DBContext *context:  The database state to handle the request with
+	                SOCKET socket:  The database socket to handle the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode handleTransactionRequest(DBContext *context, SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(context != NULL && context->file != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	DBWriteSet *writes = allocateRequestMemory(sizeof(DBWriteSet));
+	if (writes == NULL) {
+		return DB_REQUEST_DENIED;
+	}
+	writes->count = 0;
+	writes->inserts = 0;
+
+	// Send a confirmation code
+	DBCode status = sendCode(socket, DB_REQUEST_SUCCESS);
+
+	// Buffer writes without acknowledging them until the transaction ends
+	DBCode operation = DB_REQUEST_BEGIN;
+	bool overflow = false;
+	while (status == DB_SUCCESS) {
+
+		status = receiveCode(socket, &operation);
+		if (status != DB_SUCCESS
+			|| operation == DB_REQUEST_COMMIT
+			|| operation == DB_REQUEST_ABORT) {
+			break;
+		}
+
+		// Anything else leaves the stream out of sync
+		if (operation != DB_REQUEST_INSERT && operation != DB_REQUEST_UPDATE) {
+			status = DB_REQUEST_DENIED;
+			break;
+		}
+
+		// Keep draining an oversized transaction so the commit is still answered
+		DBRecord record;
+		status = receiveRecord(socket, &record, operation == DB_REQUEST_UPDATE);
+		if (status == DB_SUCCESS && writes->count == DB_TRANSACTION_MAX_WRITES) {
+			overflow = true;
+		}
+		else if (status == DB_SUCCESS) {
+			writes->operations[writes->count] = operation;
+			writes->records[writes->count] = record;
+			++writes->count;
+			if (operation == DB_REQUEST_INSERT) {
+				++writes->inserts;
+			}
+		}
+	}
+
+	DBIndex firstInsert = 0;
+	if (status == DB_SUCCESS && operation == DB_REQUEST_COMMIT) {
+		status = overflow ? DB_REQUEST_DENIED : applyWriteSet(context, writes, &firstInsert);
+	}
+
+	freeRequestMemory(writes);
+
+	CONDITIONAL_RETURN(status);
+
+	// Send a completion code
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_SUCCESS));
+
+	// Send the memberId assigned to the first insert
+	if (operation == DB_REQUEST_COMMIT) {
+		CONDITIONAL_RETURN(sendIndex(socket, firstInsert));
+	}
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendBeginRequest
+	Description:    Sends a database transaction begin request from the client-side
+	Parameters:     SOCKET socket:  The database socket to send the request with
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendBeginRequest(SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_BEGIN));
+
+	// Receive a confirmation code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	return response;
+}
+
+
+/*	Name:           sendTransactionInsert
+	Description:    Buffers an insert in the open transaction from the client-side
+	Parameters:     SOCKET socket:  The database socket holding the transaction
+	                DBRecord *record:  The record to insert
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendTransactionInsert(SOCKET socket, const DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(record != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the operation and record without waiting for a response
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_INSERT));
+	CONDITIONAL_RETURN(sendRecord(socket, record, false));
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendTransactionUpdate
+	Description:    Buffers an update in the open transaction from the client-side
+	Parameters:     SOCKET socket:  The database socket holding the transaction
+	                DBRecord *record:  The record to update
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendTransactionUpdate(SOCKET socket, const DBRecord *record) {
+
+	// Establish function preconditions
+	assert_assume(record != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the operation and record without waiting for a response
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_UPDATE));
+	CONDITIONAL_RETURN(sendRecord(socket, record, true));
+
+	return DB_SUCCESS;
+}
+
+
+/*	Name:           sendCommitRequest
+	Description:    Commits the open transaction from the client-side
+	Parameters:     SOCKET socket:  The database socket holding the transaction
+	                DBIndex *firstInsert:  The memberId assigned to the first insert, or 0
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendCommitRequest(SOCKET socket, DBIndex *firstInsert) {
+
+	// Establish function preconditions
+	assert_assume(firstInsert != NULL);
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_COMMIT));
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+	if (response != DB_REQUEST_SUCCESS) {
+		return response;
+	}
+
+	// Receive the memberId assigned to the first insert
+	CONDITIONAL_RETURN(receiveIndex(socket, firstInsert));
+
+	return response;
+}
+
+
+/*	Name:           sendAbortRequest
+	Description:    Discards the open transaction from the client-side
+	Parameters:     SOCKET socket:  The database socket holding the transaction
+	Returns:        DBCode:  A return status code
+*/
+DBCode sendAbortRequest(SOCKET socket) {
+
+	// Establish function preconditions
+	assert_assume(socket != INVALID_SOCKET);
+
+	// Send the database command
+	CONDITIONAL_RETURN(sendCode(socket, DB_REQUEST_ABORT));
+
+	// Receive a completion code
+	DBCode response;
+	CONDITIONAL_RETURN(receiveCode(socket, &response));
+
+	return response;
+}